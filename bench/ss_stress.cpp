@@ -0,0 +1,432 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// ss_stress.cpp: multithreaded contention & scaling harness
+//
+// Runs a mixed workload (get / set / add+remove storage / save) against one
+// configuration from N threads for a fixed amount of time, then reports throughput
+// and latency percentiles for each operation. Run it for several thread counts to
+// get a scaling curve:
+//
+//   ss_stress --threads 1,2,4,8 --seconds 2 --keys 1000 --mix 80,15,3,2
+//
+// --mix is read,write,storage,save (relative weights). Build with -DSS_ENABLE_TSAN=ON
+// to run the same workload under ThreadSanitizer. The RNG seed is fixed (--seed), so
+// runs are reproducible as far as the thread scheduler lets them be.
+//
+// --storage memory uses memory_storage instead of file_storage everywhere, which gives
+// a baseline without any file I/O.
+//
+// When the library is built with SETTING_TRACE, --trace FILE dumps the events of the
+// last run as Chrome trace-event JSON. When it's built with SETTING_LOCK_STATS, the
+// per-lock statistics of each run are printed as well.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ss/setting.h"
+#include "ss/file_storage.h"
+#include "ss/memory_storage.h"
+#include "ss/trace.h"
+#include "ss/lock_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ss {
+    // the library needs this - the harness uses its own configuration, so nothing to do here
+    void init_settings() {}
+}
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+enum op_type {
+    op_read,
+    op_write,
+    op_storage,
+    op_save,
+    op_count
+};
+
+const char * op_names[op_count] = { "read", "write", "storage", "save" };
+
+/*
+    log-linear latency histogram (nanoseconds).
+
+    Each power of two is split into 16 linear sub-buckets, so any percentile is
+    reported with < ~6% error, and recording is just a couple of shifts.
+*/
+class latency_histogram {
+    enum { sub_bits = 4, sub_count = 1 << sub_bits, max_pow = 40 };
+public:
+    latency_histogram() : m_buckets( (max_pow + 1) * sub_count, 0), m_count(0), m_max(0) {}
+
+    void record(unsigned long long ns) {
+        ++m_buckets[ bucket_of(ns) ];
+        ++m_count;
+        if ( ns > m_max) m_max = ns;
+    }
+
+    void merge(const latency_histogram & other) {
+        for ( size_t i = 0; i < m_buckets.size(); ++i)
+            m_buckets[i] += other.m_buckets[i];
+        m_count += other.m_count;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    unsigned long long count() const { return m_count; }
+    unsigned long long max() const { return m_max; }
+
+    // p in [0,1]; returns the upper bound of the bucket holding that percentile
+    unsigned long long percentile(double p) const {
+        if ( m_count == 0)
+            return 0;
+        unsigned long long wanted = (unsigned long long)(p * (double)m_count);
+        if ( wanted >= m_count) wanted = m_count - 1;
+        unsigned long long seen = 0;
+        for ( size_t i = 0; i < m_buckets.size(); ++i) {
+            seen += m_buckets[i];
+            if ( seen > wanted)
+                return std::min( upper_bound_of(i), m_max);
+        }
+        return m_max;
+    }
+
+private:
+    static size_t bucket_of(unsigned long long ns) {
+        if ( ns < sub_count)
+            return (size_t)ns;
+        int pow = 63 - count_leading_zeros(ns);
+        if ( pow > max_pow) return (max_pow + 1) * sub_count - 1;
+        size_t sub = (size_t)((ns >> (pow - sub_bits)) & (sub_count - 1));
+        return (size_t)(pow - sub_bits + 1) * sub_count + sub;
+    }
+    static unsigned long long upper_bound_of(size_t bucket) {
+        if ( bucket < sub_count)
+            return bucket;
+        int pow = (int)(bucket / sub_count) + sub_bits - 1;
+        unsigned long long sub = bucket % sub_count;
+        return ((sub_count + sub + 1) << (pow - sub_bits)) - 1;
+    }
+    static int count_leading_zeros(unsigned long long x) {
+        int n = 0;
+        for ( unsigned long long bit = 1ULL << 63; bit && !(x & bit); bit >>= 1) ++n;
+        return n;
+    }
+
+private:
+    std::vector<unsigned long long> m_buckets;
+    unsigned long long m_count;
+    unsigned long long m_max;
+};
+
+// xorshift - we don't want the RNG to show up in the profile
+struct rng {
+    explicit rng(unsigned long long seed) : m_state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+    unsigned long long next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+    unsigned long long m_state;
+};
+
+struct options {
+    options() : seconds(2), keys(1000), seed(42), csv(false), read_cache(false), in_memory(false), dir(".") {
+        threads.push_back(1); threads.push_back(2); threads.push_back(4); threads.push_back(8);
+        mix[op_read] = 80; mix[op_write] = 15; mix[op_storage] = 3; mix[op_save] = 2;
+    }
+    std::vector<int> threads;
+    double seconds;
+    int keys;
+    int mix[op_count];
+    unsigned long long seed;
+    bool csv;
+    bool read_cache;
+    bool in_memory;
+    std::string dir;
+    std::string trace_file;
+};
+
+struct thread_result {
+    latency_histogram hist[op_count];
+};
+
+struct run_result {
+    int threads;
+    double elapsed_sec;
+    latency_histogram hist[op_count];
+
+    unsigned long long total_ops() const {
+        unsigned long long n = 0;
+        for ( int i = 0; i < op_count; ++i) n += hist[i].count();
+        return n;
+    }
+};
+
+std::atomic<unsigned long long> g_errors(0);
+void count_error(int, const ss::string&) {
+    ++g_errors;
+}
+
+std::vector<int> parse_int_list(const char * str) {
+    std::vector<int> result;
+    const char * cur = str;
+    while ( *cur) {
+        char * end = 0;
+        long val = std::strtol(cur, &end, 10);
+        if ( end == cur) break;
+        result.push_back((int)val);
+        cur = (*end == ',') ? end + 1 : end;
+    }
+    return result;
+}
+
+ss::setting_storage * new_storage(const options & opt, const std::string & file_name) {
+    if ( opt.in_memory)
+        return new ss::memory_storage();
+    return new ss::file_storage(opt.dir + "/" + file_name, ss::file_storage::open_writable, ss::file_storage::save_on_request);
+}
+
+std::string key_name(const char * place, int idx) {
+    char buff[64];
+    std::snprintf(buff, sizeof(buff), "%s.key%d", place, idx);
+    return buff;
+}
+
+void worker(ss::configuration & cfg, const options & opt, int thread_idx, const std::vector<std::string> & names,
+            const std::atomic<bool> & start, const std::atomic<bool> & stop, thread_result & out) {
+    rng r( opt.seed * 7919 + thread_idx);
+    int total_weight = 0;
+    for ( int i = 0; i < op_count; ++i) total_weight += opt.mix[i];
+
+    char tmp_name[32];
+    std::snprintf(tmp_name, sizeof(tmp_name), "tmp%d", thread_idx);
+    const std::string tmp_file = std::string("ss_stress_") + tmp_name + ".txt";
+    const std::string tmp_key = std::string(tmp_name) + ".value";
+
+    while ( !start.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+    while ( !stop.load(std::memory_order_relaxed)) {
+        int pick = (int)(r.next() % (unsigned long long)total_weight);
+        int op = 0;
+        while ( pick >= opt.mix[op]) { pick -= opt.mix[op]; ++op; }
+
+        const std::string & name = names[ r.next() % names.size() ];
+        clock_type::time_point begin = clock_type::now();
+        switch ( op) {
+        case op_read: {
+            long val = ss::setting<long>(name, cfg);
+            (void)val;
+            } break;
+        case op_write:
+            ss::setting<long>(name, cfg) = (long)(r.next() & 0xFFFF);
+            break;
+        case op_storage:
+            cfg.add_storage(tmp_name, new_storage(opt, tmp_file));
+            ss::setting<long>(tmp_key, cfg) = thread_idx;
+            cfg.remove_storage(tmp_name);
+            break;
+        case op_save:
+            // wait until it's on disk
+            cfg.save().wait();
+            break;
+        }
+        clock_type::time_point end = clock_type::now();
+        out.hist[op].record( (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() );
+    }
+}
+
+run_result run_once(const options & opt, int thread_count) {
+    ss::configuration cfg;
+    cfg.set_error_handler(count_error);
+    cfg.use_read_cache(opt.read_cache);
+    cfg.add_storage("", new_storage(opt, "ss_stress_root.txt"));
+    cfg.add_storage("app", new_storage(opt, "ss_stress_app.txt"));
+
+    // half the keys live in the root storage, half in "app"
+    std::vector<std::string> names;
+    for ( int i = 0; i < opt.keys; ++i) {
+        names.push_back( key_name( (i % 2) ? "app" : "root", i));
+        ss::setting<long>(names.back(), cfg) = i;
+    }
+    cfg.save().wait();
+
+    std::vector<thread_result> results(thread_count);
+    std::vector<std::thread> threads;
+    std::atomic<bool> start(false), stop(false);
+    for ( int i = 0; i < thread_count; ++i)
+        threads.push_back( std::thread(worker, std::ref(cfg), std::cref(opt), i, std::cref(names),
+                                       std::cref(start), std::cref(stop), std::ref(results[i])) );
+
+    clock_type::time_point begin = clock_type::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for( std::chrono::duration<double>(opt.seconds));
+    stop.store(true);
+    for ( size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    clock_type::time_point end = clock_type::now();
+
+    run_result result;
+    result.threads = thread_count;
+    result.elapsed_sec = std::chrono::duration<double>(end - begin).count();
+    for ( int t = 0; t < thread_count; ++t)
+        for ( int op = 0; op < op_count; ++op)
+            result.hist[op].merge(results[t].hist[op]);
+    return result;
+}
+
+double to_us(unsigned long long ns) { return (double)ns / 1000.0; }
+
+void print_run(const run_result & r) {
+    std::printf("threads=%d  elapsed=%.2fs  ops=%llu  throughput=%.0f ops/s\n",
+        r.threads, r.elapsed_sec, r.total_ops(), (double)r.total_ops() / r.elapsed_sec);
+    std::printf("  %-8s %12s %10s %10s %10s %10s %10s\n", "op", "count", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)");
+    for ( int op = 0; op < op_count; ++op) {
+        const latency_histogram & h = r.hist[op];
+        if ( h.count() == 0) continue;
+        std::printf("  %-8s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", op_names[op], h.count(),
+            to_us(h.percentile(0.50)), to_us(h.percentile(0.90)), to_us(h.percentile(0.99)),
+            to_us(h.percentile(0.999)), to_us(h.max()));
+    }
+}
+
+void print_scaling(const std::vector<run_result> & runs) {
+    if ( runs.empty()) return;
+    double base = (double)runs[0].total_ops() / runs[0].elapsed_sec / runs[0].threads;
+    std::printf("\nscaling (relative to %d thread%s):\n", runs[0].threads, runs[0].threads > 1 ? "s" : "");
+    std::printf("  %8s %14s %10s %12s\n", "threads", "ops/s", "speedup", "efficiency");
+    for ( size_t i = 0; i < runs.size(); ++i) {
+        double ops = (double)runs[i].total_ops() / runs[i].elapsed_sec;
+        double speedup = base > 0 ? ops / (base * runs[0].threads) : 0;
+        double efficiency = base > 0 ? ops / (base * runs[i].threads) : 0;
+        std::printf("  %8d %14.0f %10.2f %11.0f%%\n", runs[i].threads, ops, speedup, efficiency * 100);
+    }
+}
+
+void print_csv(const std::vector<run_result> & runs) {
+    std::printf("threads,op,count,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    for ( size_t i = 0; i < runs.size(); ++i)
+        for ( int op = 0; op < op_count; ++op) {
+            const latency_histogram & h = runs[i].hist[op];
+            std::printf("%d,%s,%llu,%.0f,%llu,%llu,%llu,%llu,%llu\n", runs[i].threads, op_names[op], h.count(),
+                (double)h.count() / runs[i].elapsed_sec, h.percentile(0.50), h.percentile(0.90),
+                h.percentile(0.99), h.percentile(0.999), h.max());
+        }
+}
+
+void usage() {
+    std::cerr <<
+        "usage: ss_stress [options]\n"
+        "  --threads N[,N...]   thread counts to run (default 1,2,4,8)\n"
+        "  --seconds S          duration of each run (default 2)\n"
+        "  --keys K             number of settings (default 1000)\n"
+        "  --mix R,W,S,V        weights for read,write,storage add/remove,save (default 80,15,3,2)\n"
+        "  --seed N             RNG seed (default 42)\n"
+        "  --dir PATH           where to put the settings files (default .)\n"
+        "  --csv                machine-readable output\n"
+        "  --read-cache         turn on the per-thread read cache\n"
+        "  --storage file|memory  storage type to use (default file)\n"
+        "  --trace FILE         dump a Chrome trace of the last run (needs SETTING_TRACE)\n";
+}
+
+bool parse_args(int argc, char ** argv, options & opt) {
+    for ( int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        const char * val = (i + 1 < argc) ? argv[i + 1] : 0;
+        if ( !std::strcmp(arg, "--csv")) { opt.csv = true; continue; }
+        if ( !std::strcmp(arg, "--read-cache")) { opt.read_cache = true; continue; }
+        if ( !val) return false;
+        if ( !std::strcmp(arg, "--threads")) opt.threads = parse_int_list(val);
+        else if ( !std::strcmp(arg, "--seconds")) opt.seconds = std::atof(val);
+        else if ( !std::strcmp(arg, "--keys")) opt.keys = std::atoi(val);
+        else if ( !std::strcmp(arg, "--seed")) opt.seed = std::strtoull(val, 0, 10);
+        else if ( !std::strcmp(arg, "--dir")) opt.dir = val;
+        else if ( !std::strcmp(arg, "--trace")) opt.trace_file = val;
+        else if ( !std::strcmp(arg, "--storage")) {
+            if ( !std::strcmp(val, "memory")) opt.in_memory = true;
+            else if ( !std::strcmp(val, "file")) opt.in_memory = false;
+            else return false;
+        }
+        else if ( !std::strcmp(arg, "--mix")) {
+            std::vector<int> mix = parse_int_list(val);
+            if ( mix.size() != op_count) return false;
+            for ( int op = 0; op < op_count; ++op) opt.mix[op] = mix[op];
+        }
+        else return false;
+        ++i;
+    }
+    int total = 0;
+    for ( int op = 0; op < op_count; ++op) total += opt.mix[op];
+    return !opt.threads.empty() && opt.keys > 0 && opt.seconds > 0 && total > 0;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    options opt;
+    if ( !parse_args(argc, argv, opt)) {
+        usage();
+        return 1;
+    }
+
+#ifdef SS_IS_TRACING
+    ss::trace::enable( !opt.trace_file.empty());
+#else
+    if ( !opt.trace_file.empty())
+        std::fprintf(stderr, "--trace ignored: library built without SETTING_TRACE\n");
+#endif
+
+    std::vector<run_result> runs;
+    for ( size_t i = 0; i < opt.threads.size(); ++i) {
+#ifdef SS_IS_TRACING
+        ss::trace::clear();
+#endif
+        ss::lock_stats::reset();
+        runs.push_back( run_once(opt, opt.threads[i]));
+        if ( !opt.csv) {
+            print_run(runs.back());
+#ifdef SS_LOCK_STATS
+            ss::lock_stats::dump(std::cout);
+#endif
+            std::printf("\n");
+        }
+    }
+
+    if ( opt.csv)
+        print_csv(runs);
+    else
+        print_scaling(runs);
+
+#ifdef SS_IS_TRACING
+    if ( !opt.trace_file.empty() && !ss::trace::dump_chrome_trace(opt.trace_file))
+        std::fprintf(stderr, "cannot write %s\n", opt.trace_file.c_str());
+#endif
+
+    if ( g_errors.load())
+        std::fprintf(stderr, "%llu library errors reported\n", g_errors.load());
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// access_profile.h: records the settings read at startup, and prefetches them on the next start
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_ACCESS_PROFILE_H)
+#define SS_ACCESS_PROFILE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include "ss/settings_table.h"
+#include <atomic>
+#include <future>
+#include <map>
+#include <vector>
+
+namespace ss {
+
+class configuration;
+
+namespace detail {
+
+/*
+    The startup profile of a configuration - see configuration::use_startup_profile().
+
+    The profile file has one (full) setting name per line, in the order they were first read.
+
+    Prefetching: the names are grouped by storage, and each storage's settings are read in parallel
+    (on the library's thread pool), into a table per storage. Reads are served from these tables, lock-free -
+    until storages are added/removed, or that storage reloads. A setting that's set through the configuration
+    is dropped from the table. Settings not prefetched (yet) are read from their storage, as usual.
+    Storages that find out about changes as they're read (shared files, shared memory) are never prefetched.
+
+    Recording: the first read of each setting is recorded (lock-free once it's recorded),
+    until 'seconds' pass - then the file is written, in the background.
+*/
+class access_profile {
+    access_profile(const access_profile&);
+    void operator=(const access_profile&);
+public:
+    access_profile(configuration & conf, const std::string & file_name, int seconds);
+    // waits for the prefetching to end; if still recording, writes the file
+    ~access_profile();
+
+    // reads the file (if any), and starts prefetching what it says
+    void prefetch();
+
+    // lock-free. False if it's not prefetched (or it's stale)
+    bool find(const string & place, const string & sett_name, string & value, typeinfo & type) const;
+    void on_read(const string & place, const string & sett_name);
+    // the setting was set - what we prefetched for it is stale
+    void on_set(const string & place, const string & sett_name);
+
+    // stops recording, and writes the file. Returns false if it could not be written
+    bool finish();
+
+private:
+    // what we prefetch from a storage
+    struct prefetched {
+        prefetched(setting_storage * storage);
+        ~prefetched();
+        // use()-d while we exist
+        setting_storage * storage;
+        // the values are valid as long as the storage's reloads() is this
+        unsigned long reloads;
+        settings_table values;
+        // the names set since we started prefetching
+        settings_table dropped;
+    };
+    void prefetch_storage(prefetched * from, const std::vector<string> * names);
+    bool is_stale(const prefetched & from) const;
+    bool write_file();
+    static long long now_ms();
+
+private:
+    configuration & m_conf;
+    std::string m_file_name;
+
+    // place -> what we prefetched from it (filled on the thread pool)
+    typedef std::map<string, prefetched*> prefetched_coll;
+    prefetched_coll m_prefetched;
+    std::map<string, std::vector<string> > m_names;
+    std::vector< std::shared_future<void> > m_prefetchers;
+    // the prefetched values are valid as long as the configuration's layout_version() is this
+    unsigned long long m_layout_version;
+    // the file, being written in the background (see on_read())
+    std::shared_future<void> m_written;
+    // guards ending the recording, and m_written
+    critical_section m_written_cs;
+
+    // the settings read so far (in the order they were first read)
+    settings_table m_recorded;
+    std::atomic<bool> m_recording;
+    long long m_record_until;
+};
+
+}}
+
+#endif
@@ -31,13 +31,21 @@
 #include <map>
 #include <string>
 #include <set>
+#include <future>
+#include <memory>
+#include <vector>
 #include "ss/defaults_holder.h"
 #include "ss/bulk_setting.h"
 #include "ss/enum.h"
+#include "ss/read_cache.h"
+#include "ss/memory_resource.h"
+#include "ss/schema.h"
+#include "ss/merkle.h"
 
 namespace ss {
 
 class setting_storage;
+namespace detail { class access_profile; }
 
 /*
     A configuration contains multiple settings that can be get/set.
@@ -78,10 +86,31 @@ public:
     void remove_storage( const string & storage_name);
     void remove_all_storages();
 
-    void save();
+    // storages load their settings the first time they're accessed (see setting_storage::load()).
+    // If on, storages added from now on start loading right away, on a thread pool - in parallel with
+    // each other, and with whatever the program does meanwhile (accessing one waits until it's loaded).
+    // Note: with a schema, a storage is loaded (and checked) when it's added
+    void load_in_background(bool on) { m_load_in_background.store(on, std::memory_order_relaxed); }
+    // waits until the storages that load in the background, have loaded
+    void wait_for_loads();
+
+    // starts saving all storages; storages that can, save in the background.
+    // Wait on the result if you need the settings to be on disk (true = all saved successfully)
+    std::shared_future<bool> save();
+    // streams the settings whose (full) names start with 'prefix' to the visitor: storage by storage,
+    // each in name order. Returns false if the visitor stopped it
+    bool visit_settings( const string & prefix, const setting_visitor & visitor);
     void copy_into( configuration & other );
     void copy_into_no_overwrite( configuration & other);
 
+    // the settings that differ in 'other' (with other's values) - applied to this configuration, they make it the same.
+    // Both configurations keep per-prefix hashes of their settings (see ss/merkle.h) from the first diff on,
+    // so comparing only descends where they differ
+    void diff( configuration & other, settings_delta & changes);
+    // sets all the changes in one go: a read_view sees all of them, or none.
+    // (settings can't be removed - removed ones are reported as errors)
+    void apply( const settings_delta & changes);
+
     void add_default_value(const string & name, string & value, const typeinfo & type) ;
     void get_default_value(const string & name, string & value, typeinfo & type, bool & has_default) const;
     void add_enum_value(const typeinfo & type, int enum_, const string& str);
@@ -90,27 +119,157 @@ public:
     void set_error_handler(error_handler_func func);
     error_handler_func get_error_handler() const;
 
+    // if on, each thread caches the (converted) values it reads from this configuration,
+    // until anything changes - see ss/read_cache.h
+    void use_read_cache(bool on) { m_use_read_cache.store(on, std::memory_order_relaxed); }
+    bool uses_read_cache() const { return m_use_read_cache.load(std::memory_order_relaxed); }
+    // call this when a value changed behind the configuration's back (like, a storage reloaded)
+    static void invalidate_read_caches() { detail::bump_read_cache_epoch(); }
+
+    // what values the settings can have (see ss/schema.h). The storages we have are checked right away
+    void set_schema(const schema & s);
+    // lock-free. 0 if there's no schema
+    const schema * get_schema() const { return m_schema.load(std::memory_order_acquire); }
+    // the value of a setting, as converted by the schema (false if it's not available)
+    bool get_typed( const string & place, const string & sett_name, typed_value & typed);
+
+    // startup profile (see ss/access_profile.h): prefetches the settings that were read at startup last time
+    // (as recorded in this file, if it exists), in parallel per storage; then records the settings read
+    // during the next 'seconds' into the file, for next time. Call it once, after adding the storages
+    void use_startup_profile(const std::string & file_name, int seconds = 10);
+
+    // changes each time storages are added/removed (so names resolved before need to be resolved again)
+    unsigned long long layout_version() const { return m_layout_version.load(std::memory_order_acquire); }
+
+    /*
+        A consistent view of the settings: all reads through it see the settings as they were
+        when the view was created, even if other threads set them meanwhile.
+
+        configuration::read_view view;
+        string host = view.get<string>("db.host");
+        int port = view.get<int>("db.port");
+
+        Reads don't block writers, and writers don't block reads. While there are views, each set_setting()
+        keeps the value it overwrote, until no view needs it anymore.
+        Only changes made through the configuration are versioned (not storages that reload, or storages
+        added/removed meanwhile).
+    */
+    class read_view {
+        read_view(const read_view&);
+        void operator=(const read_view&);
+    public:
+        explicit read_view(configuration & conf = configuration::def());
+        ~read_view();
+
+        template<class type> type get(const string & name) const;
+        void get_setting( const string & place, const string & sett_name, string & value, typeinfo &type) const;
+
+        unsigned long long version() const { return m_version; }
+    private:
+        configuration & m_conf;
+        unsigned long long m_version;
+    };
+
+    // where the defaults, enums (and the storages that don't have their own resource) allocate from.
+    // Set it before adding settings/storages - what's already allocated stays where it is.
+    // The resource needs to outlive the configuration
+    void set_memory_resource(memory_resource * res);
+    memory_resource * get_memory_resource() const;
+
+    // how this configuration (its storages and defaults) synchronizes access (see locking_policy):
+    // lock_none          - used by one thread only
+    // lock_mutex         - the default
+    // lock_reader_writer - readers don't wait for each other
+    // lock_snapshot      - finding the storage a setting is in, is lock-free (adding/removing storages copies
+    //                      what readers see); storages that are self-synchronized read lock-free too, the others
+    //                      use lock_reader_writer
+    // Storages use it, unless they have their own (see setting_storage::set_locking()).
+    // Set it before adding storages, and before the configuration is used by more than one thread
+    void set_locking(locking_policy p);
+    locking_policy locking() const { return m_cs.policy(); }
+
 private:
     void init_def_cfg() ;
-private:
-    mutable ::ss::detail::critical_section m_cs;
-
-    error_handler_func m_on_error;
+    void get_setting( const string & place, const string & sett_name, string & value, typeinfo &type, const read_view * view);
+    void convert_enum( const typeinfo & original_type, string & value, typeinfo & type) const;
+    void set_versioned( setting_storage * storage, const string & place, const string & sett_name, const string & value, const typeinfo &type);
+    void trim_versions();
+    static void delete_versions(void * p);
+    // the storage at this place, use()-d (0 if there's none)
+    setting_storage * use_storage(const string & place);
+    bool find_setting( const string & name, string & value, typeinfo & type);
+    detail::merkle_tree & hashes();
+    unsigned long long hashes_stamp() const;
+    void update_hash( setting_storage * storage, const string & place, const string & sett_name);
+    friend class detail::access_profile;
 
     typedef std::map<string,setting_storage*> coll;
-    coll m_storages;
-
     typedef std::set<string> set;
-    set m_const_names;
+    // the storages, and the names marked as const. Never modified once published - adding/removing
+    // storages publishes a copy (so that readers can read it without locking - see lock_snapshot)
+    struct layout {
+        coll storages;
+        set const_names;
+    };
+    class layout_reader;
+    // replaces the layout (call it with m_cs locked); the old one is deleted once no reader can see it
+    void publish( layout * fresh);
+    static void delete_layout(void * p);
+    typedef std::vector< std::pair<string, setting_storage*> > storages_coll;
+    // all our storages, use()-d
+    void use_storages( storages_coll & storages) const;
+private:
+    // guards changes to the layout (readers read it through layout_reader)
+    mutable ::ss::detail::policy_lock m_cs;
 
-    bool m_we_are_setting_defaults;
+    std::atomic<error_handler_func> m_on_error;
+
+    std::atomic<layout*> m_layout;
+
+    std::atomic<bool> m_we_are_setting_defaults;
     defaults_holder m_defaults_holder;
 
     enum_holder m_enum_holder;
+
+    std::atomic<bool> m_use_read_cache;
+
+    std::atomic<memory_resource*> m_resource;
+
+    std::atomic<unsigned long long> m_layout_version;
+
+    // the current schema. Older ones are kept (readers might still use them) until we're destroyed
+    std::atomic<const schema*> m_schema;
+    std::vector< std::unique_ptr<schema> > m_schemas;
+
+    // read views: the values overwritten while there are views (newest first)
+    struct version_entry;
+    std::atomic<version_entry*> m_versions;
+    // guards m_version and m_pinned; held while a versioned set_setting() runs
+    ::ss::detail::policy_lock m_version_cs;
+    unsigned long long m_version;
+    // the version each view sees
+    std::multiset<unsigned long long> m_pinned;
+    std::atomic<int> m_views;
+    // set_setting() calls that saw no views, so they don't keep the value they overwrite
+    std::atomic<int> m_unversioned_sets;
+
+    std::atomic<detail::access_profile*> m_profile;
+
+    // the settings' hashes (see diff()) - 0 until the first diff
+    std::unique_ptr<detail::merkle_tree> m_hashes;
+    std::atomic<bool> m_track_hashes;
+    // guards m_hashes and m_hashes_stamp
+    ::ss::detail::policy_lock m_hash_cs;
+    // the hashes are stale if storages were added/removed, or reloaded since (see hashes_stamp())
+    unsigned long long m_hashes_stamp;
+
+    std::atomic<bool> m_load_in_background;
+    // the storages loading in the background (guarded by m_cs)
+    std::vector< std::shared_future<void> > m_loads;
 };
 
 inline void set_error_handler(error_handler_func func) {
-    configuration().set_error_handler(func);
+    configuration::def().set_error_handler(func);
 }
 
 // this function needs to be provided by the user of the library, to initalize the (default) configuration
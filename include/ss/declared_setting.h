@@ -0,0 +1,185 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// declared_setting.h: settings declared once, at compile time
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_DECLARED_SETTING_H)
+#define SS_DECLARED_SETTING_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include "ss/setting.h"
+#include "ss/reclaim.h"
+#include "ss/read_cache.h"
+#include <atomic>
+
+namespace ss {
+
+namespace detail {
+    // (C++11 constexpr functions - one return statement each)
+    constexpr char_t ct_lower(char_t c) {
+        return (c >= 'A' && c <= 'Z') ? (char_t)(c - 'A' + 'a') : c;
+    }
+    // same rule as configuration::resolve_name(): not empty, and doesn't start with '.'
+    constexpr bool ct_valid_name(const char_t * name) {
+        return *name != 0 && *name != '.';
+    }
+
+    // a declared setting's name, as resolved in the configuration
+    struct resolved_name {
+        unsigned long long layout;
+        string place;
+        string name;
+    };
+
+    // the state of one declared setting, shared by all translation units.
+    // No constructor - it's zero-initialized before anything runs, so it can be used during static initialization
+    struct declared_state {
+        std::atomic<resolved_name*> resolved;
+        // the last value read (see declared_setting::get())
+        std::atomic<void*> value;
+        std::atomic<bool> has_default;
+    };
+
+    // resolves the name once per configuration layout (see configuration::layout_version()).
+    // Call it within a read_guard - the result is valid until the guard ends
+    const resolved_name & resolve_declared(declared_state & state, configuration & conf, const char_t * name);
+    void add_declared_default(declared_state & state, configuration & conf, const char_t * name, const string & value, const typeinfo & type);
+
+    // records a declared setting, during static initialization - without touching the default configuration.
+    // The defaults are added when it's initialized (see configuration::def())
+    struct declared_registrar {
+        explicit declared_registrar(void (*register_default)());
+        void (*register_default)();
+        declared_registrar * next;
+    };
+    // adds the defaults of all the declared settings recorded so far
+    void add_declared_defaults();
+}
+
+/*
+    A setting of the default configuration, declared once with its name, type and default value:
+
+    // (in a header, or in the .cpp file where you use it)
+    SS_SETTING(int, app_retries, "app.retries", 3);
+    SS_SETTING(string, user_name, "user.name", "John");
+
+    int retries = app_retries;
+    app_retries = 5;
+
+    Unlike setting<int>("app.retries"), there's no string work on each access:
+    - the name is checked at compile time
+    - it's resolved (lower-cased, its storage found) once - and again only when storages are added/removed
+    - its default is added when the default configuration is initialized (no need for bulk_setting)
+    - if the configuration uses the read cache, the converted value is shared by all threads,
+      until anything changes (same rules as the read cache - see ss/read_cache.h)
+*/
+template<class type, class decl> class declared_setting {
+    typedef declared_setting<type, decl> self_type;
+
+    struct snapshot {
+        snapshot(unsigned long long epoch, const type & val) : epoch(epoch), val(val) {}
+        unsigned long long epoch;
+        type val;
+    };
+public:
+    static const char_t * name() { return decl::name(); }
+
+    // easy conversion
+    operator type() const { return get(); }
+
+    // (the handle itself never changes - the value is in the configuration)
+    const self_type & operator=( const type & val) const {
+        set( val);
+        return *this;
+    }
+
+    type get() const {
+        configuration & conf = configuration::def();
+        if ( conf.uses_read_cache()) {
+            detail::read_guard guard;
+            const snapshot * last = static_cast<const snapshot*>( s_state.value.load(std::memory_order_acquire));
+            if ( last && last->epoch == detail::read_cache_epoch())
+                return last->val;
+        }
+        return get_slow(conf);
+    }
+
+    void set( const type & val) const {
+        configuration & conf = configuration::def();
+        register_default();
+        ostringstream out;
+        out << val;
+        detail::read_guard guard;
+        const detail::resolved_name & resolved = detail::resolve_declared(s_state, conf, decl::name());
+        conf.set_setting( resolved.place, resolved.name, out.str(), typeid(type) );
+    }
+
+    // adds the default value to the default configuration (once).
+    // (called when it's initialized - and on first use, in case we were declared after that)
+    static void register_default() {
+        if ( s_state.has_default.load(std::memory_order_acquire))
+            return;
+        ostringstream out;
+        out << decl::default_value();
+        detail::add_declared_default(s_state, configuration::def(), decl::name(), out.str(), typeid(type));
+    }
+
+private:
+    static type get_slow(configuration & conf) {
+        register_default();
+        // note: read the epoch before the value - if the value changes meanwhile, the snapshot is already stale
+        unsigned long long epoch = detail::read_cache_epoch();
+        type val = type();
+        detail::read_guard guard;
+        const detail::resolved_name & resolved = detail::resolve_declared(s_state, conf, decl::name());
+        if ( !detail::convert_setting( conf, resolved.place, resolved.name, val))
+            return val;
+        if ( conf.uses_read_cache()) {
+            void * old = s_state.value.exchange( new snapshot(epoch, val), std::memory_order_acq_rel);
+            if ( old)
+                detail::retire(old, delete_snapshot);
+        }
+        return val;
+    }
+
+    static void delete_snapshot(void * p) {
+        delete static_cast<snapshot*>(p);
+    }
+
+    static detail::declared_state s_state;
+};
+
+template<class type, class decl> detail::declared_state declared_setting<type, decl>::s_state;
+
+}
+
+// declares a setting of the default configuration - see declared_setting
+#define SS_SETTING(type_, var_, name_, default_) \
+    struct var_ ## _ss_decl { \
+        static const ::ss::char_t * name() { return TTEXT(name_); } \
+        static type_ default_value() { return default_; } \
+    }; \
+    static_assert( ::ss::detail::ct_valid_name( TTEXT(name_)), "bad setting name (empty, or starts with '.')"); \
+    typedef ::ss::declared_setting< type_, var_ ## _ss_decl> var_ ## _ss_type; \
+    const var_ ## _ss_type var_ = var_ ## _ss_type(); \
+    static ::ss::detail::declared_registrar var_ ## _ss_registrar( &var_ ## _ss_type::register_default)
+
+#endif
@@ -18,44 +18,71 @@
 
 #pragma once
 
+#include "ss/memory_resource.h"
+
 namespace ss {
 
 /** 
     holds default values for settings
+
+    The names and values are allocated from an arena (freed all at once, when the holder is destroyed)
 */
 class defaults_holder {
-    typedef ::ss::detail::scoped_lock scoped_lock;
+    typedef ::ss::detail::read_lock read_lock;
+    typedef ::ss::detail::write_lock write_lock;
+    typedef ::ss::detail::string_ref string_ref;
 
     struct info {
-        info(const string & value = string(), const typeinfo & type = typeinfo() )
+        info(const string_ref & value = string_ref(), const typeinfo & type = typeinfo() )
             : value(value), type(type) {}
-        string value;
+        string_ref value;
         typeinfo type;
     };
 
 public:
+    defaults_holder() : m_infos( std::less<string_ref>(), info_alloc(&m_arena) ) {
+        ::ss::detail::name_lock(m_lock.raw(), "defaults");
+    }
+
+    // see configuration::set_locking() (defaults are never replaced - so there are no snapshots to read)
+    void set_locking(locking_policy p) {
+        m_lock.policy( p == lock_snapshot ? lock_reader_writer : p);
+    }
+
     void add_default(const string & name, const string & value, const typeinfo & type) {
-        scoped_lock lk(m_cs);
-        m_infos[name] = info(value, type);
+        write_lock lk(m_lock);
+        info_coll::iterator found = m_infos.find(name);
+        if ( found == m_infos.end())
+            found = m_infos.insert( info_coll::value_type( string_ref(name).copy_to(m_arena), info() )).first;
+        // note: the old value (if any) is freed only together with the arena
+        found->second = info( string_ref(value).copy_to(m_arena), type);
     }
 
     void get_default(const string & name, string & value, typeinfo & type, bool & has_default) const {
-        scoped_lock lk(m_cs);
+        read_lock lk(m_lock);
         info_coll::const_iterator found = m_infos.find(name);
         if ( found != m_infos.end()) {
             has_default = true;
-            value = found->second.value;
+            value.assign( found->second.value.data, found->second.value.len);
             type = found->second.type;
         }
         else 
             has_default = false;
     }
+
+    // where the defaults are allocated from (0 = the default)
+    void set_memory_resource(memory_resource * res) {
+        write_lock lk(m_lock);
+        m_arena.upstream(res);
+    }
     
 private:
-    typedef std::map<string,info> info_coll;
-    info_coll m_infos;
+    mutable ::ss::detail::policy_lock m_lock;
 
-    mutable ::ss::detail::critical_section m_cs;
+    ::ss::detail::monotonic_arena m_arena;
+    typedef ::ss::detail::resource_allocator< std::pair<const string_ref,info> > info_alloc;
+    typedef std::map<string_ref,info,std::less<string_ref>,info_alloc> info_coll;
+    info_coll m_infos;
 };
 
 }
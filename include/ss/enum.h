@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include "ss/memory_resource.h"
 
 namespace ss { 
 
@@ -45,18 +46,29 @@ namespace ss {
 */
 
 class enum_holder {
-    typedef std::map<string, int> string_to_int_coll;
-    typedef std::map<int, string> int_to_string_coll;
+    typedef ::ss::detail::string_ref string_ref;
+    typedef std::map<string_ref, int, std::less<string_ref>, ::ss::detail::resource_allocator< std::pair<const string_ref,int> > > string_to_int_coll;
+    typedef std::map<int, string_ref, std::less<int>, ::ss::detail::resource_allocator< std::pair<const int,string_ref> > > int_to_string_coll;
     struct info {
+        info(memory_resource * res) : str_to_int( std::less<string_ref>(), res), int_to_str( std::less<int>(), res) {}
         string_to_int_coll str_to_int;
         int_to_string_coll int_to_str;
     };
-    typedef std::map<typeinfo, info> enum_coll;
+    typedef std::map<typeinfo, info, std::less<typeinfo>, ::ss::detail::resource_allocator< std::pair<const typeinfo,info> > > enum_coll;
+
+    // the enum names (and the collections) are allocated from here
+    ::ss::detail::monotonic_arena m_arena;
     enum_coll m_enums;
 public:
+    enum_holder() : m_enums( std::less<typeinfo>(), &m_arena) {}
+
     void add_enum(const typeinfo & type, int enum_, const string& str) {
-        m_enums[ type ].str_to_int[str] = enum_;
-        m_enums[ type ].int_to_str[enum_] = str;
+        enum_coll::iterator found = m_enums.find(type);
+        if ( found == m_enums.end())
+            found = m_enums.insert( enum_coll::value_type(type, info(&m_arena)) ).first;
+        string_ref copy = string_ref(str).copy_to(m_arena);
+        found->second.str_to_int[copy] = enum_;
+        found->second.int_to_str[enum_] = copy;
     }
 
     bool is_enum(const typeinfo & type) const {
@@ -85,12 +97,17 @@ public:
             int_to_string_coll::const_iterator enum_it = found->second.int_to_str.find(enum_);
             if ( enum_it != found->second.int_to_str.end()) {
                 enum_found = true;
-                result = enum_it->second;
+                result = enum_it->second.str();
             }
         }
         return enum_found;
     }
 
+    // where the enums are allocated from (0 = the default)
+    void set_memory_resource(memory_resource * res) {
+        m_arena.upstream(res);
+    }
+
 };
 
 
@@ -38,7 +38,11 @@ namespace err {
         storage_already_exists,
         // this is not necessary an error - it just signals that we cannot enumerate a certain storage's settings
         cannot_enum_settings,
-        const_setting
+        const_setting,
+        // a storage could not write its settings (like, the disk is full)
+        cannot_save,
+        // a setting's value does not match the schema (see ss/schema.h)
+        invalid_setting
     };
 
     ////////////////////////////////////////////////////
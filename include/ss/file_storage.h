@@ -20,13 +20,23 @@
 
 #include "ss/fwd.h"
 #include "ss/setting_storage.h"
+#include "ss/settings_table.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <map>
+#include <vector>
 
 namespace ss {
 
 
 
-// when thread-safety on, you can have it run on a dedicated thread (to write the settings). Or,
-// otherwise, rewrite each time a setting is set.
+// the file is read the first time one of its settings is needed (or in the background - see configuration::load_in_background()).
+// It's written on a dedicated thread: when requested, each time a setting is set, or a little while
+// after settings are set (see save_type)
 class file_storage : public setting_storage
 {
 public:
@@ -42,22 +52,60 @@ public:
         save_on_request,
         // saves each time a modification takes place
         save_each_modify,
-        // saves at a given interval, on a dedicated thread (like, every second)
-        //
-        // IMPORTANT: At this time, only available for windows
+        // saves at a given interval, on a dedicated thread (like, every second): a modification is written
+        // at most interval_ms later. A burst of modifications is written once (see set_save_interval())
         save_at_interval
     };
 
-    file_storage(const std::string & file_name, open_type open = open_writable, save_type save = save_at_interval, int interval_ms = 1000);
+    // res - where the settings are allocated from (0 = the configuration's)
+    file_storage(const std::string & file_name, open_type open = open_writable, save_type save = save_at_interval, int interval_ms = 1000,
+                 memory_resource * res = 0);
     ~file_storage(void);
 
     void save() ;
     void get_setting( const string & name, string & value, typeinfo&) const ;
+    bool find_setting( const string & name, string & value, typeinfo&) const ;
     void set_setting( const string & name, const string & value, const typeinfo&) ;
     void enum_settings( std::map<string,string> & values) const ;
+    // a range scan over the settings, sorted by name
+    bool visit_settings( const string & prefix, const setting_visitor & visitor) const ;
+
+    // save_at_interval: settings are written once they haven't been modified for debounce_ms,
+    // but no later than max_delay_ms after the first modification
+    void set_save_interval(int debounce_ms, int max_delay_ms);
+
+    // the file is also used by other processes (that share it the same way):
+    // - reads check, at most every check_interval_ms, whether the file changed (its size, time, inode),
+    //   and reload it if it did
+    // - saving holds an advisory lock (on "<file>.lock"); if the file changed since we read it, it's read again
+    //   and the settings set here are merged onto it - so we don't overwrite what the others wrote
+    void set_shared(bool shared, int check_interval_ms = 1000);
+    // shared files: reloads the file if it changed. Returns true if it did
+    bool check_for_changes();
+
+    typedef detail::settings_table::memory_usage memory_usage;
+    // how much memory the settings take (useful for large files)
+    void get_memory_usage(memory_usage & usage) const;
+
+    // get_setting() is lock-free, set_setting() locks only when adding a new setting
+    bool is_self_synchronized() const { return true; }
+    // shared files are checked for changes as they're read
+    bool checks_for_changes_on_read() const { return m_shared.load(std::memory_order_relaxed); }
+
+protected:
+    void on_memory_resource_changed(memory_resource * res);
+    // the file is written on a dedicated thread
+    std::shared_future<bool> save_async();
+    // reads the file - the first time a setting is needed (not in the constructor)
+    void load();
 
 private:
-    void load();
+    void read_file();
+    bool file_is_valid();
+    bool write();
+    bool write_changes();
+    bool save_all();
+    bool save_in_place(std::vector<int> & changed);
 
 private:
     std::string m_file_name;
@@ -65,31 +113,103 @@ private:
     save_type m_save;
     int m_interval_ms;
 
-    bool m_is_dirty;
+    std::atomic<bool> m_is_dirty;
 
-    // information about ONE setting
+    // information about ONE setting (as parsed/written)
     struct info {
-        info() : idx(0) {}
         string name;
         string value;
         string comment;
         typeinfo type;
-        // the setting's index (this is useful when saving, to preserve the original layout of the file)
-        int idx;
     };
-    typedef std::map<string, info> info_coll;
-    info_coll m_infos;
-
-    static void read_setting(string line, info & parsed);
-    static void write_setting(ofstream & out, const info & parsed);
-
 
-    // FIXME(later) at this time save_at_interval is available only for windows
-#ifdef SS_TS_WIN
-    static DWORD WINAPI save_thread(LPVOID);
-    HANDLE m_dedicated_thread;
-    bool m_is_dedicated_thread_running;
-#endif
+    // the values - readers look them up without locking.
+    // Keys are in the order the settings were read/added - this is the order we save them in
+    detail::settings_table m_table;
+
+    // serializes reading/writing the file; guards the comments, the spans and the save buffer
+    detail::critical_section m_io_cs;
+
+    // the comments (this is useful when saving, to preserve the original layout of the file).
+    // Few settings have comments, so only keep the ones that do: key -> the comment before it.
+    // They're allocated from an arena, freed on reload/destruction
+    detail::monotonic_arena m_comments_arena;
+    typedef std::map<int, detail::string_ref, std::less<int>, detail::resource_allocator< std::pair<const int,detail::string_ref> > > comment_coll;
+    comment_coll m_comments;
+    // the comment after all settings (read from the file) - any settings added later are written after it
+    detail::string_ref m_trailing_comment;
+    int m_trailing_pos;
+
+    // where each setting's value is, in the file (as we loaded or last saved it) - so that when only
+    // a few settings change, we rewrite only those (see save_in_place())
+    struct value_span {
+        value_span(unsigned long long offset = 0, size_t len = 0) : offset(offset), len((unsigned int)len) {}
+        unsigned long long offset;
+        unsigned int len;
+    };
+    std::vector<value_span> m_spans;
+    unsigned long long m_file_size;
+    bool m_can_rewrite_in_place;
+    // the settings changed since last save (reused between saves)
+    std::vector<int> m_changed;
+
+    static void read_setting(const string & line, info & parsed, size_t & value_begin, size_t & value_end);
+    static size_t write_setting(string & out, const info & parsed);
+    static void write_value(string & out, const info & parsed);
+
+    // when saving, the settings are serialized here, then written in big chunks. Reused between saves
+    string m_save_buffer;
+
+    // saving in the background (see save_async() and save_at_interval)
+    void start_writer();
+    void writer_thread();
+    void on_modified();
+    typedef std::chrono::steady_clock clock_type;
+
+    std::mutex m_writer_mutex;
+    std::condition_variable m_writer_cv;
+    std::thread m_writer;
+    bool m_writer_stop;
+    // whoever waits for the next write
+    std::vector< std::promise<bool> > m_save_requests;
+
+    // save_at_interval (m_interval_ms is the max delay)
+    int m_debounce_ms;
+    // modified since the last write
+    std::atomic<bool> m_interval_pending;
+    clock_type::time_point m_first_modified;
+    // (clock_type ticks)
+    std::atomic<long long> m_last_modified;
+
+    // sharing the file with other processes (see set_shared())
+    struct file_stamp {
+        file_stamp() : size(0), time(0), id(0) {}
+        unsigned long long size;
+        unsigned long long time;
+        unsigned long long id;
+        bool operator!=(const file_stamp & other) const { return size != other.size || time != other.time || id != other.id; }
+    };
+    static file_stamp stamp_of(const std::string & name);
+    void check_if_due() const;
+
+    std::atomic<bool> m_shared;
+    // the file as we last read/wrote it (guarded by m_io_cs)
+    file_stamp m_stamp;
+    // (clock_type ticks)
+    std::atomic<long long> m_check_interval;
+    std::atomic<long long> m_next_check;
+    // a thread is checking the file right now
+    std::atomic<bool> m_checking;
+
+    // the keys, sorted by name (see visit_settings()). Keys are never removed, so when there are new ones,
+    // a new (sorted) copy replaces the old one
+    struct sorted_keys {
+        std::vector<int> keys;
+    };
+    const sorted_keys & sorted() const;
+    static void delete_sorted(void * p);
+    mutable std::atomic<sorted_keys*> m_sorted;
+    mutable detail::critical_section m_sorted_cs;
 
 };
 
@@ -29,6 +29,7 @@
 #include <fstream>
 
 #include "ss/ts.h"
+#include <functional>
 #include <typeinfo>
 
 #if defined(_UNICODE) || defined(UNICODE)
@@ -84,6 +85,9 @@ namespace ss {
     inline bool operator!=(const typeinfo & a, const typeinfo & b) { return !(a == b); }
     inline bool operator<(const typeinfo & a, const typeinfo & b) { return a.raw_type->before(*(b.raw_type)) > 0; }
 
+    // gets each setting (name, value, type) - see visit_settings(). Return false to stop
+    typedef std::function<bool (const string & name, const string & value, const typeinfo & type)> setting_visitor;
+
 }
 
 #include "ss/error.h"
@@ -97,6 +101,8 @@ namespace ss {
 #define TTEXT(x) x
 #endif
 
+#ifdef _WIN32
 #include <tchar.h>
 #endif
+#endif
 
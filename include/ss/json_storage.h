@@ -0,0 +1,102 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// json_storage.h: settings kept in a JSON file
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_JSON_STORAGE_H)
+#define SS_JSON_STORAGE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include "ss/setting_storage.h"
+#include "ss/settings_table.h"
+#include <atomic>
+#include <map>
+
+namespace ss {
+
+/*
+    Settings kept in a JSON file.
+
+    Nested objects become dotted names, and arrays follow the ss/array.h convention:
+    { "app": { "net": { "port": 80 }, "hosts": ["a", "b"] } }
+    is
+    app.net.port = 80
+    app.hosts.count = 2
+    app.hosts.elems.1 = "a"
+    app.hosts.elems.2 = "b"
+
+    Names are lower-cased. Values keep the type the JSON gives them: strings, bools,
+    numbers (long if negative, unsigned long if integer, double otherwise); null is an empty string.
+
+    The file is mapped in memory (read-only) and parsed in one pass, without building a document:
+    the parser hands each value to us as it finds it, and strings without escapes are not even copied
+    until they're stored. That happens the first time a setting is needed (or in the background -
+    see configuration::load_in_background()). Reads are lock-free.
+
+    open_read_only - the file is never written (settings can still be changed, in memory)
+    open_writable - save() rewrites the file, if anything changed
+*/
+class json_storage : public setting_storage
+{
+public:
+    enum open_type {
+        open_writable,
+        open_read_only
+    };
+
+    // res - where the settings are allocated from (0 = the configuration's)
+    json_storage(const std::string & file_name, open_type open = open_read_only, memory_resource * res = 0);
+    ~json_storage(void);
+
+    void save() ;
+    void get_setting( const string & name, string & value, typeinfo&) const ;
+    bool find_setting( const string & name, string & value, typeinfo&) const ;
+    void set_setting( const string & name, const string & value, const typeinfo&) ;
+    void enum_settings( std::map<string,string> & values) const ;
+    bool visit_settings( const string & prefix, const setting_visitor & visitor) const ;
+
+    // if the file is not valid JSON, what's wrong with it (and where). Empty if it parsed fine.
+    // (the settings found before the error are kept)
+    const string & parse_error() const { ensure_loaded(); return m_parse_error; }
+
+    // get_setting() is lock-free, set_setting() locks only when adding a new setting
+    bool is_self_synchronized() const { return true; }
+
+protected:
+    void on_memory_resource_changed(memory_resource * res);
+    // parses the file - the first time a setting is needed (not in the constructor)
+    void load();
+
+private:
+    bool write();
+
+private:
+    std::string m_file_name;
+    open_type m_open;
+    std::atomic<bool> m_is_dirty;
+
+    detail::settings_table m_table;
+    string m_parse_error;
+};
+
+}
+
+#endif
@@ -0,0 +1,74 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// lock_stats.h: report on the library's lock usage
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_LOCK_STATS_H)
+#define SS_LOCK_STATS_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/ts.h"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/*
+    When you #define SETTING_LOCK_STATS (and the library is thread-safe), every critical section
+    of the library keeps statistics. Locks are named:
+
+    "configuration"           - configuration::m_cs
+    "defaults"                - the defaults holder
+    "storage:<name>"          - a storage's own lock ("storage:(root)" for the "" storage)
+
+    With lock_reader_writer / lock_snapshot (see locking_policy), only writers take these locks.
+
+    Instances with the same name (like, several configurations) are added up, and so are
+    the statistics of locks that have been destroyed (like, removed storages).
+
+    Without SETTING_LOCK_STATS, the report is always empty.
+*/
+
+namespace ss { namespace lock_stats {
+
+struct entry {
+    entry() : instances(0), acquisitions(0), contended(0), wait_ns(0), max_wait_ns(0), hold_ns(0), max_hold_ns(0) {}
+    std::string name;
+    // how many locks (alive or destroyed) contributed to this entry
+    int instances;
+    // outermost acquisitions (recursive re-locks are not counted)
+    unsigned long long acquisitions;
+    // acquisitions that had to wait for another thread
+    unsigned long long contended;
+    long long wait_ns;
+    long long max_wait_ns;
+    long long hold_ns;
+    long long max_hold_ns;
+};
+
+// one entry per lock name, the ones with the most waiting first
+void report( std::vector<entry> & entries);
+// prints report() as a table
+void dump( std::ostream & out);
+// zeroes all counters
+void reset();
+
+}}
+
+#endif
@@ -0,0 +1,162 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// memory_resource.h: where the library allocates its settings from
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_MEMORY_RESOURCE_H)
+#define SS_MEMORY_RESOURCE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <cstddef>
+#include <functional>
+
+// #define SETTING_USE_PMR, to use C++17's std::pmr::memory_resource (needs a C++17 compiler)
+#ifdef SETTING_USE_PMR
+#define SS_USE_PMR
+#endif
+
+#ifdef SS_USE_PMR
+#include <memory_resource>
+#endif
+
+namespace ss {
+
+#ifdef SS_USE_PMR
+    typedef std::pmr::memory_resource memory_resource;
+#else
+    /*
+        Same interface as C++17's std::pmr::memory_resource (which we use when SETTING_USE_PMR is defined).
+    */
+    class memory_resource {
+    public:
+        virtual ~memory_resource() {}
+
+        void * allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) { return do_allocate(bytes, alignment); }
+        void deallocate(void * p, size_t bytes, size_t alignment = alignof(std::max_align_t)) { do_deallocate(p, bytes, alignment); }
+        bool is_equal(const memory_resource & other) const noexcept { return do_is_equal(other); }
+
+    protected:
+        virtual void * do_allocate(size_t bytes, size_t alignment) = 0;
+        virtual void do_deallocate(void * p, size_t bytes, size_t alignment) = 0;
+        virtual bool do_is_equal(const memory_resource & other) const noexcept = 0;
+    };
+#endif
+
+// the resource used when you don't set one (new/delete, or std::pmr::get_default_resource())
+memory_resource * default_memory_resource();
+
+namespace detail {
+
+/*
+    Monotonic arena: allocates from its upstream resource in growing chunks, and never frees
+    anything individually - everything is freed at once, on release() or destruction.
+
+    Each chunk remembers the resource it came from, so the upstream can be changed at any time.
+
+    Not thread-safe. Note: the upstream needs to be thread-safe if several arenas share it from
+    different threads (new/delete and std::pmr::synchronized_pool_resource are), and it needs to outlive the arena.
+*/
+class monotonic_arena : public memory_resource {
+    monotonic_arena(const monotonic_arena&);
+    void operator=(const monotonic_arena&);
+public:
+    explicit monotonic_arena(memory_resource * upstream = 0, size_t first_chunk = 1024, size_t max_chunk = 64 * 1024);
+    ~monotonic_arena();
+
+    memory_resource * upstream() const { return m_upstream; }
+    void upstream(memory_resource * upstream) { m_upstream = upstream ? upstream : default_memory_resource(); }
+
+    // frees everything allocated so far
+    void release();
+    // like release(), but lock-free readers might still be reading the memory - see ss/reclaim.h
+    void retire_all();
+
+    // total memory taken from the upstream
+    size_t reserved() const { return m_reserved; }
+
+    void swap(monotonic_arena & other);
+
+protected:
+    void * do_allocate(size_t bytes, size_t alignment);
+    void do_deallocate(void *, size_t, size_t) {}
+    bool do_is_equal(const memory_resource & other) const noexcept { return this == &other; }
+
+private:
+    struct chunk;
+    static void free_chunk(void * p);
+
+    memory_resource * m_upstream;
+    chunk * m_chunks;
+    char * m_cur;
+    size_t m_left;
+    size_t m_next_chunk;
+    size_t m_max_chunk;
+    size_t m_reserved;
+};
+
+
+// allocator (for std containers) on top of a memory_resource
+template<class T> struct resource_allocator {
+    typedef T value_type;
+    typedef T * pointer;
+    typedef const T * const_pointer;
+    typedef T & reference;
+    typedef const T & const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template<class U> struct rebind { typedef resource_allocator<U> other; };
+
+    resource_allocator(memory_resource * res) : res(res) {}
+    template<class U> resource_allocator(const resource_allocator<U> & other) : res(other.res) {}
+
+    T * allocate(size_t n) { return static_cast<T*>( res->allocate(n * sizeof(T), alignof(T)) ); }
+    void deallocate(T * p, size_t n) { res->deallocate(p, n * sizeof(T), alignof(T)); }
+
+    memory_resource * res;
+};
+template<class T, class U> inline bool operator==(const resource_allocator<T> & a, const resource_allocator<U> & b) { return a.res == b.res; }
+template<class T, class U> inline bool operator!=(const resource_allocator<T> & a, const resource_allocator<U> & b) { return a.res != b.res; }
+
+
+/*
+    A string that lives in an arena (or anywhere else) - it's just a pointer + length, it never owns its characters.
+    Use it as a key to look up by a plain string, without copying it.
+*/
+struct string_ref {
+    string_ref() : data(0), len(0) {}
+    string_ref(const char_t * data, size_t len) : data(data), len(len) {}
+    string_ref(const string & str) : data(str.c_str()), len(str.size()) {}
+
+    string str() const { return string(data, len); }
+    // copies the characters into this arena
+    string_ref copy_to(memory_resource & arena) const;
+
+    const char_t * data;
+    size_t len;
+};
+bool operator<(const string_ref & a, const string_ref & b);
+inline bool operator==(const string_ref & a, const string_ref & b) {
+    return a.len == b.len && std::char_traits<char_t>::compare(a.data, b.data, a.len) == 0;
+}
+
+}}
+
+#endif
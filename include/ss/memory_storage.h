@@ -0,0 +1,95 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// memory_storage.h: settings kept in memory only
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SS_MEMORY_STORAGE_H
+#define SS_MEMORY_STORAGE_H
+
+#pragma once
+
+#include "ss/fwd.h"
+#include "ss/setting_storage.h"
+#include <vector>
+
+namespace ss {
+
+/*
+    Keeps the settings in memory - nothing is ever persisted.
+
+    Useful for per-process/per-test configurations, as an overlay on top of other storages,
+    or as a no-I/O baseline when benchmarking.
+
+    You can seed it from a buffer, which has the same syntax as a file_storage file:
+
+    def_cfg().add_storage("test", new memory_storage(
+        "retries=5\n"
+        "user.name=\"John\"\n"));
+*/
+class memory_storage : public setting_storage
+{
+public:
+    memory_storage();
+    explicit memory_storage(const string & seed);
+    ~memory_storage();
+
+    void save() ;
+    void get_setting( const string & name, string & value, typeinfo&) const ;
+    bool find_setting( const string & name, string & value, typeinfo&) const ;
+    void set_setting( const string & name, const string & value, const typeinfo&) ;
+    void enum_settings( std::map<string,string> & values) const ;
+    // (with their types)
+    bool visit_settings( const string & prefix, const setting_visitor & visitor) const ;
+
+    // looks up a setting without needing a string for its name.
+    // Returns false if the setting does not exist (does not look at defaults, does not set any error).
+    // Locks as the locking policy says (like the configuration does, when it calls us)
+    bool find( const char_t * name, size_t name_len, string & value, typeinfo & type) const;
+
+    // how many settings we hold
+    int size() const;
+
+private:
+    void seed(const string & buffer);
+
+    // information about ONE setting
+    struct info {
+        info() : hash(0), used(false) {}
+        size_t hash;
+        string name;
+        string value;
+        typeinfo type;
+        // (not the type - a setting can be set with any type, even an empty one)
+        bool used;
+        bool is_used() const { return used; }
+    };
+
+    static size_t hash_of(const char_t * name, size_t len);
+    const info * find_info(const char_t * name, size_t len, size_t hash) const;
+    bool find_unlocked( const char_t * name, size_t name_len, string & value, typeinfo & type) const;
+    info & insert_info(const string & name, size_t hash);
+    void grow();
+
+private:
+    // open addressing, linear probing (size is a power of 2, at most half full)
+    std::vector<info> m_infos;
+    size_t m_used;
+};
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// merkle.h: per-prefix hashes of the settings, to find what differs between two configurations
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_MERKLE_H)
+#define SS_MERKLE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <map>
+#include <vector>
+
+namespace ss {
+
+// one setting that differs (see configuration::diff())
+struct setting_change {
+    setting_change() : type(typeid(string)), removed(false) {}
+    // full name
+    string name;
+    string value;
+    typeinfo type;
+    // the other configuration doesn't have this setting
+    bool removed;
+};
+typedef std::vector<setting_change> settings_delta;
+
+// the delta as text, one setting per line: "name=value" (same as a settings file), or "-name" if it's removed
+string write_delta(const settings_delta & changes);
+// false if a line could not be parsed (the lines before it are still read)
+bool read_delta(const string & text, settings_delta & changes);
+
+namespace detail {
+
+/*
+    The settings of a configuration, as a tree split at the dots ("app.net.port" -> app / net / port),
+    where each node has the hash of all the settings below it.
+
+    A node's hash is the sum of its settings' hashes (each one hashes the full name and the value), so
+    setting a value only adds the difference to each node on its path - there's nothing to recompute.
+
+    Two trees are compared top-down, skipping the subtrees whose hashes are equal - so comparing
+    two large configurations that differ in a few settings only visits those settings' paths.
+*/
+class merkle_tree {
+    merkle_tree(const merkle_tree&);
+    void operator=(const merkle_tree&);
+public:
+    merkle_tree();
+    ~merkle_tree();
+
+    // adds the setting, or updates its value
+    void set(const string & name, const string & value);
+    void clear();
+
+    // the hash of all the settings
+    unsigned long long hash() const;
+
+    enum difference {
+        only_left = 1,
+        only_right = 2,
+        // both have it, with different values
+        changed = 3
+    };
+    // the settings that differ, sorted by name
+    static void diff(const merkle_tree & left, const merkle_tree & right, std::vector< std::pair<string,difference> > & names);
+
+private:
+    struct node {
+        node() : hash(0), own(0), has_value(false) {}
+        ~node();
+        // sum of own + the children's hash
+        unsigned long long hash;
+        // the hash of this node's setting (if has_value)
+        unsigned long long own;
+        bool has_value;
+        std::map<string, node*> children;
+    };
+    static void diff(const node & left, const node & right, string & path, std::vector< std::pair<string,difference> > & names);
+    static void add_all(const node & n, string & path, difference diff, std::vector< std::pair<string,difference> > & names);
+    static void append_path(string & path, const string & part);
+
+    node * m_root;
+};
+
+}}
+
+#endif
@@ -0,0 +1,116 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// read_cache.h: per-thread cache of already converted setting values
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_READ_CACHE_H)
+#define SS_READ_CACHE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <atomic>
+#include <vector>
+
+namespace ss {
+
+class configuration;
+
+namespace detail {
+
+/*
+    Each thread keeps its own cache of (configuration, place, name, type) -> converted value.
+
+    All entries are tagged with the global epoch at the time they were read. Anything that could
+    change the value of a setting (set_setting, add/remove storage, adding defaults, a storage
+    reloading, ...) bumps the epoch, which invalidates every cached value in every thread at once.
+
+    So in steady state, a read is a probe into a thread-local table + one relaxed atomic load:
+    no locks, no writes to shared memory.
+
+    You turn it on per configuration - see configuration::use_read_cache()
+*/
+extern std::atomic<unsigned long long> g_read_cache_epoch;
+
+inline unsigned long long read_cache_epoch() {
+    return g_read_cache_epoch.load(std::memory_order_relaxed);
+}
+
+inline void bump_read_cache_epoch() {
+    g_read_cache_epoch.fetch_add(1, std::memory_order_release);
+}
+
+class read_cache {
+    struct value_base {
+        virtual ~value_base() {}
+    };
+    template<class type> struct value_holder : value_base {
+        value_holder(const type & val) : val(val) {}
+        type val;
+    };
+
+    struct entry {
+        entry() : hash(0), conf(0), type(0), epoch(0), value(0) {}
+        size_t hash;
+        const configuration * conf;
+        const std::type_info * type;
+        string place;
+        string name;
+        unsigned long long epoch;
+        value_base * value;
+    };
+
+    read_cache();
+    ~read_cache();
+    read_cache(const read_cache&);
+    void operator=(const read_cache&);
+public:
+    // the cache of the current thread
+    static read_cache & this_thread();
+
+    template<class type> bool find(const configuration * conf, const string & place, const string & name, type & val) const {
+        const entry * e = find_entry( conf, place, name, typeid(type));
+        if ( !e)
+            return false;
+        val = static_cast<const value_holder<type>*>(e->value)->val;
+        return true;
+    }
+
+    // 'epoch' is the epoch read *before* reading the value
+    template<class type> void insert(const configuration * conf, const string & place, const string & name, unsigned long long epoch, const type & val) {
+        entry & e = slot_for( conf, place, name, typeid(type));
+        delete e.value;
+        e.value = new value_holder<type>(val);
+        e.epoch = epoch;
+    }
+
+private:
+    const entry * find_entry(const configuration * conf, const string & place, const string & name, const std::type_info & type) const;
+    entry & slot_for(const configuration * conf, const string & place, const string & name, const std::type_info & type);
+    static size_t hash_of(const configuration * conf, const string & place, const string & name, const std::type_info & type);
+
+private:
+    // open addressing, linear probing; size is a power of 2
+    std::vector<entry> m_entries;
+    size_t m_used;
+};
+
+}}
+
+#endif
@@ -0,0 +1,63 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// reclaim.h: safe memory reclamation for lock-free readers
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_RECLAIM_H)
+#define SS_RECLAIM_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <atomic>
+
+namespace ss { namespace detail {
+
+/*
+    Epoch based reclamation.
+
+    Lock-free readers enter a read_guard while they look at shared nodes; writers that unlink
+    a node retire() it, and the node is deleted only once no reader that could still see it
+    is inside a read_guard.
+
+    Entering/leaving a guard only writes to the current thread's own slot (no shared cache lines).
+*/
+class read_guard {
+    read_guard(const read_guard&);
+    void operator=(const read_guard&);
+public:
+    read_guard();
+    // enters only if 'active' (for readers that need the guard only some of the time)
+    explicit read_guard(bool active);
+    ~read_guard();
+private:
+    bool m_active;
+};
+
+typedef void (*retire_func)(void*);
+// deletes 'p' (by calling 'deleter') once no reader can be using it anymore
+void retire(void * p, retire_func deleter);
+
+// waits until the readers that are inside a read_guard right now (except this thread), leave it -
+// after that, nobody can still see what was unlinked before the call
+void wait_for_readers();
+
+}}
+
+#endif
@@ -0,0 +1,130 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// schema.h: what values the settings can have
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_SCHEMA_H)
+#define SS_SCHEMA_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <map>
+#include <vector>
+
+namespace ss {
+
+// a value, as converted by the schema (numbers and bools only - strings need no conversion)
+struct typed_value {
+    typed_value() : code(0), as_long(0) {}
+    // the type, as a settings_table type code (0 = not converted)
+    unsigned char code;
+    union {
+        long as_long;
+        unsigned long as_ulong;
+        double as_double;
+        bool as_bool;
+    };
+};
+
+/*
+    Declares the settings' types, and what values they can take:
+
+    schema s;
+    s.add("app.retries", typeid(int), 0, 10);
+    s.add("app.timeouts.*", typeid(double));
+    s.add_enum("log.level", "debug|info|warning|error");
+    def_cfg().set_schema(s);
+
+    The whole storage is checked once - when it's added to the configuration (a storage with invalid settings
+    is rejected), when it reloads, and on copy_into(). Setting a value checks it too.
+    Valid numbers/bools are kept converted, so reading them doesn't parse anything.
+
+    Names are case-insensitive; "prefix.*" matches all settings starting with "prefix.".
+    An exact name wins over a prefix, and a longer prefix over a shorter one.
+    Settings that match no rule can have any value.
+*/
+class schema {
+public:
+    // type: int, long, unsigned, double, bool, string, etc.
+    schema & add(const string & pattern, const typeinfo & type);
+    // a number, within [min_value, max_value]
+    schema & add(const string & pattern, const typeinfo & type, double min_value, double max_value);
+    // a string, which can only be one of these values (separated by '|')
+    schema & add_enum(const string & pattern, const string & domain);
+
+    // checks a setting's value (name is the full name). If valid, numbers/bools are converted into 'typed'.
+    // Returns false if it's invalid, with the reason in 'error'
+    bool check(const string & name, const string & value, typed_value & typed, string & error) const;
+
+    bool empty() const { return m_rules.empty(); }
+
+private:
+    struct rule {
+        rule() : code(0), has_range(false), min_value(0), max_value(0) {}
+        string pattern;
+        unsigned char code;
+        bool has_range;
+        double min_value;
+        double max_value;
+        std::vector<string> domain;
+    };
+    rule & add_rule(const string & pattern, const typeinfo & type);
+    const rule * find(const string & name) const;
+
+private:
+    std::vector<rule> m_rules;
+    // exact names -> rule
+    std::map<string, size_t> m_exact;
+    // "prefix." -> rule (looked up from the longest prefix of the name)
+    std::map<string, size_t> m_prefixes;
+};
+
+namespace detail {
+    template<class type> bool typed_number(const typed_value & typed, type & val) {
+        switch ( typed.code) {
+        case 1: val = (type)typed.as_bool; return true;
+        case 2: val = (type)typed.as_long; return true;
+        case 3: val = (type)typed.as_ulong; return true;
+        case 4: val = (type)typed.as_double; return true;
+        default: return false;
+        }
+    }
+
+    // converts a value the schema already converted. Returns false for anything but numbers/bools
+    template<class type> bool from_typed(const typed_value &, type &) { return false; }
+    inline bool from_typed(const typed_value & typed, short & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, unsigned short & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, int & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, unsigned int & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, long & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, unsigned long & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, float & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, double & val) { return typed_number(typed, val); }
+    inline bool from_typed(const typed_value & typed, bool & val) {
+        if ( typed.code != 1)
+            return false;
+        val = typed.as_bool;
+        return true;
+    }
+}
+
+}
+
+#endif
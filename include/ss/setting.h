@@ -59,9 +59,66 @@ namespace ss {
         inline void from_stream( istringstream & in, string & val) {
             val = in.str();
         }
+
+        // reads a setting and converts it to its type. Returns false if it can't be converted
+        template< class type> bool convert_setting( configuration & conf, const string & place, const string & name, type & val) {
+            string val_str;
+            typeinfo set_type = typeid(type);
+            conf.get_setting( place, name, val_str, set_type);
+            istringstream in( val_str);
+            from_stream( in, val);
+            if ( in.fail() ) {
+                conf.get_error_handler()( err::cannot_convert, TTEXT("value cannot be converted to underlying type") );
+                return false;
+            }
+            return true;
+        }
+
+        // reads a setting and converts it to its type
+        // (if the configuration uses a read cache, the converted value is cached)
+        template< class type> type read_setting( configuration & conf, const string & place, const string & name) {
+            bool use_cache = conf.uses_read_cache();
+            unsigned long long epoch = 0;
+            type val = type();
+            if ( use_cache) {
+                if ( read_cache::this_thread().find( &conf, place, name, val))
+                    return val;
+                // note: read the epoch before the value - if the value changes meanwhile, the entry is already stale
+                epoch = read_cache_epoch();
+            }
+
+            typed_value typed;
+            if ( conf.get_schema() && conf.get_typed( place, name, typed) && from_typed( typed, val) ) {
+                // the schema already converted it
+                if ( use_cache)
+                    read_cache::this_thread().insert( &conf, place, name, epoch, val);
+                return val;
+            }
+            if ( !convert_setting( conf, place, name, val))
+                return val;
+
+            if ( use_cache)
+                read_cache::this_thread().insert( &conf, place, name, epoch, val);
+            return val;
+        }
     }
 
 
+template<class type> type configuration::read_view::get(const string & name) const {
+    string place, sett_name;
+    m_conf.resolve_name( name, place, sett_name, configuration::resolve_dont_care);
+    string val_str;
+    typeinfo set_type = typeid(type);
+    get_setting( place, sett_name, val_str, set_type);
+    type val = type();
+    istringstream in( val_str);
+    detail::from_stream( in, val);
+    if ( in.fail() )
+        m_conf.get_error_handler()( err::cannot_convert, TTEXT("value cannot be converted to underlying type") );
+    return val;
+}
+
+
 /** 
     represents a setting, with a known type, like
     setting<some_type>("some_name")
@@ -101,16 +158,7 @@ public:
 
 private:
     type get() const {
-        string val_str;
-        typeinfo set_type = typeid(type);
-        m_conf.get_setting( m_place, m_name, val_str, set_type);
-        istringstream in( val_str);
-        type val = type();
-        detail::from_stream( in, val);
-        if ( in.fail() ) {
-            m_conf.get_error_handler()( err::cannot_convert, TTEXT("value cannot be converted to underlying type") );
-        }
-        return val;
+        return detail::read_setting<type>( m_conf, m_place, m_name);
     }
 
     void set( const type & val) {
@@ -199,16 +247,7 @@ public:
 
 private:
     template<class type> type get() const {
-        string val_str;
-        typeinfo set_type = typeid(type);
-        m_conf.get_setting( m_place, m_name, val_str, set_type);
-        istringstream in( val_str);
-        type val = type();
-        detail::from_stream( in, val);
-        if ( in.fail() ) {
-            m_conf.get_error_handler()( err::cannot_convert, TTEXT("value cannot be converted to underlying type") );
-        }
-        return val;
+        return detail::read_setting<type>( m_conf, m_place, m_name);
     }
 
     template<class type> void set( const type & val) {
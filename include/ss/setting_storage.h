@@ -25,7 +25,16 @@
 #endif // _MSC_VER > 1000
 
 #include "ss/fwd.h"
+#include "ss/trace.h"
+#include "ss/memory_resource.h"
+#include "ss/read_cache.h"
+#include "ss/schema.h"
+#include "ss/settings_table.h"
+#include <atomic>
+#include <future>
 #include <map>
+#include <mutex>
+#include <vector>
 #include <assert.h>
 
 namespace ss {
@@ -47,9 +56,9 @@ class configuration;
 class setting_storage  
 {
 protected:
-    setting_storage() : m_use_count(0), m_conf(0) {}
+    setting_storage() : m_use_count(0), m_locking_set(false), m_conf(0), m_resource(0), m_typed(0), m_typed_sets(0), m_reloads(0), m_is_loaded(false) {}
 public:
-    virtual ~setting_storage() {}
+    virtual ~setting_storage() { delete m_typed.load(); }
 
 protected:
     // saves all (modified) settings;
@@ -69,76 +78,295 @@ protected:
         set_error(err::cannot_enum_settings, TTEXT("cannot enumerate settings"));
     }
 
+    // streams the settings whose names start with 'prefix' to the visitor, in name order.
+    // Returns false if the visitor stopped it.
+    // By default, it enumerates all settings - storages that keep their settings ordered, should do better
+    virtual bool visit_settings( const string & prefix, const setting_visitor & visitor) const {
+        std::map<string,string> values;
+        enum_settings(values);
+        for ( std::map<string,string>::const_iterator first = values.lower_bound(prefix), last = values.end(); first != last; ++first) {
+            if ( first->first.compare(0, prefix.size(), prefix) != 0)
+                break;
+            if ( !visitor(first->first, first->second, typeid(variant)) )
+                return false;
+        }
+        return true;
+    }
+
+    // like get_setting(), but if we don't have this setting, returns false (doesn't look at defaults, doesn't set any error).
+    // By default, it enumerates the settings - storages that can look up one setting, should
+    virtual bool find_setting( const string & name, string & value, typeinfo & type) const {
+        std::map<string,string> values;
+        enum_settings(values);
+        std::map<string,string>::const_iterator found = values.find(name);
+        if ( found == values.end() )
+            return false;
+        value = found->second;
+        type = typeid(variant);
+        return true;
+    }
+
 public:
-    void use() {
-        { scoped_lock lk(m_use_cs);
-          ++m_use_count;
+    // if true, get_setting(), set_setting(), find_setting(), enum_settings() and visit_settings() do their own synchronization
+    // (for instance, they're lock-free), so the do_xxx() functions won't lock this storage's critical section
+    // (save() is always called with it locked)
+    virtual bool is_self_synchronized() const { return false; }
+
+    // if true, reading a setting is what finds out that our values changed (like, a shared file that was edited),
+    // so reads must not be served from elsewhere (see access_profile)
+    virtual bool checks_for_changes_on_read() const { return false; }
+
+protected:
+
+    // saves in the background, if the storage can. The future is set once the settings are written
+    // (true = success). By default, saves right away
+    virtual std::shared_future<bool> save_async() {
+        { write_lock lk(m_lock);
+          save();
         }
+        std::promise<bool> saved;
+        saved.set_value(true);
+        return saved.get_future().share();
+    }
+
+    // the memory resource this storage should allocate its settings from has changed
+    // (storages that don't allocate much can ignore it)
+    virtual void on_memory_resource_changed(memory_resource * /* res */) {}
+
+    // reads the settings. Called once, before the settings are first accessed (or in the background,
+    // see configuration::load_in_background()) - so storages that are never used, never read anything.
+    // By default, there's nothing to load (the storage has its settings from the constructor)
+    virtual void load() {}
+
+public:
+    void use() {
+        m_use_count.fetch_add(1, std::memory_order_relaxed);
     }
 
     void un_use() {
-        int count;
-        { scoped_lock lk(m_use_cs);
-          count = --m_use_count;
-        }
+        int count = m_use_count.fetch_sub(1, std::memory_order_acq_rel) - 1;
         delete_if_needed(count);
     }
 
+    // how this storage synchronizes access to its settings (see locking_policy). By default, it's the
+    // configuration's (see configuration::set_locking()). Set it before the storage is used by more than one thread.
+    // lock_snapshot only makes sense for storages that are self-synchronized (their readers never lock) -
+    // the others use lock_reader_writer instead
+    void set_locking(locking_policy p) {
+        if ( p == lock_snapshot && !is_self_synchronized())
+            p = lock_reader_writer;
+        m_lock.policy(p);
+        m_locking_set = true;
+    }
+    locking_policy locking() const { return m_lock.policy(); }
+    // the configuration's policy - unless set_locking() was called
+    void inherit_locking(locking_policy p) {
+        if ( m_locking_set)
+            return;
+        set_locking(p);
+        m_locking_set = false;
+    }
+
+    // loads the settings, unless they're loaded already (if another thread is loading them, waits for it).
+    // Once they're loaded, it's just an atomic read
+    void ensure_loaded() const {
+        if ( !m_is_loaded.load(std::memory_order_acquire))
+            const_cast<setting_storage*>(this)->load_once();
+    }
+    bool is_loaded() const { return m_is_loaded.load(std::memory_order_acquire); }
+
+    // note: doesn't load the settings - if they're not loaded yet, nothing was set, so there's nothing to save
     void do_save() {
+        SS_TRACE_SCOPE("setting_storage::do_save");
         // client has already called use()
-        scoped_lock lk(m_cs);
+        write_lock lk(m_lock);
         save();
         // client will call un_use()
     }
 
+    std::shared_future<bool> do_save_async() {
+        SS_TRACE_SCOPE("setting_storage::do_save_async");
+        // client has already called use()
+        return save_async();
+        // client will call un_use()
+    }
+
     void do_get_setting(const string & name, string & value, typeinfo& t) {
+        SS_TRACE_SCOPE("setting_storage::do_get_setting");
         // client has already called use()
-        scoped_lock lk(m_cs);
+        ensure_loaded();
+        if ( is_self_synchronized()) {
+            get_setting(name, value, t);
+            return;
+        }
+        read_lock lk(m_lock);
         get_setting(name, value, t);
         // client will call un_use()
     }
 
+    // like do_get_setting(), for callers that know the storage's real type (see ss/static_configuration.h):
+    // storage_type's own functions are called directly - not virtually
+    template<class storage_type> void do_get_setting_as(const string & name, string & value, typeinfo& t) {
+        // client has already called use()
+        ensure_loaded();
+        storage_type & self = static_cast<storage_type&>(*this);
+        if ( self.storage_type::is_self_synchronized()) {
+            self.storage_type::get_setting(name, value, t);
+            return;
+        }
+        read_lock lk(m_lock);
+        self.storage_type::get_setting(name, value, t);
+        // client will call un_use()
+    }
+
+    // note: the visitor is never called with our lock held (it might set settings - in this storage,
+    // or in another configuration)
+    bool do_visit_settings(const string & prefix, const setting_visitor & visitor) {
+        // client has already called use()
+        ensure_loaded();
+        if ( is_self_synchronized())
+            return visit_settings(prefix, visitor);
+        // copy them while locked, visit them afterwards
+        struct visited {
+            string name, value;
+            typeinfo type;
+        };
+        std::vector<visited> copied;
+        { read_lock lk(m_lock);
+          visited cur;
+          visit_settings(prefix, [&](const string & name, const string & value, const typeinfo & type) {
+              cur.name = name;
+              cur.value = value;
+              cur.type = type;
+              copied.push_back(cur);
+              return true;
+          });
+        }
+        for ( size_t idx = 0; idx < copied.size(); ++idx)
+            if ( !visitor( copied[idx].name, copied[idx].value, copied[idx].type))
+                return false;
+        return true;
+        // client will call un_use()
+    }
+
+    bool do_find_setting(const string & name, string & value, typeinfo& t) {
+        // client has already called use()
+        ensure_loaded();
+        if ( is_self_synchronized())
+            return find_setting(name, value, t);
+        read_lock lk(m_lock);
+        return find_setting(name, value, t);
+        // client will call un_use()
+    }
+
     void do_set_setting(const string & name, const string & value, const typeinfo& t) {
+        SS_TRACE_SCOPE("setting_storage::do_set_setting");
         // client has already called use()
-        scoped_lock lk(m_cs);
-        set_setting(name, value, t);
+        ensure_loaded();
+        typed_value typed;
+        if ( !check_setting(name, value, typed))
+            return;
+        if ( is_self_synchronized()) {
+            set_setting(name, value, t);
+            // (there's no lock to hold while setting both - see set_current_typed)
+            set_current_typed(name, value, typed);
+        }
+        else {
+            // the value and its converted value change within the same lock
+            write_lock lk(m_lock);
+            set_setting(name, value, t);
+            set_typed(name, typed);
+        }
         // client will call un_use()
     }
 
+    // lock-free. The value of this setting, as converted by the schema
+    // (false if there's no schema, or it's not a number/bool, or we don't have this setting)
+    bool do_get_typed(const string & name, typed_value & typed) const;
+
+    // checks all settings against the configuration's schema (see ss/schema.h), and keeps the converted values.
+    // Returns false if any setting is invalid (each one is reported as an error)
+    bool validate();
+
     void do_enum_settings(std::map<string,string> & values) {
+        SS_TRACE_SCOPE("setting_storage::do_enum_settings");
         // client has already called use()
-        scoped_lock lk(m_cs);
+        ensure_loaded();
+        if ( is_self_synchronized()) {
+            enum_settings(values);
+            return;
+        }
+        read_lock lk(m_lock);
         enum_settings(values);
         // client will call un_use()
     }
 
 
     void parent(configuration * conf) {
-        scoped_lock lk(m_cs);
-        // you should set this only once!
-        assert( !m_conf);
-        m_conf = conf;
+        { write_lock lk(m_lock);
+          // you should set this only once!
+          assert( !m_conf.load());
+          m_conf.store(conf, std::memory_order_release);
+        }
+        update_memory_resource();
     }
 
     configuration * parent() const {
-        return m_conf;
+        return m_conf.load(std::memory_order_acquire);
     }
 
+    // how many times our values changed behind the configuration's back (see on_reloaded())
+    unsigned long reloads() const { return m_reloads.load(std::memory_order_acquire); }
+
     // in the configuration - the name of this setting storage
     void name(const string& n) {
-        scoped_lock lk(m_cs);
-        m_name = n;
+        { scoped_lock lk(m_name_cs);
+          m_name = n;
+        }
+        std::string lock_name = "storage:" + (n.empty() ? std::string("(root)") : detail::narrow(n));
+        detail::name_lock(m_lock.raw(), lock_name);
+    }
+
+    // where this storage allocates its settings from. If you don't set it, it's the configuration's.
+    // The resource needs to outlive the storage
+    void set_memory_resource(memory_resource * res) {
+        m_resource = res;
+        update_memory_resource();
+    }
+    memory_resource * get_memory_resource() const ;
+    // called by the configuration, when its resource changes
+    void update_memory_resource() {
+        on_memory_resource_changed( get_memory_resource() );
     }
 
 protected:
+    // for storages that reload their settings: checks a setting against the configuration's schema,
+    // before it goes live (reports the error if it's invalid). True if there's no schema
+    bool check_setting(const string & name, const string & value, typed_value & typed) const;
+    // ... and once it's live, keeps its converted value
+    void set_typed(const string & name, const typed_value & typed) const;
+    // ... for self-synchronized storages: keeps the converted value of what the storage holds *now*
+    // ('value' unless another thread set it meanwhile)
+    void set_current_typed(const string & name, const string & value, const typed_value & typed) const;
+    // checks these settings (all we have - like, just reloaded), and keeps their converted values.
+    // If any is invalid, we keep the converted values we had, and return false.
+    // Only for settings that can't be set meanwhile (otherwise, use validate())
+    bool validate(const std::map<string,string> & values) const;
+
+    // call it when the values changed behind the configuration's back (like, the file was reloaded)
+    void on_reloaded() const {
+        m_reloads.fetch_add(1, std::memory_order_release);
+        detail::bump_read_cache_epoch();
+    }
+
     void set_error(int err_code, const string & error) const {
         // already in scoped lock
-        m_conf->get_error_handler()( err_code, error);
+        parent()->get_error_handler()( err_code, error);
     }
 
 private:
     string name() const {
-        scoped_lock lk(m_cs);
+        scoped_lock lk(m_name_cs);
         return m_name;
     }
 protected:
@@ -152,27 +380,57 @@ private:
             delete this;
     }
 
+    void load_once() {
+        // (if load() throws, the next access tries again)
+        std::call_once(m_load_once, [this] { load(); });
+        m_is_loaded.store(true, std::memory_order_release);
+    }
+
 
 protected:
     typedef ::ss::detail::scoped_lock scoped_lock;
-    ::ss::detail::critical_section & cs() const { return m_cs; }
+    typedef ::ss::detail::read_lock read_lock;
+    typedef ::ss::detail::write_lock write_lock;
+    // the critical section writers hold (whatever the locking policy - unless it's lock_none)
+    ::ss::detail::critical_section & cs() const { return m_lock.raw(); }
+    // the lock the do_xxx() functions take (as the locking policy says) - for functions you call directly
+    ::ss::detail::policy_lock & storage_lock() const { return m_lock; }
     
 private:
-    // note: we use 2 critical sections :
-    // m_use_cs - to increase/decrease whenever the setting is used
-    // m_cs     - to provide thread-safety of the class's operations
-    //
-    // we could use only one critical section, but then just calling use()/un_use() could take too long
-    // if another thread is doing an operation (save, get_setting, etc)
-    mutable ::ss::detail::critical_section m_use_cs;
-    // how many times is this setting used?
-    int m_use_count;
+    // how many times is this setting used? (atomic - so that use()/un_use() don't wait for
+    // another thread's operation: save, get_setting, etc)
+    std::atomic<int> m_use_count;
+
+    // provides thread-safety of the class's operations (see set_locking())
+    mutable ::ss::detail::policy_lock m_lock;
+    bool m_locking_set;
+
+    // (atomic - storages that get settings on their own threads, check them against its schema)
+    std::atomic<configuration*> m_conf;
+
+    std::atomic<memory_resource*> m_resource;
+
+    // with a schema: the settings' converted values (name -> raw typed_value)
+    mutable std::atomic<detail::settings_table*> m_typed;
+    // guards setting a converted value vs. replacing all of them
+    mutable ::ss::detail::critical_section m_typed_cs;
+    // how many converted values were set so far
+    mutable std::atomic<unsigned long> m_typed_sets;
+    enum { MAX_VALIDATE_TRIES = 8 };
+
+    bool convert_all(const std::map<string,string> & values, detail::settings_table & table) const;
+    bool keep_typed(detail::settings_table * fresh, unsigned long sets_before) const;
+    static void delete_typed(void * p);
 
-    mutable ::ss::detail::critical_section m_cs;
+    mutable std::atomic<unsigned long> m_reloads;
 
-    mutable configuration * m_conf;
+    // see load()
+    std::once_flag m_load_once;
+    std::atomic<bool> m_is_loaded;
 
     string m_name;
+    // (only guards m_name - so that we can find out our name while holding any other lock)
+    mutable ::ss::detail::critical_section m_name_cs;
 };
 
 
@@ -0,0 +1,107 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// settings_daemon.h: serves a configuration to the processes on this host, over a Unix domain socket
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_SETTINGS_DAEMON_H)
+#define SS_SETTINGS_DAEMON_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/configuration.h"
+#include "ss/socket_protocol.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace ss {
+
+/*
+    Owns the authoritative configuration of a host: processes mount it with a socket_storage
+    (see ss/socket_storage.h), and each of them gets a replica of all its settings, then every change,
+    as it happens.
+
+    configuration authoritative;
+    authoritative.add_storage("", new file_storage("/etc/my_app.settings"));
+    settings_daemon daemon(authoritative, "/run/my_app.sock");
+    daemon.start();
+
+    The settings clients set are applied to the configuration (all of a client's batch at once -
+    see configuration::apply()), then pushed to all clients. If the configuration changes otherwise
+    (like, its file is reloaded), call publish().
+
+    Everything happens on one thread of ours. The ssd tool (tools/ssd.cpp) is a daemon built around it.
+    POSIX only.
+*/
+class settings_daemon {
+    settings_daemon(const settings_daemon&);
+    void operator=(const settings_daemon&);
+public:
+    settings_daemon(configuration & conf, const std::string & socket_path);
+    ~settings_daemon();
+
+    // starts listening. False if we can't
+    bool start();
+    void stop();
+
+    // pushes the settings that changed since we last pushed them, to all clients
+    void publish();
+
+    // how many clients are connected
+    int client_count() const { return m_client_count.load(std::memory_order_relaxed); }
+
+private:
+    struct client {
+        client(int fd) : fd(fd), synced(false), dead(false) {}
+        int fd;
+        detail::socket_protocol::frame_reader reader;
+        // it got the snapshot - from now on, it gets the deltas
+        bool synced;
+        // we're done with it (it's removed once we're not walking the clients)
+        bool dead;
+    };
+
+    void run();
+    void accept_client();
+    // false if we should drop the client
+    bool on_readable(client & c);
+    void do_publish();
+    void remove_dead();
+    void wake();
+    void drop_all();
+
+private:
+    configuration & m_conf;
+    std::string m_path;
+    int m_listen;
+    // writing to it wakes our thread up
+    int m_wake[2];
+    std::thread m_thread;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_publish_pending;
+    std::atomic<int> m_client_count;
+
+    // what we've pushed to the clients so far (only our thread touches it)
+    configuration m_published;
+    std::vector<client*> m_clients;
+};
+
+}
+
+#endif
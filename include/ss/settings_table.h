@@ -0,0 +1,202 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// settings_table.h: compact name -> value table, with lock-free reads
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_SETTINGS_TABLE_H)
+#define SS_SETTINGS_TABLE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include "ss/reclaim.h"
+#include "ss/memory_resource.h"
+#include <atomic>
+#include <vector>
+
+namespace ss { namespace detail {
+
+/*
+    Compact table of settings, kept as structure-of-arrays:
+
+    - names and values are length-prefixed blobs, allocated from arenas (no std::string per setting)
+    - each setting is a key (0, 1, 2, ... in the order they were added) with a 16-byte record:
+      its name blob and its current value blob (the value blob also holds the type, as a 1-byte code)
+    - the lookup index is a flat open-addressing array of 8-byte slots: (hash, key)
+
+    Reads are lock-free: find()/get() never block and are never blocked.
+    Setting a value takes a lock striped by key, and appends a new value blob to that stripe's arena;
+    the old blob becomes garbage, which is reclaimed by compacting the stripe once there's enough of it.
+    Adding a new name is serialized.
+
+    Keys are never removed (only clear() removes everything) - a setting that's gone is marked as removed
+    (see remove_loaded()), until it's set again.
+*/
+class settings_table {
+    settings_table(const settings_table&);
+    void operator=(const settings_table&);
+public:
+    settings_table();
+    ~settings_table();
+
+    // lock-free. Returns the key, or -1 if there's no such name (the key might be removed - see is_removed())
+    int find(const char_t * name, size_t len) const;
+    // lock-free. False if there's no such name, or it's removed
+    bool get(const string & name, string & value, typeinfo & type) const;
+    void get(int key, string & value, typeinfo & type) const;
+    bool is_removed(int key) const;
+    // names never change - the returned pointer is valid as long as the table is (until clear())
+    const char_t * name(int key, size_t & len) const;
+    string name(int key) const;
+
+    // returns false if the value didn't change. The first one keeps the existing type
+    bool set(int key, const string & value);
+    bool set(int key, const string & value, const typeinfo & type);
+    // sets the value as (re)read from disk: it's not reported by take_changed(), and if the key
+    // was set since the last take_changed(), that value is kept
+    bool set_loaded(int key, const string & value, const typeinfo & type);
+    // marks the setting as removed, as (re)read from disk (same rules as set_loaded()).
+    // Returns false if it's not removed
+    bool remove_loaded(int key);
+
+    // returns the key for this name, adding it (with this value) if needed.
+    // 'inserted' tells you whether it was added. If 'changed', the added key is reported by take_changed()
+    // (like, it's added here - as opposed to read from disk)
+    int insert(const string & name, const string & value, const typeinfo & type, bool & inserted, bool changed = false);
+
+    int size() const { return (int)m_size.load(std::memory_order_acquire); }
+
+    // appends the keys whose values were set since the last call (each key once, in no particular order).
+    // Keys added by insert() are not included, unless added as changed
+    void take_changed(std::vector<int> & keys);
+
+    // removes everything. Not thread-safe - only call when nobody else is using the table
+    void clear();
+
+    // where the names/values are allocated from (0 = the default). Applies to what's allocated from now on
+    void set_memory_resource(memory_resource * res);
+
+    struct memory_usage {
+        memory_usage() : keys(0), name_bytes(0), value_bytes(0), garbage_bytes(0), arena_bytes(0), record_bytes(0), index_bytes(0) {}
+        int keys;
+        // payload of the names/values (without any overhead)
+        size_t name_bytes;
+        size_t value_bytes;
+        // old values, not yet reclaimed
+        size_t garbage_bytes;
+        // total memory reserved by the arenas (names + values, including blob headers and free space)
+        size_t arena_bytes;
+        // the per-key records (+ their directory)
+        size_t record_bytes;
+        // the hash index
+        size_t index_bytes;
+
+        size_t total_bytes() const { return arena_bytes + record_bytes + index_bytes; }
+        // bytes per key, besides the name and value themselves
+        double overhead_per_key() const {
+            return keys ? (double)(total_bytes() - name_bytes - value_bytes) / keys : 0;
+        }
+    };
+    void memory(memory_usage & usage) const;
+
+    // type <-> 1-byte code
+    static unsigned char type_code(const typeinfo & type);
+    static typeinfo code_type(unsigned char code);
+
+    static size_t hash_of(const char_t * name, size_t len);
+
+private:
+    struct blob {
+        unsigned int len;
+        unsigned char type;
+        // set if this value was set since the last take_changed(). Only accessed with the stripe locked
+        unsigned char changed;
+        // followed by 'len' characters
+        const char_t * data() const { return reinterpret_cast<const char_t*>(this + 1); }
+        char_t * data() { return reinterpret_cast<char_t*>(this + 1); }
+    };
+
+    struct record {
+        const blob * name;
+        std::atomic<const blob*> value;
+    };
+    enum { SEGMENT_SIZE = 1024, STRIPES = 16 };
+    // the type code of a removed setting's value (an empty value)
+    enum { REMOVED = 0xFE };
+    struct segment {
+        record records[SEGMENT_SIZE];
+    };
+    struct directory {
+        explicit directory(size_t capacity);
+        ~directory();
+        size_t capacity;
+        std::atomic<segment*> * segments;
+    };
+    struct index {
+        explicit index(size_t size);
+        ~index();
+        size_t mask;
+        // (hash >> 32) << 32 | (key + 1); 0 = empty
+        std::atomic<unsigned long long> * slots;
+    };
+
+    struct stripe {
+        stripe() : live_bytes(0), garbage_bytes(0) {}
+        critical_section cs;
+        monotonic_arena values;
+        size_t live_bytes;
+        size_t garbage_bytes;
+        // the keys set since the last take_changed()
+        std::vector<int> changed;
+    };
+
+    const record & rec(int key) const;
+    record & rec(int key);
+    int find(const char_t * name, size_t len, size_t hash) const;
+    bool set_impl(int key, const char_t * value, size_t len, unsigned char type, bool loaded);
+    void compact(int stripe_idx);
+    void add_segment_if_needed(int key);
+    void grow_index();
+    void init();
+    void destroy();
+
+    static void delete_directory(void*);
+    static void delete_index(void*);
+    static bool equal(const blob & b, const char_t * data, size_t len);
+    static blob * new_blob(monotonic_arena & arena, const char_t * data, size_t len, unsigned char type);
+
+private:
+    std::atomic<directory*> m_directory;
+    std::atomic<index*> m_index;
+    std::atomic<size_t> m_size;
+    // the keys whose value is in a stripe's arena - including the one being inserted, before m_size
+    // includes it (so that compacting that stripe copies its value too)
+    std::atomic<size_t> m_valued;
+
+    // serializes inserts; guards m_names
+    mutable critical_section m_insert_cs;
+    monotonic_arena m_names;
+    size_t m_name_bytes;
+
+    stripe m_stripes[STRIPES];
+};
+
+}}
+
+#endif
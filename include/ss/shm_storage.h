@@ -0,0 +1,147 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// shm_storage.h: settings shared between processes, through POSIX shared memory
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_SHM_STORAGE_H)
+#define SS_SHM_STORAGE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include "ss/setting_storage.h"
+#include "ss/settings_table.h"
+#include <atomic>
+#include <map>
+
+namespace ss {
+
+/*
+    Settings published by one process, and read by many others, from a POSIX shared memory segment
+    (so that N worker processes don't each parse and keep their own copy of the same settings).
+
+    The writer keeps its settings in memory; each save() publishes all of them as a new generation:
+    a new segment "<name>.<generation>" with a read-optimized layout (entries + hash index + string table),
+    which is never modified afterwards. The control segment "<name>" says which generation is current;
+    it's guarded by a seqlock, so switching to a new generation is atomic for readers.
+
+    Readers never block (not even on the writer): on each read, they check the control segment's
+    version word, and if there's a new generation, they map it (the old one is unmapped once
+    no thread is still reading it).
+
+    // the process that owns the settings
+    configuration shared;
+    shared.add_storage("", new shm_storage("/my_app.settings", shm_storage::open_writer));
+    def_cfg().copy_into(shared);
+    shared.save();
+
+    // each worker
+    def_cfg().add_storage("shared", new shm_storage("/my_app.settings"));
+
+    Notes:
+    - readers pick up a new generation on their next read. If the configuration uses the read cache,
+      call refresh() now and then (it invalidates the read caches when there's a new generation)
+    - only one writer at a time. If the writer dies while publishing, readers keep the last generation
+    - the segments outlive the processes; use remove() to get rid of them
+    - POSIX only
+*/
+class shm_storage : public setting_storage
+{
+public:
+    enum open_type {
+        // maps the published settings, read-only
+        open_reader,
+        // publishes the settings (it starts from what is already published, if anything)
+        open_writer
+    };
+
+    explicit shm_storage(const std::string & segment_name, open_type open = open_reader);
+    ~shm_storage();
+
+    void save() ;
+    void get_setting( const string & name, string & value, typeinfo&) const ;
+    bool find_setting( const string & name, string & value, typeinfo&) const ;
+    void set_setting( const string & name, const string & value, const typeinfo&) ;
+    void enum_settings( std::map<string,string> & values) const ;
+
+    // readers: switches to the latest generation, if there's a new one. Returns true if it did
+    bool refresh();
+    // the generation we're looking at (0 = nothing published yet)
+    unsigned long long generation() const;
+
+    // unlinks the segments (processes that have them mapped can still use them)
+    static void remove(const std::string & segment_name);
+
+    bool is_self_synchronized() const { return true; }
+    // we switch to the writer's latest generation as we're read
+    bool checks_for_changes_on_read() const { return true; }
+
+protected:
+    void on_memory_resource_changed(memory_resource * res);
+
+private:
+    struct control;
+    struct generation_header;
+    struct entry;
+    // a mapped generation
+    struct mapping {
+        mapping() : addr(0), size(0), number(0), header(0), slots(0), entries(0) {}
+        void * addr;
+        size_t size;
+        unsigned long long number;
+        const generation_header * header;
+        const unsigned int * slots;
+        const entry * entries;
+    };
+
+    bool attach() const;
+    bool check_generation() const;
+    mapping * map_generation(unsigned long long number, unsigned long long size) const;
+    bool find(const mapping & m, const string & name, string & value, typeinfo & type) const;
+    bool publish();
+    void load_published();
+
+    static bool well_formed(mapping & m);
+    static void entries_of(const mapping & m, std::map<string,string> & values);
+    static void delete_mapping(void * p);
+    static std::string generation_name(const std::string & segment_name, unsigned long long number);
+
+private:
+    std::string m_name;
+    open_type m_open;
+
+    // the control segment (0 until the writer created it)
+    mutable std::atomic<control*> m_control;
+    // readers: the generation we're reading
+    mutable std::atomic<mapping*> m_current;
+    // serializes attaching/mapping a new generation
+    mutable detail::critical_section m_map_cs;
+    // readers that started before the writer: when we last looked for the control segment
+    mutable std::atomic<long long> m_next_attach;
+    // readers: the last generation we rejected, because it doesn't match the schema
+    mutable std::atomic<unsigned long long> m_rejected;
+
+    // the writer: the settings it will publish
+    detail::settings_table m_table;
+    unsigned long long m_published;
+};
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// socket_protocol.h: what settings_daemon and socket_storage say to each other, over a Unix domain socket
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_SOCKET_PROTOCOL_H)
+#define SS_SOCKET_PROTOCOL_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <string>
+
+namespace ss { namespace detail {
+
+/*
+    Each message is a frame: "<verb> <length>\n" followed by <length> bytes of payload.
+    The payloads are deltas, as written by write_delta() (see ss/merkle.h), in UTF-8.
+
+    client -> daemon
+    SYNC    (empty)     - send me all the settings, then push me what changes
+    SET     delta       - set these (the client batches whatever it set meanwhile)
+
+    daemon -> client
+    SNAPSHOT delta      - all the settings (the answer to SYNC)
+    DELTA   delta       - these changed (pushed to all clients)
+
+    POSIX only.
+*/
+namespace socket_protocol {
+    const char * const SYNC = "SYNC";
+    const char * const SET = "SET";
+    const char * const SNAPSHOT = "SNAPSHOT";
+    const char * const DELTA = "DELTA";
+
+    // -1 on error
+    int listen_to(const std::string & path);
+    int connect_to(const std::string & path);
+    // a write that takes longer than this fails (so a stuck peer doesn't block us forever)
+    void set_send_timeout(int fd, int ms);
+    void close_socket(int fd);
+
+    // the whole frame, or false
+    bool send_frame(int fd, const char * verb, const std::string & payload);
+
+    // splits what we read into frames
+    class frame_reader {
+    public:
+        frame_reader() : m_pos(0) {}
+        // reads what's available (once). False if the peer closed the socket, or it failed
+        bool read_some(int fd);
+        // the next complete frame, if we have one. Sets 'bad' if the peer sent garbage
+        bool next(std::string & verb, std::string & payload, bool & bad);
+        void clear() { m_buffer.erase(); m_pos = 0; }
+    private:
+        std::string m_buffer;
+        // where the next frame starts, within m_buffer
+        size_t m_pos;
+    };
+}
+
+}}
+
+#endif
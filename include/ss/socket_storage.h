@@ -0,0 +1,111 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// socket_storage.h: the settings of a settings_daemon, replicated locally
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_SOCKET_STORAGE_H)
+#define SS_SOCKET_STORAGE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include "ss/setting_storage.h"
+#include "ss/settings_table.h"
+#include "ss/merkle.h"
+#include "ss/socket_protocol.h"
+#include <atomic>
+#include <map>
+#include <thread>
+
+namespace ss {
+
+/*
+    A replica of the settings a settings_daemon serves (see ss/settings_daemon.h):
+
+    def_cfg().add_storage("shared", new socket_storage("/run/my_app.sock", "/var/cache/my_app.replica"));
+
+    When created, it fetches all the settings at once; from then on, the daemon pushes every change,
+    and a thread of ours applies it. Reads are local (and lock-free) - they never wait for the daemon.
+
+    Settings you set here are set locally right away, and sent to the daemon in batches (whatever was
+    set since the last batch went out). The daemon applies them, then pushes them to everybody.
+
+    If the daemon is not available, we start from the replica file (the settings as we last got them),
+    and keep trying to reconnect; once we do, we fetch everything again, then send what was set meanwhile.
+
+    POSIX only.
+*/
+class socket_storage : public setting_storage
+{
+public:
+    // replica_file - where we keep the settings we last got (empty = we don't keep them).
+    // We wait at most connect_timeout_ms for the daemon to send us the settings
+    explicit socket_storage(const std::string & socket_path, const std::string & replica_file = std::string(), int connect_timeout_ms = 1000);
+    ~socket_storage();
+
+    // sends what was set, now
+    void save() ;
+    void get_setting( const string & name, string & value, typeinfo&) const ;
+    bool find_setting( const string & name, string & value, typeinfo&) const ;
+    void set_setting( const string & name, const string & value, const typeinfo&) ;
+    void enum_settings( std::map<string,string> & values) const ;
+
+    // are we connected to the daemon right now?
+    bool is_connected() const { return m_connected.load(std::memory_order_relaxed); }
+
+    // get_setting() is lock-free, set_setting() locks only when adding a new setting
+    bool is_self_synchronized() const { return true; }
+
+protected:
+    void on_memory_resource_changed(memory_resource * res);
+
+private:
+    bool connect(int timeout_ms);
+    void disconnect();
+    void io_thread();
+    // false if the daemon sent garbage
+    bool on_frames(bool & got_settings);
+    void apply(const std::string & payload);
+    bool send_pending();
+    void wake();
+
+    void load_replica();
+    void save_replica();
+
+private:
+    std::string m_path;
+    std::string m_replica_file;
+    int m_fd;
+    int m_wake[2];
+    std::thread m_io;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_connected;
+    // (only the connecting thread, then our thread, use it)
+    detail::socket_protocol::frame_reader m_reader;
+
+    detail::settings_table m_table;
+
+    // set here, not sent yet (name -> latest change)
+    ::ss::detail::critical_section m_pending_cs;
+    std::map<string, setting_change> m_pending;
+};
+
+}
+
+#endif
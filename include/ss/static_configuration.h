@@ -0,0 +1,266 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// static_configuration.h: a configuration whose storages are known at compile time
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_STATIC_CONFIGURATION_H)
+#define SS_STATIC_CONFIGURATION_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/setting.h"
+#include "ss/setting_storage.h"
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+
+namespace ss {
+
+// names a mount point - a type, so that it can be a template argument:
+// SS_MOUNT_NAME(net_mount, "app.net");
+#define SS_MOUNT_NAME(tag, name) \
+    struct tag { \
+        static const ::ss::char_t * str() { return TTEXT(name); } \
+        enum { length = sizeof(TTEXT(name)) / sizeof(::ss::char_t) - 1 }; \
+    }
+
+// the root (it gets the settings no other mount point claims)
+SS_MOUNT_NAME(root_mount, "");
+
+// a storage of type 'storage', mounted at 'name_type' (see SS_MOUNT_NAME)
+template<class storage, class name_type> struct mount {
+    typedef storage storage_type;
+    typedef name_type name;
+};
+
+template<class... mounts> class static_configuration;
+
+namespace detail {
+    // if the (lower-case) name belongs to the mount point, the length of the mount point's name; otherwise, -1.
+    // Same rules as configuration::resolve_name()
+    template<class name_type> inline int mount_length(const string & lo_name) {
+        const int len = name_type::length;
+        if ( len == 0)
+            return 0;
+        if ( (int)lo_name.size() <= len || lo_name[len] != '.')
+            return -1;
+        return std::char_traits<char_t>::compare( lo_name.data(), name_type::str(), len) == 0 ? len : -1;
+    }
+
+    // walks the mount points - unrolled at compile time
+    template<size_t idx, class... mounts> struct static_router {
+        static void route(const string &, int &, int &) {}
+        template<class tuple_type> static void add(configuration &, const tuple_type &) {}
+        template<class tuple_type> static void release(const tuple_type &) {}
+        template<class tuple_type, class visitor> static void call(const tuple_type &, int, visitor &) {}
+    };
+
+    template<size_t idx, class first, class... rest> struct static_router<idx, first, rest...> {
+        typedef static_router<idx + 1, rest...> next;
+
+        // the longest mount point the name belongs to (like configuration::resolve_name())
+        static void route(const string & lo_name, int & best, int & best_len) {
+            int len = mount_length<typename first::name>(lo_name);
+            if ( len > best_len) {
+                best = (int)idx;
+                best_len = len;
+            }
+            next::route(lo_name, best, best_len);
+        }
+
+        template<class tuple_type> static void add(configuration & conf, const tuple_type & storages) {
+            // (we keep it, even if it's removed from the configuration)
+            std::get<idx>(storages)->use();
+            conf.add_storage( first::name::str(), std::get<idx>(storages));
+            next::add(conf, storages);
+        }
+
+        template<class tuple_type> static void release(const tuple_type & storages) {
+            std::get<idx>(storages)->un_use();
+            next::release(storages);
+        }
+
+        // visitor( the storage of this mount point, as its real type)
+        template<class tuple_type, class visitor> static void call(const tuple_type & storages, int mount, visitor & v) {
+            if ( mount == (int)idx)
+                v( *std::get<idx>(storages));
+            else
+                next::call(storages, mount, v);
+        }
+    };
+
+    // reads a setting from a storage whose type we know
+    template<class type> struct static_reader {
+        static_reader(configuration & conf, const string & name) : conf(conf), name(name), val() {}
+
+        template<class storage_type> void operator()(storage_type & storage) {
+            typed_value typed;
+            if ( conf.get_schema() && storage.do_get_typed(name, typed) && from_typed(typed, val))
+                // the schema already converted it
+                return;
+            string val_str;
+            typeinfo set_type = typeid(type);
+            storage.template do_get_setting_as<storage_type>(name, val_str, set_type);
+            int enum_value;
+            if ( std::is_enum<type>::value && conf.enum_holder_().get_enum(typeid(type), val_str, enum_value)) {
+                ostringstream out;
+                out << enum_value;
+                val_str = out.str();
+            }
+            istringstream in( val_str);
+            from_stream( in, val);
+            if ( in.fail() )
+                conf.get_error_handler()( err::cannot_convert, TTEXT("value cannot be converted to underlying type") );
+        }
+
+        configuration & conf;
+        const string & name;
+        type val;
+    };
+}
+
+
+/*
+    A configuration whose storages are fixed, and known at compile time:
+
+    SS_MOUNT_NAME(app_mount, "app");
+    typedef static_configuration< mount<file_storage, app_mount>, mount<memory_storage, root_mount> > my_config;
+    my_config cfg( new file_storage("app.txt"), new memory_storage );
+
+    long retries = setting<long>("app.retries", cfg);
+    setting<long>("app.retries", cfg) = 5;
+
+    A name is routed to its storage by comparing it against the mount points' names, in code the compiler
+    unrolls (no map lookups, no locks). Reads call the storage's functions directly (not virtually),
+    so the compiler can inline them (the storages' code is in the library - use link-time optimization).
+    Writes go through the configuration, like any other (so that const settings, setting defaults,
+    read views, diffs and enums work as usual).
+
+    It is a configuration: anything that takes a configuration takes it - but don't add/remove storages.
+    Reads through it don't go through the read cache, read views or the startup profile.
+*/
+template<class... mounts> class static_configuration : public configuration {
+    static_configuration(const static_configuration&);
+    void operator=(const static_configuration&);
+
+    typedef detail::static_router<0, mounts...> router;
+public:
+    typedef std::tuple<typename mounts::storage_type*...> storages;
+
+    explicit static_configuration(typename mounts::storage_type * ... stores) : m_storages(stores...) {
+        router::add(*this, m_storages);
+    }
+    ~static_configuration() {
+        router::release(m_storages);
+    }
+
+    // the mount point the name belongs to (-1 if none), where it is (its name) and its name there
+    int route(const string & name, string & place, string & sett_name) const {
+        string lo_name = name;
+        std::transform( lo_name.begin(), lo_name.end(), lo_name.begin(), tolower);
+        int mount = -1, len = -1;
+        router::route(lo_name, mount, len);
+        if ( mount < 0) {
+            // (it reports the error)
+            resolve_name( name, place, sett_name, resolve_dont_care);
+            return -1;
+        }
+        place = lo_name.substr(0, len);
+        sett_name = len > 0 ? lo_name.substr(len + 1) : lo_name;
+        return mount;
+    }
+
+    template<class type> type read(int mount, const string & place, const string & sett_name) {
+        if ( mount < 0)
+            return detail::read_setting<type>(*this, place, sett_name);
+        detail::static_reader<type> reader(*this, sett_name);
+        router::call(m_storages, mount, reader);
+        return reader.val;
+    }
+
+    // (the name is resolved again - it might be const, or we might be setting defaults)
+    template<class type> void write(const string & name, const type & val) {
+        string place, sett_name;
+        resolve_name( name, place, sett_name, resolve_writable);
+        ostringstream out;
+        out << val;
+        set_setting( place, sett_name, out.str(), typeid(type) );
+    }
+
+    // the storage mounted at mount point 'idx' (in the order they were given)
+    template<size_t idx> typename std::tuple_element<idx, storages>::type storage() const { return std::get<idx>(m_storages); }
+
+private:
+    storages m_storages;
+};
+
+
+/**
+    setting<some_type>("some_name", static_cfg) - like forced_setting_t, routed at compile time
+*/
+template<class type, class config_type> class static_setting_t {
+    typedef static_setting_t<type, config_type> self_type;
+public:
+    static_setting_t( const string & name, config_type & conf) : m_full_name(name), m_conf(conf) {
+        m_mount = m_conf.route( name, m_place, m_name);
+    }
+
+    // easy conversion
+    operator type() const { return get(); }
+
+    self_type & operator=( const type & val) {
+        set( val);
+        return *this;
+    }
+    template< class other_type> self_type & operator=( const forced_setting_t<other_type> & other) {
+        set( (other_type)other );
+        return *this;
+    }
+    template< class other_type, class other_config> self_type & operator=( const static_setting_t<other_type, other_config> & other) {
+        set( (other_type)other );
+        return *this;
+    }
+    self_type & operator=( const self_type & other) {
+        set( other.get() );
+        return *this;
+    }
+
+private:
+    type get() const {
+        return m_conf.template read<type>( m_mount, m_place, m_name);
+    }
+    void set( const type & val) {
+        m_conf.write( m_full_name, val);
+    }
+
+private:
+    int m_mount;
+    string m_place;
+    string m_name;
+    string m_full_name;
+    config_type & m_conf;
+};
+
+template< class t, class... mounts> inline static_setting_t< t, static_configuration<mounts...> > setting( const string & name, static_configuration<mounts...> & conf) {
+    return static_setting_t< t, static_configuration<mounts...> >( name, conf);
+}
+
+}
+
+#endif
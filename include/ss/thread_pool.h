@@ -0,0 +1,74 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// thread_pool.h: a few threads that run tasks in the background
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_THREAD_POOL_H)
+#define SS_THREAD_POOL_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "ss/fwd.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ss { namespace detail {
+
+/*
+    Runs tasks on a fixed number of threads. The threads are started when the first task comes
+    (a process that never submits anything doesn't pay for them).
+
+    On destruction, the tasks still queued are run, then the threads are joined.
+*/
+class thread_pool {
+    thread_pool(const thread_pool&);
+    void operator=(const thread_pool&);
+public:
+    // threads = 0 - one per core
+    explicit thread_pool(int threads = 0);
+    ~thread_pool();
+
+    // the future is set once the task ran (if it threw, the future holds the exception)
+    std::shared_future<void> submit(const std::function<void()> & task);
+
+    // the pool the library uses (like, for loading storages in the background - see configuration::load_in_background())
+    static thread_pool & shared();
+
+private:
+    void worker();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque< std::packaged_task<void()> > m_tasks;
+    std::vector<std::thread> m_threads;
+    int m_size;
+    // threads waiting for a task
+    int m_idle;
+    bool m_stop;
+};
+
+}}
+
+#endif
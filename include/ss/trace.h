@@ -0,0 +1,101 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// trace.h: low-overhead begin/end event tracing
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(SS_TRACE_H)
+#define SS_TRACE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+/*
+    Tracing of the library's own operations (resolve_name, get_setting, set_setting, save,
+    and each storage operation).
+
+    It's compiled in only if you #define SETTING_TRACE - otherwise SS_TRACE_SCOPE expands to nothing.
+    When compiled in, it's still off until you call ss::trace::enable(true).
+
+    Each thread writes its begin/end events into its own ring buffer (no locks, no allocations
+    once the buffer exists). When a buffer is full, the oldest events are overwritten.
+    Buffers of threads that ended are kept (so their events can still be dumped) - the last few of them;
+    older ones are reused by new threads.
+    At any time, you can dump what's in the buffers as Chrome trace-event JSON
+    (open it in chrome://tracing or https://ui.perfetto.dev):
+
+    ss::trace::enable(true);
+    ...
+    ss::trace::dump_chrome_trace("ss_trace.json");
+*/
+
+#ifdef SETTING_TRACE
+#define SS_IS_TRACING
+
+#include <atomic>
+#include <iosfwd>
+#include <string>
+
+namespace ss { namespace trace {
+
+    namespace detail {
+        extern std::atomic<bool> g_enabled;
+
+        // records one event for the current thread. 'name' must be a string literal
+        void record(const char * name, bool is_begin);
+
+        struct scope {
+            explicit scope(const char * name) : m_name( g_enabled.load(std::memory_order_relaxed) ? name : 0) {
+                if ( m_name) record(m_name, true);
+            }
+            ~scope() {
+                if ( m_name) record(m_name, false);
+            }
+        private:
+            scope(const scope&);
+            void operator=(const scope&);
+            const char * m_name;
+        };
+    }
+
+    void enable(bool on);
+    inline bool is_enabled() { return detail::g_enabled.load(std::memory_order_relaxed); }
+
+    // how many events each thread's ring buffer holds. Only affects threads that haven't traced anything yet
+    void set_buffer_size(int events);
+
+    // writes all events still in the ring buffers, as Chrome trace-event JSON
+    void dump_chrome_trace(std::ostream & out);
+    bool dump_chrome_trace(const std::string & file_name);
+
+    // forgets all recorded events
+    void clear();
+
+}}
+
+#define SS_TRACE_CAT_(a,b) a ## b
+#define SS_TRACE_CAT(a,b) SS_TRACE_CAT_(a,b)
+#define SS_TRACE_SCOPE(name) ::ss::trace::detail::scope SS_TRACE_CAT(ss_trace_scope_, __LINE__)(name)
+
+#else
+
+// tracing compiled out
+#define SS_TRACE_SCOPE(name)
+
+#endif
+
+#endif
@@ -27,6 +27,7 @@
 #undef SS_IS_THREAD_SAFE
 #undef SS_TS_WIN
 #undef SS_TS_BOOST
+#undef SS_TS_STD
 
 #ifdef SETTING_NOT_THREAD_SAFE
 // not thread safe
@@ -36,12 +37,43 @@
 #elif defined(SETTING_THREAD_SAFE_USE_WIN)
 #define SS_IS_THREAD_SAFE
 #define SS_TS_WIN
-#else
+#elif defined(SETTING_THREAD_SAFE_USE_STD)
+#define SS_IS_THREAD_SAFE
+#define SS_TS_STD
+#elif defined(_WIN32)
 // default - thread safe, use Win Threads
 #define SS_IS_THREAD_SAFE
 #define SS_TS_WIN
+#else
+// default on other platforms - thread safe, use the C++11 standard library
+#define SS_IS_THREAD_SAFE
+#define SS_TS_STD
 #endif
 
+#if defined(SETTING_LOCK_STATS) && defined(SS_IS_THREAD_SAFE)
+// each critical section keeps acquisition/wait/hold statistics - see ss/lock_stats.h
+#define SS_LOCK_STATS
+#endif
+
+#include <string>
+
+namespace ss {
+
+// how an object (a configuration, a storage) synchronizes access to it - chosen per instance
+// (see configuration::set_locking() and setting_storage::set_locking())
+enum locking_policy {
+    // the object is used by one thread only - no locking at all
+    lock_none,
+    // readers and writers take the same lock (the default)
+    lock_mutex,
+    // readers share the lock, writers take it exclusively
+    lock_reader_writer,
+    // readers don't lock: they read a snapshot that writers replace (never modify); writers take a lock
+    lock_snapshot
+};
+
+}
+
 // thread-safe issues.
 namespace ss { namespace detail {
 
@@ -53,23 +85,146 @@ namespace ss { namespace detail {
 #include <windows.h>
 namespace ss { namespace detail {
 
-class critical_section {
-    critical_section & operator = ( const critical_section & Not_Implemented);
-    critical_section( const critical_section & From);
+class win_critical_section {
+    win_critical_section & operator = ( const win_critical_section & Not_Implemented);
+    win_critical_section( const win_critical_section & From);
 public:
-    critical_section() {    InitializeCriticalSection( GetCriticalSectionPtr() ); }
+    win_critical_section() {    InitializeCriticalSection( GetCriticalSectionPtr() ); }
+    ~win_critical_section() {   DeleteCriticalSection( GetCriticalSectionPtr() ); }
     void Lock() {           EnterCriticalSection( GetCriticalSectionPtr()); }
     void Unlock() {         LeaveCriticalSection( GetCriticalSectionPtr()); }
+    bool TryLock() {        return TryEnterCriticalSection( GetCriticalSectionPtr()) != FALSE; }
     operator LPCRITICAL_SECTION() const { return GetCriticalSectionPtr(); }
+
+    // same interface as the boost/std mutexes
+    void lock() { Lock(); }
+    void unlock() { Unlock(); }
+    bool try_lock() { return TryLock(); }
 private:
     LPCRITICAL_SECTION GetCriticalSectionPtr() const { return &m_cs; }
 private:
     // the critical section itself
     mutable CRITICAL_SECTION m_cs;
 };
+typedef win_critical_section raw_critical_section;
 
+#elif defined(SS_TS_BOOST)
+}}
+#include <boost/thread/recursive_mutex.hpp>
+namespace ss { namespace detail {
+typedef boost::recursive_mutex raw_critical_section;
+#elif defined(SS_TS_STD)
+}}
+#include <mutex>
+namespace ss { namespace detail {
+typedef std::recursive_mutex raw_critical_section;
+#else
+#error Invalid thread safety option
+#endif
 
 
+#ifdef SS_LOCK_STATS
+}}
+#include <atomic>
+#include <chrono>
+namespace ss { namespace detail {
+
+/*
+    instrumented critical section: counts acquisitions, contended acquisitions, and
+    keeps the total time spent waiting, and the total/max time the lock was held.
+
+    Each instance registers itself, so that you can get a report at any time - see ss/lock_stats.h
+    Name instances with name_lock(), so that the report tells you which lock hurts.
+*/
+class critical_section {
+    critical_section & operator = ( const critical_section & Not_Implemented);
+    critical_section( const critical_section & From);
+public:
+    critical_section();
+    ~critical_section();
+
+    void lock() {
+        if ( !m_raw.try_lock()) {
+            long long wait_start = now_ns();
+            m_raw.lock();
+            long long waited = now_ns() - wait_start;
+            m_contended.fetch_add(1, std::memory_order_relaxed);
+            m_wait_ns.fetch_add(waited, std::memory_order_relaxed);
+            if ( waited > m_max_wait_ns.load(std::memory_order_relaxed))
+                m_max_wait_ns.store(waited, std::memory_order_relaxed);
+        }
+        // we own the lock - the counters below only change while it's held
+        if ( ++m_depth == 1) {
+            m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+            m_hold_start = now_ns();
+        }
+    }
+    bool try_lock() {
+        if ( !m_raw.try_lock())
+            return false;
+        if ( ++m_depth == 1) {
+            m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+            m_hold_start = now_ns();
+        }
+        return true;
+    }
+    void unlock() {
+        if ( --m_depth == 0) {
+            long long held = now_ns() - m_hold_start;
+            m_hold_ns.fetch_add(held, std::memory_order_relaxed);
+            if ( held > m_max_hold_ns.load(std::memory_order_relaxed))
+                m_max_hold_ns.store(held, std::memory_order_relaxed);
+        }
+        m_raw.unlock();
+    }
+
+    static long long now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    friend struct lock_registry;
+    raw_critical_section m_raw;
+    // recursion depth - hold time is measured for the outermost lock only
+    int m_depth;
+    long long m_hold_start;
+
+    std::atomic<unsigned long long> m_acquisitions;
+    std::atomic<unsigned long long> m_contended;
+    std::atomic<long long> m_wait_ns;
+    std::atomic<long long> m_max_wait_ns;
+    std::atomic<long long> m_hold_ns;
+    std::atomic<long long> m_max_hold_ns;
+
+    // guarded by the registry
+    std::string m_name;
+    critical_section * m_prev;
+    critical_section * m_next;
+};
+
+class scoped_lock
+{
+    scoped_lock operator=( scoped_lock & Not_Implemented);
+    scoped_lock( const scoped_lock & Not_Implemented);
+public:
+    scoped_lock( critical_section & csResource) : m_csResource( csResource) {
+        m_csResource.lock();
+    }
+    ~scoped_lock() {
+        m_csResource.unlock();
+    }
+private:
+    critical_section & m_csResource;
+};
+
+// gives a name to a critical section, as it will appear in the lock statistics report
+void name_lock( critical_section & cs, const std::string & name);
+
+#else
+
+typedef raw_critical_section critical_section;
+
 /*
     allows automatic Locking/ Unlocking of a Resource,
     protected by a Critical Section:
@@ -80,26 +235,131 @@ class scoped_lock
     scoped_lock( const scoped_lock & Not_Implemented);
 public:
     scoped_lock( critical_section & csResource) : m_csResource( csResource) {
-        m_csResource.Lock();
+        m_csResource.lock();
     }
     ~scoped_lock() {
-        m_csResource.Unlock();
+        m_csResource.unlock();
     }
 private:
     critical_section & m_csResource;
 };
 
+// gives a name to a critical section (only used when gathering lock statistics)
+inline void name_lock( critical_section &, const std::string &) {}
 
-
-#elif defined(SS_TS_BOOST)
-#include <boost/thread/recursive_mutex.hpp>
-typedef boost::recursive_mutex critical_section;
-typedef boost::recursive_mutex::scoped_lock scoped_lock;
-#else
-#error Invalid thread safety option
 #endif
 
 
+}}
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+namespace ss { namespace detail {
+
+/*
+    A lock whose behavior is chosen per instance (see locking_policy):
+
+    lock_none           - lock()/lock_shared() do nothing
+    lock_mutex          - both take the critical section
+    lock_reader_writer  - lock_shared() lets readers in together; lock() waits until there are none.
+                          Readers are never kept waiting by writers that wait (so a thread can share it recursively);
+                          a thread that shares it can't lock() it too (that would wait for itself)
+    lock_snapshot       - lock_shared() does nothing (the data readers see is replaced, never modified);
+                          lock() takes the critical section
+
+    Set the policy before the lock is used by more than one thread.
+*/
+class policy_lock {
+    policy_lock( const policy_lock&);
+    void operator=( const policy_lock&);
+public:
+    policy_lock() : m_policy(lock_mutex), m_readers(0), m_writer_depth(0) {}
+
+    void policy( locking_policy p) { m_policy = p; }
+    locking_policy policy() const { return m_policy; }
+
+    void lock() {
+        if ( m_policy == lock_none)
+            return;
+        if ( m_policy == lock_reader_writer)
+            lock_writer();
+        m_cs.lock();
+    }
+    void unlock() {
+        if ( m_policy == lock_none)
+            return;
+        m_cs.unlock();
+        if ( m_policy == lock_reader_writer)
+            unlock_writer();
+    }
+    void lock_shared() {
+        if ( m_policy == lock_mutex)
+            m_cs.lock();
+        else if ( m_policy == lock_reader_writer)
+            lock_reader();
+    }
+    void unlock_shared() {
+        if ( m_policy == lock_mutex)
+            m_cs.unlock();
+        else if ( m_policy == lock_reader_writer)
+            unlock_reader();
+    }
+
+    // the critical section writers take (for naming it, or for locking it regardless of the policy)
+    critical_section & raw() const { return m_cs; }
+
+private:
+    void lock_writer() {
+        std::unique_lock<std::mutex> lk(m_state);
+        if ( m_writer == std::this_thread::get_id()) {
+            ++m_writer_depth;
+            return;
+        }
+        while ( m_readers > 0 || m_writer != std::thread::id())
+            m_changed.wait(lk);
+        m_writer = std::this_thread::get_id();
+        m_writer_depth = 1;
+    }
+    void unlock_writer() {
+        std::lock_guard<std::mutex> lk(m_state);
+        if ( --m_writer_depth > 0)
+            return;
+        m_writer = std::thread::id();
+        m_changed.notify_all();
+    }
+    void lock_reader() {
+        std::unique_lock<std::mutex> lk(m_state);
+        if ( m_writer == std::this_thread::get_id()) {
+            // the writer reads what it writes
+            ++m_writer_depth;
+            return;
+        }
+        while ( m_writer != std::thread::id())
+            m_changed.wait(lk);
+        ++m_readers;
+    }
+    void unlock_reader() {
+        std::lock_guard<std::mutex> lk(m_state);
+        if ( m_writer == std::this_thread::get_id()) {
+            --m_writer_depth;
+            return;
+        }
+        if ( --m_readers == 0)
+            m_changed.notify_all();
+    }
+
+private:
+    locking_policy m_policy;
+    mutable critical_section m_cs;
+
+    // lock_reader_writer
+    std::mutex m_state;
+    std::condition_variable m_changed;
+    int m_readers;
+    std::thread::id m_writer;
+    int m_writer_depth;
+};
+
 #else
 // not thread-safe
 
@@ -113,8 +373,47 @@ public:
     ~scoped_lock() {}
 };
 
+inline void name_lock( critical_section &, const std::string &) {}
+
+class policy_lock {
+public:
+    policy_lock() : m_policy(lock_none) {}
+    void policy( locking_policy p) { m_policy = p; }
+    locking_policy policy() const { return m_policy; }
+    void lock() {}
+    void unlock() {}
+    void lock_shared() {}
+    void unlock_shared() {}
+    critical_section & raw() const { return m_cs; }
+private:
+    locking_policy m_policy;
+    mutable critical_section m_cs;
+};
+
 #endif
 
+// locks a policy_lock for writing, while in scope
+class write_lock {
+    write_lock( const write_lock&);
+    void operator=( const write_lock&);
+public:
+    write_lock( policy_lock & lock) : m_lock(lock) { m_lock.lock(); }
+    ~write_lock() { m_lock.unlock(); }
+private:
+    policy_lock & m_lock;
+};
+
+// locks a policy_lock for reading, while in scope
+class read_lock {
+    read_lock( const read_lock&);
+    void operator=( const read_lock&);
+public:
+    read_lock( policy_lock & lock) : m_lock(lock) { m_lock.lock_shared(); }
+    ~read_lock() { m_lock.unlock_shared(); }
+private:
+    policy_lock & m_lock;
+};
+
 }}
 
 #endif 
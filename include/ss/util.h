@@ -32,6 +32,13 @@ string full_setting_name(const string & place, const string & sett_name) ;
 void trim(string & value);
 string unescape_string(const string & value) ;
 string escape_string(const string & value) ;
+// appends the escaped value to 'dest' (doesn't allocate, as long as 'dest' has enough capacity)
+void append_escaped(string & dest, const string & value);
+// if given, raw_value_begin/end are set to where the value's text is, within the line
+bool parse_setting_line(const string & line, string & name, string & value, typeinfo & type, string & comment,
+                        size_t * raw_value_begin = 0, size_t * raw_value_end = 0);
+// the type we store a setting as (int -> long, float -> double, char -> string, etc)
+typeinfo friendly_type(const typeinfo & type);
 
 
 }}
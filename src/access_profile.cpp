@@ -0,0 +1,168 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/setting_storage.h"
+#include "ss/access_profile.h"
+#include "ss/thread_pool.h"
+#include "ss/util.h"
+#include <chrono>
+
+namespace ss { namespace detail {
+
+access_profile::prefetched::prefetched(setting_storage * storage) : storage(storage), reloads(storage->reloads()) {
+}
+
+access_profile::prefetched::~prefetched() {
+    storage->un_use();
+}
+
+access_profile::access_profile(configuration & conf, const std::string & file_name, int seconds)
+        : m_conf(conf), m_file_name(file_name), m_layout_version(0), m_recording(true),
+          m_record_until(now_ms() + (long long)seconds * 1000) {
+}
+
+access_profile::~access_profile() {
+    for ( size_t idx = 0; idx < m_prefetchers.size(); ++idx)
+        m_prefetchers[idx].wait();
+    finish();
+    scoped_lock lk(m_written_cs);
+    if ( m_written.valid())
+        m_written.wait();
+    for ( prefetched_coll::iterator first = m_prefetched.begin(), last = m_prefetched.end(); first != last; ++first)
+        delete first->second;
+}
+
+long long access_profile::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// note: called once, before anyone else can see us
+void access_profile::prefetch() {
+    ifstream in( m_file_name.c_str() );
+    string line;
+    while ( std::getline(in, line) ) {
+        trim(line);
+        if ( line.empty() || line[0] == '#')
+            continue;
+        string place, sett_name;
+        m_conf.resolve_name( line, place, sett_name, configuration::resolve_dont_care);
+        if ( !sett_name.empty() )
+            m_names[place].push_back(sett_name);
+    }
+    if ( m_names.empty() )
+        return;
+
+    // adding/removing storages from now on, makes what we prefetch stale
+    m_layout_version = m_conf.layout_version();
+    for ( std::map<string, std::vector<string> >::const_iterator first = m_names.begin(), last = m_names.end(); first != last; ++first) {
+        setting_storage * storage = m_conf.use_storage(first->first);
+        if ( !storage)
+            continue;
+        if ( storage->checks_for_changes_on_read()) {
+            // reading from it is what keeps it up to date
+            storage->un_use();
+            continue;
+        }
+        m_prefetched[first->first] = new prefetched(storage);
+    }
+    // (m_prefetched doesn't change from now on - only the tables get filled)
+    for ( prefetched_coll::iterator first = m_prefetched.begin(), last = m_prefetched.end(); first != last; ++first) {
+        prefetched * from = first->second;
+        const std::vector<string> * names = &m_names[first->first];
+        m_prefetchers.push_back( thread_pool::shared().submit( [this, from, names] { prefetch_storage(from, names); }) );
+    }
+}
+
+bool access_profile::is_stale(const prefetched & from) const {
+    return m_conf.layout_version() != m_layout_version || from.storage->reloads() != from.reloads
+        // (for instance, it was shared after we prefetched it)
+        || from.storage->checks_for_changes_on_read();
+}
+
+void access_profile::prefetch_storage(prefetched * from, const std::vector<string> * names) {
+    string value;
+    typeinfo type;
+    for ( size_t idx = 0; idx < names->size(); ++idx) {
+        if ( is_stale(*from))
+            // what we'd prefetch from now on is not used anyway
+            break;
+        const string & name = (*names)[idx];
+        if ( !from->storage->do_find_setting(name, value, type))
+            continue;
+        bool inserted;
+        from->values.insert(name, value, type, inserted);
+    }
+}
+
+bool access_profile::find(const string & place, const string & sett_name, string & value, typeinfo & type) const {
+    prefetched_coll::const_iterator found = m_prefetched.find(place);
+    if ( found == m_prefetched.end() )
+        return false;
+    const prefetched & from = *found->second;
+    if ( is_stale(from) || from.dropped.find(sett_name.c_str(), sett_name.size()) >= 0)
+        return false;
+    return from.values.get(sett_name, value, type);
+}
+
+void access_profile::on_set(const string & place, const string & sett_name) {
+    prefetched_coll::iterator found = m_prefetched.find(place);
+    if ( found == m_prefetched.end() )
+        return;
+    settings_table & dropped = found->second->dropped;
+    if ( dropped.find(sett_name.c_str(), sett_name.size()) >= 0)
+        return;
+    bool inserted;
+    dropped.insert(sett_name, string(), typeid(string), inserted);
+}
+
+void access_profile::on_read(const string & place, const string & sett_name) {
+    if ( !m_recording.load(std::memory_order_relaxed))
+        return;
+    if ( now_ms() >= m_record_until) {
+        // (the reader that gets here doesn't wait for the file to be written)
+        scoped_lock lk(m_written_cs);
+        if ( m_recording.exchange(false))
+            m_written = thread_pool::shared().submit( [this] { write_file(); });
+        return;
+    }
+    string name = full_setting_name(place, sett_name);
+    if ( m_recorded.find(name.c_str(), name.size()) >= 0)
+        return;
+    bool inserted;
+    m_recorded.insert(name, string(), typeid(string), inserted);
+}
+
+bool access_profile::finish() {
+    scoped_lock lk(m_written_cs);
+    if ( !m_recording.exchange(false))
+        return true;
+    return write_file();
+}
+
+bool access_profile::write_file() {
+    ofstream out( m_file_name.c_str() );
+    out << TTEXT("# settings read at startup, in the order they were first read\n");
+    for ( int key = 0, count = m_recorded.size(); key < count; ++key) {
+        size_t len;
+        const char_t * name = m_recorded.name(key, len);
+        out.write(name, len);
+        out << TTEXT('\n');
+    }
+    out.close();
+    return !out.fail();
+}
+
+}}
@@ -27,17 +27,20 @@ namespace {
         string::size_type equal = name_and_value.find('=');
         assert( equal != string::npos);
         string name = name_and_value.substr(0, equal);
-        string value = name_and_value.substr(equal + 1);
-        detail::trim(value);
+        // remove leading and trailing spaces (without copying the value first)
+        const char_t * b = name_and_value.c_str() + equal + 1, * e = name_and_value.c_str() + name_and_value.size();
+        while ( b != e && isspace(*b)) ++b;
+        while ( b != e && isspace(e[-1])) --e;
+
         typeinfo type;
         type = typeid(variant);
-
-        if ( (value.size() > 2) && (value[0] == '"') && (*value.rbegin() == '"') ) {
+        string value;
+        if ( (e - b > 2) && (*b == '"') && (e[-1] == '"') ) {
             type = typeid(string);
-            value.erase(0, 1);
-            value.erase( value.size() - 1, 1);
-            value = detail::unescape_string(value);
+            value = detail::unescape_string( string(b + 1, e - 1));
         }
+        else
+            value.assign(b, e);
 
         def_cfg().add_default_value(name, value, type);
 
@@ -20,19 +20,34 @@
 #include "ss/configuration.h"
 #include "ss/setting_storage.h"
 #include "ss/setting.h"
+#include "ss/trace.h"
+#include "ss/reclaim.h"
+#include "ss/access_profile.h"
+#include "ss/thread_pool.h"
+#include "ss/declared_setting.h"
 #include <algorithm>
+#include <mutex>
+#include <thread>
 #include <assert.h>
 
-using ss::detail::scoped_lock;
+using ss::detail::read_lock;
+using ss::detail::write_lock;
 
 
 namespace ss {
 
 namespace {
-    // make sure default configuration is initialized before main
-    struct configuration_init {
-        configuration_init() { configuration::def(); }
-    } s_init;
+    // the default configuration is initialized (init_settings() is called) the first time it's used -
+    // not during static initialization
+    std::once_flag s_def_once;
+    std::atomic<bool> s_def_inited(false);
+    // the thread calling init_settings() - while it does, it gets the default configuration as it is
+    thread_local bool t_initing_def = false;
+
+    struct initing_def {
+        initing_def() { t_initing_def = true; }
+        ~initing_def() { t_initing_def = false; }
+    };
 
     // converts a value to lower-case
     string locase( const string & str) {
@@ -41,24 +56,55 @@ namespace {
         std::transform( str.begin(), str.end(), lo.begin(), tolower);
         return lo;
     }
-
-    struct do_delete {
-        template< class T> void operator()( T & val) {
-            delete val.second;
-        }
-    };
 }
 
+// a value overwritten while there were read views
+struct configuration::version_entry {
+    unsigned long long version;
+    string place;
+    string name;
+    // the value before it was set (if the setting existed)
+    bool had_value;
+    string value;
+    typeinfo type;
+    // older entries
+    std::atomic<version_entry*> next;
+};
+
+// reads the layout while in scope. Under lock_snapshot, it doesn't lock
+// (the layout it read stays alive until it goes out of scope)
+class configuration::layout_reader {
+    layout_reader(const layout_reader&);
+    void operator=(const layout_reader&);
+public:
+    explicit layout_reader(const configuration & conf)
+        : m_guard( conf.m_cs.policy() == lock_snapshot), m_lock( conf.m_cs),
+          m_layout( conf.m_layout.load(std::memory_order_acquire)) {}
+
+    const layout * operator->() const { return m_layout; }
+private:
+    detail::read_guard m_guard;
+    read_lock m_lock;
+    const layout * m_layout;
+};
+
 configuration & configuration::def() {
     def_cfg obj;
     static configuration d( obj);
-    d.init_def_cfg();
+    if ( !s_def_inited.load(std::memory_order_acquire) && !t_initing_def)
+        std::call_once( s_def_once, [] {
+            initing_def guard;
+            d.init_def_cfg();
+            s_def_inited.store(true, std::memory_order_release);
+        });
     return d;
 }
 
 
 // constructor for default configuration
-configuration::configuration( const configuration::def_cfg &) {
+configuration::configuration( const configuration::def_cfg &) : m_on_error(err::do_ignore), m_layout(new layout), m_we_are_setting_defaults(false), m_use_read_cache(false), m_resource(0), m_layout_version(0), m_schema(0), m_versions(0), m_version(0), m_views(0), m_unversioned_sets(0), m_profile(0), m_track_hashes(false), m_hashes_stamp(0), m_load_in_background(false) {
+    detail::name_lock(m_cs.raw(), "configuration");
+    detail::name_lock(m_hash_cs.raw(), "configuration hashes");
     static int idx = 0;
     ++idx;
     if ( idx > 1)
@@ -67,33 +113,58 @@ configuration::configuration( const configuration::def_cfg &) {
         assert(false);
 }
 
+// called once (see def())
 void configuration::init_def_cfg() {
-    static bool already_inited = false;
-    if ( already_inited ) {
-        // we have entered this constructor recursively !!!
-        return;
-    }
-    already_inited = true;
-
     m_on_error = err::do_ignore; //default handler
     setting_defaults(true);
     init_settings();
     setting_defaults(false);
+    // the settings declared with SS_SETTING (so far)
+    detail::add_declared_defaults();
 }
 
 
-configuration::configuration() {
+configuration::configuration() : m_on_error(err::do_ignore), m_layout(new layout), m_we_are_setting_defaults(false), m_use_read_cache(false), m_resource(0), m_layout_version(0), m_schema(0), m_versions(0), m_version(0), m_views(0), m_unversioned_sets(0), m_profile(0), m_track_hashes(false), m_hashes_stamp(0), m_load_in_background(false) {
+    detail::name_lock(m_cs.raw(), "configuration");
+    detail::name_lock(m_hash_cs.raw(), "configuration hashes");
 }
 
 
 configuration::~configuration() {
-    save();
-    std::for_each( m_storages.begin(), m_storages.end(), do_delete() );
+    // (our storages might still be loading / it might still be prefetching from them)
+    wait_for_loads();
+    delete m_profile.load();
+    remove_all_storages();
+    delete m_layout.load();
+    delete_versions( m_versions.load());
+}
+
+void configuration::set_locking(locking_policy p) {
+    // (not locked - it's set before we're used by more than one thread)
+    m_cs.policy(p);
+    // read views and diffs always lock - unless there's just one thread
+    m_version_cs.policy( p == lock_none ? lock_none : lock_mutex);
+    m_hash_cs.policy( p == lock_none ? lock_none : lock_mutex);
+    m_defaults_holder.set_locking(p);
+    layout_reader cur(*this);
+    for ( coll::const_iterator first = cur->storages.begin(), last = cur->storages.end(); first != last; ++first)
+        first->second->inherit_locking(p);
+}
+
+void configuration::publish( layout * fresh) {
+    layout * old = m_layout.exchange(fresh, std::memory_order_acq_rel);
+    // (lock-free readers might still be reading it)
+    detail::retire(old, delete_layout);
+}
+
+void configuration::delete_layout(void * p) {
+    delete static_cast<layout*>(p);
 }
 
 void configuration::setting_defaults(bool we_are_setting_defaults) {
-    scoped_lock lock(m_cs);
+    write_lock lock(m_cs);
     m_we_are_setting_defaults = we_are_setting_defaults;
+    m_layout_version.fetch_add(1, std::memory_order_release);
 }
 
 /* 
@@ -104,6 +175,7 @@ void configuration::setting_defaults(bool we_are_setting_defaults) {
     we'll trigger an error
 */
 void configuration::resolve_name( const string & name, string & place, string & sett_name, resolve_type resolve) const {
+    SS_TRACE_SCOPE("configuration::resolve_name");
     place.erase();
     sett_name.erase();
 
@@ -114,9 +186,9 @@ void configuration::resolve_name( const string & name, string & place, string &
     }
     string lo_name = locase(name);
 
-    scoped_lock lock(m_cs);
+    layout_reader cur(*this);
 
-    if ( (resolve == resolve_writable) && (m_const_names.find(name) != m_const_names.end()) ) {
+    if ( (resolve == resolve_writable) && (cur->const_names.find(name) != cur->const_names.end()) ) {
         assert(false);
         get_error_handler()(err::const_setting, TTEXT("this setting was marked as const") + name);
     }
@@ -129,12 +201,12 @@ void configuration::resolve_name( const string & name, string & place, string &
     }
 
     // before doing any operation, make sure you have at least one storage to persist settings to
-    if ( m_storages.empty() ) {
+    if ( cur->storages.empty() ) {
         get_error_handler()(err::no_storages, TTEXT("no storages, while trying to resolve name"));
         return;
     }
 
-    coll::const_reverse_iterator first = m_storages.rbegin(), last = m_storages.rend();
+    coll::const_reverse_iterator first = cur->storages.rbegin(), last = cur->storages.rend();
     while ( first != last) {
         const string & storage_name = first->first;
         if ( lo_name.size() > storage_name.size() ) {
@@ -160,27 +232,62 @@ void configuration::resolve_name( const string & name, string & place, string &
 
 
 void configuration::get_setting( const string & place, const string & sett_name, string & value, typeinfo &type) {
+    get_setting( place, sett_name, value, type, 0);
+}
+
+void configuration::get_setting( const string & place, const string & sett_name, string & value, typeinfo &type, const read_view * view) {
+    SS_TRACE_SCOPE("configuration::get_setting");
+    typeinfo original_type = type;
+    detail::access_profile * profile = m_profile.load(std::memory_order_acquire);
+    if ( profile) {
+        profile->on_read( place, sett_name);
+        if ( !view && profile->find( place, sett_name, value, type) ) {
+            convert_enum( original_type, value, type);
+            return;
+        }
+    }
+
     setting_storage * dest_storage = 0;
     {
-    scoped_lock lock(m_cs);
+    layout_reader cur(*this);
     // before doing any operation, make sure you have at least one storage to persist settings to
-    if ( m_storages.empty() ) {
+    if ( cur->storages.empty() ) {
         get_error_handler()(err::no_storages, TTEXT("no storages, while trying to get setting"));
         return;
     }
 
-    coll::iterator found = m_storages.find( place);
-    if ( found != m_storages.end() ) {
+    coll::const_iterator found = cur->storages.find( place);
+    if ( found != cur->storages.end() ) {
         dest_storage = found->second;
         dest_storage->use();
     }
     } // un-lock
 
-    typeinfo original_type = type;
     if ( dest_storage) {
         type = typeid(variant); //default
         dest_storage->do_get_setting( sett_name, value, type );
         dest_storage->un_use();
+
+        // note: the value is read first - if it's been set since the view was created, its old value is already kept
+        if ( view && m_versions.load(std::memory_order_acquire)) {
+            detail::read_guard guard;
+            const version_entry * oldest = 0;
+            for ( const version_entry * cur = m_versions.load(std::memory_order_acquire); cur && cur->version > view->version();
+                  cur = cur->next.load(std::memory_order_acquire) )
+                if ( cur->name == sett_name && cur->place == place)
+                    oldest = cur;
+            if ( oldest && oldest->had_value) {
+                value = oldest->value;
+                type = oldest->type;
+            }
+            else if ( oldest) {
+                // the setting didn't exist yet
+                value.clear();
+                type = typeid(string);
+                bool has_default;
+                m_defaults_holder.get_default(detail::full_setting_name(place,sett_name), value, type, has_default);
+            }
+        }
     }
     else {
         bool has_default;
@@ -189,7 +296,11 @@ void configuration::get_setting( const string & place, const string & sett_name,
             get_error_handler()( err::storage_not_found, TTEXT("(get) storage not found") );
     }
 
-    // see if it was an enum
+    convert_enum( original_type, value, type);
+}
+
+// if the setting is an enum, converts it from its string to its value
+void configuration::convert_enum( const typeinfo & original_type, string & value, typeinfo & type) const {
     int enum_value;
     if ( m_enum_holder.get_enum(original_type, value, enum_value)) {
         // it's an enum, and it's been converted
@@ -200,32 +311,48 @@ void configuration::get_setting( const string & place, const string & sett_name,
     }
 }
 
+void configuration::use_startup_profile(const std::string & file_name, int seconds) {
+    detail::access_profile * profile = new detail::access_profile(*this, file_name, seconds);
+    profile->prefetch();
+    detail::access_profile * old = 0;
+    if ( !m_profile.compare_exchange_strong(old, profile, std::memory_order_acq_rel)) {
+        // only one profile per configuration
+        assert(false);
+        delete profile;
+    }
+}
+
+setting_storage * configuration::use_storage(const string & place) {
+    layout_reader cur(*this);
+    coll::const_iterator found = cur->storages.find( place);
+    if ( found == cur->storages.end() )
+        return 0;
+    found->second->use();
+    return found->second;
+}
+
 void configuration::set_setting( const string & place, const string & sett_name, const string & value, const typeinfo &type) {
-    bool should_set_default = false;
-    {
-    scoped_lock lock(m_cs);
+    SS_TRACE_SCOPE("configuration::set_setting");
     // are we setting defaults?
-    if ( m_we_are_setting_defaults) 
-        // resolve_name should have set the place to empty, and sett_name to original setting name
-        should_set_default = true;
-    }
-    if ( should_set_default) {
+    // (if so, resolve_name should have set the place to empty, and sett_name to original setting name)
+    if ( m_we_are_setting_defaults) {
         assert(place.empty());
         m_defaults_holder.add_default(sett_name, value, type);
+        detail::bump_read_cache_epoch();
         return;
     }
 
     setting_storage * dest_storage = 0;
     {
-    scoped_lock lock(m_cs);
+    layout_reader cur(*this);
     // before doing any operation, make sure you have at least one storage to persist settings to
-    if ( m_storages.empty() ) {
+    if ( cur->storages.empty() ) {
         get_error_handler()(err::no_storages, TTEXT("no storages, while trying to set setting"));
         return;
     }
 
-    coll::iterator found = m_storages.find( place);
-    if ( found != m_storages.end() ) {
+    coll::const_iterator found = cur->storages.find( place);
+    if ( found != cur->storages.end() ) {
         dest_storage = found->second;
         dest_storage->use();
     }
@@ -243,19 +370,100 @@ void configuration::set_setting( const string & place, const string & sett_name,
             in >> enum_;
             if ( m_enum_holder.set_enum(type, enum_, enum_as_string)) {
                 was_enum = true;
-                dest_storage->do_set_setting( sett_name, enum_as_string, type );
+                set_versioned( dest_storage, place, sett_name, enum_as_string, type );
             }
         }
 
         if ( !was_enum)
-            dest_storage->do_set_setting( sett_name, value, type );
+            set_versioned( dest_storage, place, sett_name, value, type );
+        if ( detail::access_profile * profile = m_profile.load(std::memory_order_acquire))
+            profile->on_set( place, sett_name);
+        if ( m_track_hashes.load())
+            update_hash( dest_storage, place, sett_name);
         dest_storage->un_use();
+        // the value is in the storage - any cached value is stale now
+        detail::bump_read_cache_epoch();
+    }
+}
+
+// sets the value; if there are read views, keeps the value it overwrites
+void configuration::set_versioned( setting_storage * storage, const string & place, const string & sett_name, const string & value, const typeinfo &type) {
+    // (pairs with read_view's constructor: either it sees us, and waits for us to finish, or we see it)
+    m_unversioned_sets.fetch_add(1);
+    if ( m_views.load() == 0) {
+        storage->do_set_setting( sett_name, value, type );
+        m_unversioned_sets.fetch_sub(1);
+        return;
+    }
+    m_unversioned_sets.fetch_sub(1);
+
+    write_lock lock(m_version_cs);
+    version_entry * entry = new version_entry;
+    entry->version = ++m_version;
+    entry->place = place;
+    entry->name = sett_name;
+    entry->had_value = storage->do_find_setting( sett_name, entry->value, entry->type);
+    entry->next.store( m_versions.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // the old value is kept before the new one is visible
+    m_versions.store(entry, std::memory_order_release);
+    storage->do_set_setting( sett_name, value, type );
+}
+
+// drops the values no view needs anymore. Call it with m_version_cs locked
+void configuration::trim_versions() {
+    // the views see the values as of their version - entries up to the oldest view's version are not needed
+    unsigned long long oldest = m_pinned.empty() ? m_version : *m_pinned.begin();
+    version_entry * prev = 0;
+    version_entry * cur = m_versions.load(std::memory_order_relaxed);
+    while ( cur && cur->version > oldest) {
+        prev = cur;
+        cur = cur->next.load(std::memory_order_relaxed);
+    }
+    if ( !cur)
+        return;
+    if ( prev)
+        prev->next.store(0, std::memory_order_release);
+    else
+        m_versions.store(0, std::memory_order_release);
+    // views might still be walking them
+    detail::retire(cur, delete_versions);
+}
+
+void configuration::delete_versions(void * p) {
+    version_entry * cur = static_cast<version_entry*>(p);
+    while ( cur) {
+        version_entry * next = cur->next.load(std::memory_order_relaxed);
+        delete cur;
+        cur = next;
     }
 }
 
+configuration::read_view::read_view(configuration & conf) : m_conf(conf) {
+    write_lock lock(conf.m_version_cs);
+    conf.m_views.fetch_add(1);
+    // set_setting() calls that didn't see us don't keep the values they overwrite - let them finish first
+    while ( conf.m_unversioned_sets.load() != 0)
+        std::this_thread::yield();
+    m_version = conf.m_version;
+    conf.m_pinned.insert(m_version);
+}
+
+configuration::read_view::~read_view() {
+    write_lock lock(m_conf.m_version_cs);
+    m_conf.m_pinned.erase( m_conf.m_pinned.find(m_version));
+    m_conf.m_views.fetch_sub(1);
+    m_conf.trim_versions();
+}
+
+void configuration::read_view::get_setting( const string & place, const string & sett_name, string & value, typeinfo &type) const {
+    m_conf.get_setting( place, sett_name, value, type, this);
+}
+
 void configuration::force_setting_to_be_const(const string & name) {
-    scoped_lock lock(m_cs);
-    m_const_names.insert(name);
+    write_lock lock(m_cs);
+    layout * fresh = new layout( *m_layout.load(std::memory_order_relaxed));
+    fresh->const_names.insert(name);
+    publish( fresh);
 }
 
 
@@ -263,17 +471,58 @@ void configuration::force_setting_to_be_const(const string & name) {
 void configuration::add_storage(const string &storage_name, setting_storage *store) {
     store->use();
     store->name(storage_name);
+    store->inherit_locking( locking());
+    store->parent( this);
+    // with a schema, the storage's settings need to be valid before they go live
+    if ( !store->validate()) {
+        get_error_handler()(err::invalid_setting, TTEXT("storage has invalid settings: ") + storage_name);
+        store->un_use();
+        return;
+    }
     {
-    scoped_lock lock(m_cs);
+    write_lock lock(m_cs);
     // this storage should not exist yet
-    if ( m_storages.find(storage_name) != m_storages.end() ) {
+    if ( m_layout.load(std::memory_order_relaxed)->storages.count(storage_name) ) {
         get_error_handler()(err::storage_already_exists, TTEXT("storage already exists") );
         remove_storage(storage_name);
     }
-    m_storages[ storage_name] = store;
+    layout * fresh = new layout( *m_layout.load(std::memory_order_relaxed));
+    fresh->storages[ storage_name] = store;
+    publish( fresh);
+    m_layout_version.fetch_add(1, std::memory_order_release);
     }
 
-    store->parent( this);
+    detail::bump_read_cache_epoch();
+
+    if ( m_load_in_background.load(std::memory_order_relaxed) && !store->is_loaded()) {
+        // (the storage lives until it's loaded, even if it's removed meanwhile)
+        store->use();
+        std::shared_future<void> loaded = detail::thread_pool::shared().submit( [store] {
+            struct un_user {
+                setting_storage * storage;
+                ~un_user() { storage->un_use(); }
+            } done = { store };
+            store->ensure_loaded();
+        });
+        write_lock lock(m_cs);
+        // forget the loads that are done
+        std::vector< std::shared_future<void> > pending;
+        for ( size_t idx = 0; idx < m_loads.size(); ++idx)
+            if ( m_loads[idx].wait_for( std::chrono::seconds(0)) != std::future_status::ready)
+                pending.push_back( m_loads[idx]);
+        pending.push_back(loaded);
+        m_loads.swap(pending);
+    }
+}
+
+void configuration::wait_for_loads() {
+    std::vector< std::shared_future<void> > loads;
+    { write_lock lock(m_cs);
+      loads.swap(m_loads);
+    }
+    // (if a load threw, the first access to that storage will try again - and throw there)
+    for ( size_t idx = 0; idx < loads.size(); ++idx)
+        loads[idx].wait();
 }
 
 
@@ -282,31 +531,105 @@ void configuration::add_storage(const string &storage_name, setting_storage *sto
 // in case the other configuration already contains some settings,
 // they will be overwritten (in case some settings have names that are not
 // found in the current configuration, their values will remain unchanged)
-void configuration::copy_into(configuration &other ) {
-    scoped_lock lock(m_cs);
-    coll::iterator first = m_storages.begin(), last = m_storages.end();
-    while ( first != last) {
-        typedef std::map<string,string> vals_coll;
-        vals_coll vals;
+namespace {
+    // un_use()s the storages (see configuration::use_storages()) when it goes out of scope
+    struct storages_user {
+        explicit storages_user(std::vector< std::pair<string, setting_storage*> > & storages) : storages(storages) {}
+        ~storages_user() {
+            for ( size_t idx = 0; idx < storages.size(); ++idx)
+                storages[idx].second->un_use();
+        }
+        std::vector< std::pair<string, setting_storage*> > & storages;
+    };
+
+    // the prefix, relative to the storage at 'place'. False if none of the storage's settings can match it
+    bool storage_prefix(const string & place, const string & prefix, string & relative) {
+        if ( place.empty()) {
+            relative = prefix;
+            return true;
+        }
+        if ( prefix.size() > place.size() && prefix.compare(0, place.size(), place) == 0 && prefix[place.size()] == '.') {
+            relative = prefix.substr(place.size() + 1);
+            return true;
+        }
+        // "ap" or "app." -> all settings of "app"
+        string place_dot = place + TTEXT(".");
+        if ( place_dot.compare(0, prefix.size(), prefix) == 0) {
+            relative.erase();
+            return true;
+        }
+        return false;
+    }
+}
+
+void configuration::use_storages( storages_coll & storages) const {
+    layout_reader cur(*this);
+    storages.reserve( cur->storages.size());
+    for ( coll::const_iterator first = cur->storages.begin(), last = cur->storages.end(); first != last; ++first) {
         first->second->use();
-        first->second->do_enum_settings( vals);
-        first->second->un_use();
+        storages.push_back( *first);
+    }
+}
+
+bool configuration::visit_settings( const string & prefix, const setting_visitor & visitor) {
+    SS_TRACE_SCOPE("configuration::visit_settings");
+    string lo_prefix = locase(prefix);
+    // we visit without holding our lock - the visitor might use the configuration
+    storages_coll storages;
+    use_storages(storages);
+    storages_user user(storages);
+
+    string full_name;
+    for ( storages_coll::iterator first = storages.begin(), last = storages.end(); first != last; ++first) {
+        string relative;
+        if ( !storage_prefix(first->first, lo_prefix, relative))
+            continue;
+        const string & place = first->first;
+        bool completed = first->second->do_visit_settings( relative, [&](const string & name, const string & value, const typeinfo & type) {
+            full_name = place;
+            if ( !place.empty())
+                full_name += '.';
+            full_name += name;
+            return visitor(full_name, value, type);
+        });
+        if ( !completed)
+            return false;
+    }
+    return true;
+}
 
-        vals_coll::iterator first_val = vals.begin(), last_val = vals.end();
-        while ( first_val != last_val) {
+void configuration::copy_into(configuration &other ) {
+    storages_coll storages;
+    use_storages(storages);
+    storages_user user(storages);
+    for ( storages_coll::iterator first = storages.begin(), last = storages.end(); first != last; ++first) {
+        const string & storage_name = first->first;
+
+        // with a schema, we copy a storage only if all its settings are valid there
+        if ( const schema * other_schema = other.get_schema()) {
+            bool valid = true;
+            typed_value typed;
+            string error;
+            first->second->do_visit_settings( string(), [&](const string & name, const string & value, const typeinfo &) {
+                if ( !other_schema->check( detail::full_setting_name(storage_name, name), value, typed, error) ) {
+                    other.get_error_handler()(err::invalid_setting, error);
+                    valid = false;
+                }
+                return true;
+            });
+            if ( !valid)
+                continue;
+        }
+
+        first->second->do_visit_settings( string(), [&](const string & name, const string & value, const typeinfo &) {
             // find out the name of the setting, within the other configuration
             // (each setting we're enumerating, is relative to the *first storage)
-            string full_name = first_val->first;
-            if ( !first->first.empty())
-                full_name = first->first + TTEXT(".") + full_name;
-
             string place, sett_name;
-            other.resolve_name( full_name, place, sett_name, resolve_dont_care);
+            other.resolve_name( detail::full_setting_name(storage_name, name), place, sett_name, resolve_dont_care);
             // FIXME(later) at this time, when copying settings, we lose all context of the settings, we should fix that!
-            other.set_setting( place, sett_name, first_val->second, typeid(string) );
-            ++first_val;
-        }
-        ++first;
+            other.set_setting( place, sett_name, value, typeid(string) );
+            return true;
+        });
     }
     other.save( );
 }
@@ -327,40 +650,30 @@ void configuration::copy_into_no_overwrite(configuration &other) {
     other.set_error_handler(no_overwrite);
     try {
         {
-        scoped_lock lock(m_cs);
-        coll::iterator first = m_storages.begin(), last = m_storages.end();
-        while ( first != last) {
-            typedef std::map<string,string> vals_coll;
-            vals_coll vals;
-            first->second->use();
-            first->second->do_enum_settings( vals);
-            first->second->un_use();
-
-            vals_coll::iterator first_val = vals.begin(), last_val = vals.end();
-            while ( first_val != last_val) {
+        storages_coll storages;
+        use_storages(storages);
+        storages_user user(storages);
+        for ( storages_coll::iterator first = storages.begin(), last = storages.end(); first != last; ++first) {
+            const string & storage_name = first->first;
+            first->second->do_visit_settings( string(), [&](const string & name, const string & value, const typeinfo &) {
                 // find out the name of the setting, within the other configuration
                 // (each setting we're enumerating, is relative to the *first storage)
-                string full_name = first_val->first;
-                if ( !first->first.empty())
-                    full_name = first->first + TTEXT(".") + full_name;
-
                 string place, sett_name;
-                other.resolve_name( full_name, place, sett_name, resolve_dont_care);
-    			
+                other.resolve_name( detail::full_setting_name(storage_name, name), place, sett_name, resolve_dont_care);
+
                 try {
-			        string ignore;
+                    string ignore;
                     typeinfo ignore_type;
-			        other.get_setting( place, sett_name, ignore, ignore_type);
+                    other.get_setting( place, sett_name, ignore, ignore_type);
                     // setting exists - no overwrite
                 }
                 catch(setting_does_not_exist&) {
-				    // an error occured - we assume the setting did not exist
+                    // an error occured - we assume the setting did not exist
                     // FIXME(later) at this time, when copying settings, we lose all context of the settings, we should fix that!
-				    other.set_setting( place, sett_name, first_val->second, typeid(string) );
+                    other.set_setting( place, sett_name, value, typeid(string) );
                 }
-                ++first_val;
-            }
-            ++first;
+                return true;
+            });
         }
         }
         other.save();
@@ -372,52 +685,186 @@ void configuration::copy_into_no_overwrite(configuration &other) {
     other.set_error_handler(old_handler);
 }
 
+// with its full name
+bool configuration::find_setting( const string & name, string & value, typeinfo & type) {
+    string place, sett_name;
+    resolve_name( name, place, sett_name, resolve_dont_care);
+    setting_storage * storage = use_storage(place);
+    if ( !storage)
+        return false;
+    bool found = storage->do_find_setting( sett_name, value, type);
+    storage->un_use();
+    return found;
+}
+
+// changes each time storages are added/removed, or a storage reloads
+unsigned long long configuration::hashes_stamp() const {
+    layout_reader cur(*this);
+    unsigned long long stamp = layout_version();
+    for ( coll::const_iterator first = cur->storages.begin(), last = cur->storages.end(); first != last; ++first)
+        stamp += first->second->reloads();
+    return stamp;
+}
+
+// the hashes, up to date. Call it with m_hash_cs locked
+detail::merkle_tree & configuration::hashes() {
+    unsigned long long stamp = hashes_stamp();
+    if ( m_hashes && stamp == m_hashes_stamp)
+        return *m_hashes;
+
+    // (from now on, each set_setting() updates the hashes - even while we visit)
+    m_track_hashes = true;
+    if ( !m_hashes)
+        m_hashes.reset( new detail::merkle_tree);
+    else
+        m_hashes->clear();
+    m_hashes_stamp = stamp;
+    detail::merkle_tree & tree = *m_hashes;
+    visit_settings( string(), [&tree](const string & name, const string & value, const typeinfo &) {
+        tree.set(name, value);
+        return true;
+    });
+    return tree;
+}
+
+// after a setting is set: its hash is what the storage has now
+// (in case another thread set it meanwhile, whoever updates last, reads the latest value)
+void configuration::update_hash( setting_storage * storage, const string & place, const string & sett_name) {
+    write_lock lock(m_hash_cs);
+    if ( !m_hashes)
+        return;
+    string value;
+    typeinfo type;
+    if ( storage->do_find_setting( sett_name, value, type))
+        m_hashes->set( detail::full_setting_name(place, sett_name), value);
+}
+
+void configuration::diff( configuration & other, settings_delta & changes) {
+    SS_TRACE_SCOPE("configuration::diff");
+    changes.clear();
+    if ( &other == this)
+        return;
+    std::vector< std::pair<string, detail::merkle_tree::difference> > names;
+    {
+    // (always lock the two in the same order)
+    configuration & first = this < &other ? *this : other;
+    configuration & second = this < &other ? other : *this;
+    write_lock lock_first(first.m_hash_cs);
+    write_lock lock_second(second.m_hash_cs);
+    detail::merkle_tree::diff( hashes(), other.hashes(), names);
+    }
+
+    setting_change change;
+    for ( size_t idx = 0; idx < names.size(); ++idx) {
+        change.name = names[idx].first;
+        change.removed = names[idx].second == detail::merkle_tree::only_left;
+        change.value.erase();
+        change.type = typeid(string);
+        if ( !change.removed && !other.find_setting( change.name, change.value, change.type))
+            // (its storage was just removed)
+            continue;
+        changes.push_back(change);
+    }
+}
+
+void configuration::apply( const settings_delta & changes) {
+    SS_TRACE_SCOPE("configuration::apply");
+    // read views are created with this locked - so no view is created while we're halfway through
+    write_lock lock(m_version_cs);
+    for ( settings_delta::const_iterator first = changes.begin(), last = changes.end(); first != last; ++first) {
+        if ( first->removed) {
+            get_error_handler()(err::bad_setting_name, TTEXT("cannot remove setting ") + first->name);
+            continue;
+        }
+        string place, sett_name;
+        resolve_name( first->name, place, sett_name, resolve_writable);
+        set_setting( place, sett_name, first->value, first->type);
+    }
+}
+
 
 
 // saves this configuration to the underlying storages
 // (useful when any of the storages has a caching mechanism)
-void configuration::save() {
-    scoped_lock lock(m_cs);
-    coll::iterator first = m_storages.begin(), last = m_storages.end();
-    while ( first != last) {
-        first->second->do_save();
-        ++first;
+// note: we don't hold our lock while the storages save - one slow disk should not block everybody else
+std::shared_future<bool> configuration::save() {
+    SS_TRACE_SCOPE("configuration::save");
+    storages_coll storages;
+    use_storages(storages);
+
+    std::vector< std::shared_future<bool> > saved;
+    saved.reserve( storages.size());
+    for ( size_t idx = 0; idx < storages.size(); ++idx) {
+        saved.push_back( storages[idx].second->do_save_async() );
+        storages[idx].second->un_use();
     }
+    // waiting on the result waits for all storages
+    return std::async( std::launch::deferred, [saved] {
+        bool ok = true;
+        for ( size_t idx = 0; idx < saved.size(); ++idx)
+            ok = saved[idx].get() && ok;
+        return ok;
+    }).share();
 }
 
 // removes one storage from this configuration
 void configuration::remove_storage( const string & storage_name) {
     setting_storage * dest_storage = 0;
     {
-    scoped_lock lock(m_cs);
-    coll::iterator found = m_storages.find(storage_name);
-    if ( found != m_storages.end() ) {
+    write_lock lock(m_cs);
+    const layout & cur = *m_layout.load(std::memory_order_relaxed);
+    coll::const_iterator found = cur.storages.find(storage_name);
+    if ( found != cur.storages.end() ) {
         dest_storage = found->second;
-        m_storages.erase( found);
+        layout * fresh = new layout(cur);
+        fresh->storages.erase( storage_name);
+        publish( fresh);
+        m_layout_version.fetch_add(1, std::memory_order_release);
     }
     }
 
+    detail::bump_read_cache_epoch();
+
     if ( dest_storage) {
+        // (lock-free readers might be just about to use() it)
+        if ( locking() == lock_snapshot)
+            detail::wait_for_readers();
         dest_storage->do_save();
         dest_storage->un_use();
     }
 }
 
 // removes all storages from this configuration
+//
+// note: another thread might still be using one of the storages (it has called use()),
+// so we only drop our reference - the storage deletes itself once the last user is done
 void configuration::remove_all_storages() {
-    scoped_lock lock(m_cs);
-    save();
-    std::for_each( m_storages.begin(), m_storages.end(), do_delete() );
-    m_storages.clear();
+    coll storages;
+    {
+    write_lock lock(m_cs);
+    const layout & cur = *m_layout.load(std::memory_order_relaxed);
+    storages = cur.storages;
+    layout * fresh = new layout;
+    fresh->const_names = cur.const_names;
+    publish( fresh);
+    m_layout_version.fetch_add(1, std::memory_order_release);
+    }
+    detail::bump_read_cache_epoch();
+    if ( !storages.empty() && locking() == lock_snapshot)
+        detail::wait_for_readers();
+
+    for ( coll::iterator first = storages.begin(), last = storages.end(); first != last; ++first) {
+        first->second->do_save();
+        first->second->un_use();
+    }
 }
 
 void configuration::set_error_handler(error_handler_func func) {
-    scoped_lock lock(m_cs);
     m_on_error = func;
 }
 
+// note: lock-free - storages report errors while holding their own locks
 error_handler_func configuration::get_error_handler() const {
-    scoped_lock lock(m_cs);
     return m_on_error;
 }
 
@@ -427,10 +874,70 @@ void configuration::get_default_value(const string & name, string & value, typei
 
 void configuration::add_default_value(const string & name, string & value, const typeinfo & type) {
     m_defaults_holder.add_default(name, value, type);
+    detail::bump_read_cache_epoch();
 }
 
 void configuration::add_enum_value(const typeinfo & type, int enum_, const string& str) {
     m_enum_holder.add_enum(type, enum_, str);
+    detail::bump_read_cache_epoch();
+}
+
+void configuration::set_schema(const schema & s) {
+    std::vector<setting_storage*> storages;
+    {
+    write_lock lock(m_cs);
+    m_schemas.push_back( std::unique_ptr<schema>( new schema(s)) );
+    m_schema.store( m_schemas.back().get(), std::memory_order_release);
+    const layout & cur = *m_layout.load(std::memory_order_relaxed);
+    for ( coll::const_iterator first = cur.storages.begin(), last = cur.storages.end(); first != last; ++first) {
+        first->second->use();
+        storages.push_back( first->second);
+    }
+    }
+    // the storages are already live - all we can do is report what's invalid
+    for ( size_t idx = 0; idx < storages.size(); ++idx) {
+        storages[idx]->validate();
+        storages[idx]->un_use();
+    }
+    detail::bump_read_cache_epoch();
+}
+
+bool configuration::get_typed( const string & place, const string & sett_name, typed_value & typed) {
+    setting_storage * dest_storage = 0;
+    {
+    layout_reader cur(*this);
+    coll::const_iterator found = cur->storages.find( place);
+    if ( found == cur->storages.end() )
+        return false;
+    dest_storage = found->second;
+    dest_storage->use();
+    }
+    bool ok = dest_storage->do_get_typed( sett_name, typed);
+    dest_storage->un_use();
+    return ok;
+}
+
+void configuration::set_memory_resource(memory_resource * res) {
+    write_lock lock(m_cs);
+    m_resource = res;
+    m_defaults_holder.set_memory_resource(res);
+    m_enum_holder.set_memory_resource(res);
+    // the storages that don't have their own resource use ours
+    const layout & cur = *m_layout.load(std::memory_order_relaxed);
+    for ( coll::const_iterator b = cur.storages.begin(), e = cur.storages.end(); b != e; ++b)
+        b->second->update_memory_resource();
+}
+
+memory_resource * configuration::get_memory_resource() const {
+    memory_resource * res = m_resource.load();
+    return res ? res : default_memory_resource();
+}
+
+memory_resource * setting_storage::get_memory_resource() const {
+    if ( memory_resource * res = m_resource.load())
+        return res;
+    configuration * conf = parent();
+    return conf ? conf->get_memory_resource() : default_memory_resource();
 }
 
 
@@ -0,0 +1,83 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/declared_setting.h"
+#include <algorithm>
+
+namespace ss { namespace detail {
+
+namespace {
+    // the declared settings, as they were recorded (constant-initialized - it's usable during static initialization)
+    std::atomic<declared_registrar*> s_declared(nullptr);
+
+    // guards resolving the declared settings (which only happens when storages are added/removed)
+    critical_section & resolve_cs() {
+        static critical_section cs;
+        return cs;
+    }
+
+    void delete_resolved(void * p) {
+        delete static_cast<resolved_name*>(p);
+    }
+
+    // (same as ct_lower)
+    string locase( const char_t * name) {
+        string lo( name);
+        std::transform( lo.begin(), lo.end(), lo.begin(), ct_lower);
+        return lo;
+    }
+}
+
+declared_registrar::declared_registrar(void (*register_default)()) : register_default(register_default), next(0) {
+    declared_registrar * head = s_declared.load(std::memory_order_relaxed);
+    do
+        next = head;
+    while ( !s_declared.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void add_declared_defaults() {
+    for ( declared_registrar * cur = s_declared.load(std::memory_order_acquire); cur; cur = cur->next)
+        cur->register_default();
+}
+
+const resolved_name & resolve_declared(declared_state & state, configuration & conf, const char_t * name) {
+    // note: read the layout before resolving - if it changes meanwhile, we'll resolve again next time
+    unsigned long long layout = conf.layout_version();
+    const resolved_name * cur = state.resolved.load(std::memory_order_acquire);
+    if ( cur && cur->layout == layout)
+        return *cur;
+
+    scoped_lock lk( resolve_cs());
+    cur = state.resolved.load(std::memory_order_acquire);
+    if ( cur && cur->layout == layout)
+        // another thread just resolved it
+        return *cur;
+    resolved_name * fresh = new resolved_name;
+    fresh->layout = layout;
+    conf.resolve_name( locase(name), fresh->place, fresh->name, configuration::resolve_writable);
+    resolved_name * old = state.resolved.exchange(fresh, std::memory_order_acq_rel);
+    if ( old)
+        // other threads might still be using it
+        retire(old, delete_resolved);
+    return *fresh;
+}
+
+void add_declared_default(declared_state & state, configuration & conf, const char_t * name, const string & value, const typeinfo & type) {
+    string default_value = value;
+    conf.add_default_value( locase(name), default_value, type);
+    state.has_default.store(true, std::memory_order_release);
+}
+
+}}
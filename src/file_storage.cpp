@@ -15,96 +15,311 @@
 
 #include "ss/configuration.h"
 #include "ss/file_storage.h"
+#include "ss/read_cache.h"
+#include "ss/reclaim.h"
 #include <algorithm>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
 
 
 namespace ss {
 
     namespace {
-        // converts a value to lower-case
-        string locase( const string & str) {
-            string lo;
-            lo.resize( str.length());
-            std::transform( str.begin(), str.end(), lo.begin(), tolower);
-            return lo;
+        // save_at_interval: by default, write once settings haven't been modified for this long
+        const int DEFAULT_DEBOUNCE_MS = 100;
+
+        // when saving, we write to the file in chunks of this size
+        const size_t SAVE_BUFFER_SIZE = 1 << 20;
+
+        // replaces 'to' with 'from' - atomically, where the OS allows it
+        bool replace_file(const std::string & from, const std::string & to) {
+#ifdef _WIN32
+            return ::MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            return ::rename( from.c_str(), to.c_str()) == 0;
+#endif
         }
-    }
 
-file_storage::file_storage(const std::string & file_name, open_type open, save_type save, int interval_ms) 
-        : m_file_name(file_name), m_open(open), m_save(save), m_interval_ms(interval_ms), m_is_dirty(false) {
+        // we can rewrite parts of the file in place only if characters are bytes, and reading/writing
+        // the file in text mode doesn't translate anything (on Windows, it does)
+#if defined(_WIN32) || defined(SS_USE_UNICODE)
+        const bool CAN_REWRITE_IN_PLACE = false;
+#else
+        const bool CAN_REWRITE_IN_PLACE = true;
+#endif
 
-    load();
-#ifdef SS_TS_WIN
-    DWORD thread_id;
-    m_dedicated_thread = ::CreateThread(0, 0, &file_storage::save_thread, this, 0, &thread_id);
-    m_is_dedicated_thread_running = true;
+        unsigned long long file_size(const std::string & name) {
+            std::ifstream in( name.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+            return in ? (unsigned long long)in.tellg() : 0;
+        }
+
+        bool truncate_file(const std::string & name, unsigned long long size) {
+#ifdef _WIN32
+            // (never called - CAN_REWRITE_IN_PLACE is false)
+            return false;
 #else
-    // if we don't have save_at_interval for a platform, revert to closest thing
-    if ( save == save_at_interval)
-        save = save_each_modify;
+            return ::truncate( name.c_str(), (off_t)size) == 0;
 #endif
-}
+        }
 
-file_storage::~file_storage(void) {
-#ifdef SS_TS_WIN
-    if ( m_save == save_at_interval) {
-        // need to close the other thread, peacefully
-        {
-        scoped_lock lk(cs());
-        m_is_dedicated_thread_running = false;
+        // advisory lock on a file (created if needed), held while this object lives.
+        // Other processes see it only if they lock the same file (see file_storage::set_shared())
+        class file_lock {
+            file_lock(const file_lock&);
+            void operator=(const file_lock&);
+        public:
+            file_lock(const std::string & name, bool exclusive) {
+#ifdef _WIN32
+                m_file = ::CreateFileA( name.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                        0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+                m_locked = false;
+                if ( m_file != INVALID_HANDLE_VALUE) {
+                    OVERLAPPED whole = {};
+                    m_locked = ::LockFileEx( m_file, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &whole) != 0;
+                }
+#else
+                m_fd = ::open( name.c_str(), O_RDWR | O_CREAT, 0644);
+                if ( m_fd < 0 && !exclusive)
+                    // (we might only be able to read it)
+                    m_fd = ::open( name.c_str(), O_RDONLY);
+                m_locked = false;
+                if ( m_fd >= 0) {
+                    struct flock whole = {};
+                    whole.l_type = exclusive ? F_WRLCK : F_RDLCK;
+                    whole.l_whence = SEEK_SET;
+                    int result;
+                    while ( (result = ::fcntl(m_fd, F_SETLKW, &whole)) == -1 && errno == EINTR)
+                        ;
+                    m_locked = result == 0;
+                }
+#endif
+            }
+            ~file_lock() {
+#ifdef _WIN32
+                if ( m_locked) {
+                    OVERLAPPED whole = {};
+                    ::UnlockFileEx( m_file, 0, 1, 0, &whole);
+                }
+                if ( m_file != INVALID_HANDLE_VALUE)
+                    ::CloseHandle(m_file);
+#else
+                // closing it releases the lock
+                if ( m_fd >= 0)
+                    ::close(m_fd);
+#endif
+            }
+            bool locked() const { return m_locked; }
+        private:
+#ifdef _WIN32
+            HANDLE m_file;
+#else
+            int m_fd;
+#endif
+            bool m_locked;
+        };
+
+        long long now_ticks() {
+            return std::chrono::steady_clock::now().time_since_epoch().count();
         }
-        while ( true) {
-            ::Sleep(10);
-            scoped_lock lk(cs());
-            if (m_is_dedicated_thread_running )
-                break; // the other thread has ended
+        long long ms_to_ticks(int ms) {
+            return std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::milliseconds(ms)).count();
         }
+
+        // clears the flag when going out of scope - even if we throw
+        struct clear_on_exit {
+            explicit clear_on_exit(std::atomic<bool> & flag) : flag(flag) {}
+            ~clear_on_exit() { flag = false; }
+            std::atomic<bool> & flag;
+        };
+    }
+
+// what tells us the file changed: its size, its last write time, and (where there is such a thing) its inode
+file_storage::file_stamp file_storage::stamp_of(const std::string & name) {
+    file_stamp stamp;
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if ( ::GetFileAttributesExA( name.c_str(), GetFileExInfoStandard, &info)) {
+        stamp.size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        stamp.time = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+    }
+#else
+    struct stat info;
+    if ( ::stat( name.c_str(), &info) == 0) {
+        stamp.size = (unsigned long long)info.st_size;
+#if defined(__APPLE__)
+        stamp.time = (unsigned long long)info.st_mtimespec.tv_sec * 1000000000ull + info.st_mtimespec.tv_nsec;
+#else
+        stamp.time = (unsigned long long)info.st_mtim.tv_sec * 1000000000ull + info.st_mtim.tv_nsec;
+#endif
+        stamp.id = (unsigned long long)info.st_ino;
     }
 #endif
+    return stamp;
+}
+
+file_storage::file_storage(const std::string & file_name, open_type open, save_type save, int interval_ms, memory_resource * res) 
+        : m_file_name(file_name), m_open(open), m_save(save), m_interval_ms(interval_ms), m_is_dirty(false),
+          m_comments( std::less<int>(), &m_comments_arena), m_trailing_pos(0),
+          m_file_size(0), m_can_rewrite_in_place(false), m_writer_stop(false),
+          m_debounce_ms( std::min(interval_ms, DEFAULT_DEBOUNCE_MS)), m_interval_pending(false), m_last_modified(0),
+          m_shared(false), m_check_interval(0), m_next_check(0), m_checking(false), m_sorted(0) {
+    detail::name_lock(m_io_cs, "file_storage io");
+
+    if ( res)
+        set_memory_resource(res);
+    // the file is read the first time it's needed - see load()
+}
+
+file_storage::~file_storage(void) {
+    // let the writer finish what it's been asked to save - anything pending at an interval is saved below
+    {
+    std::lock_guard<std::mutex> lk(m_writer_mutex);
+    m_writer_stop = true;
+    }
+    m_writer_cv.notify_one();
+    if ( m_writer.joinable())
+        m_writer.join();
     save();
+    delete m_sorted.load();
 }
 
-#ifdef SS_TS_WIN
-DWORD WINAPI file_storage::save_thread(LPVOID param) {
-    file_storage * self = (file_storage*)param;
-    int sleeped = 0;
-    int SLEEP_EACH_TIME = 10;
-    while ( true) {
-        { scoped_lock lk(self->cs());
-          if ( !self->m_is_dedicated_thread_running) {
-              // signal to the other thread - we've ended
-              self->m_is_dedicated_thread_running = true;
-              break;
-          }
-        }
-        ::Sleep(SLEEP_EACH_TIME);
-        sleeped += SLEEP_EACH_TIME;
-        if ( sleeped > self->m_interval_ms) {
-            sleeped = 0;
-            scoped_lock lk(self->cs());
-            self->save();
+void file_storage::set_save_interval(int debounce_ms, int max_delay_ms) {
+    std::lock_guard<std::mutex> lk(m_writer_mutex);
+    m_debounce_ms = debounce_ms;
+    m_interval_ms = max_delay_ms > debounce_ms ? max_delay_ms : debounce_ms;
+    m_writer_cv.notify_one();
+}
+
+void file_storage::set_shared(bool shared, int check_interval_ms) {
+    m_check_interval.store( ms_to_ticks(check_interval_ms), std::memory_order_relaxed);
+    // check on the next read
+    m_next_check.store(0, std::memory_order_relaxed);
+    m_shared.store(shared, std::memory_order_release);
+}
+
+// note: only one thread checks at a time - the others go on reading what we have
+bool file_storage::check_for_changes() {
+    // (if we haven't read the file yet, we'll read it as it is now)
+    ensure_loaded();
+    if ( !m_shared.load(std::memory_order_acquire) || m_checking.exchange(true))
+        return false;
+    bool reloaded = false;
+    {
+    clear_on_exit checked(m_checking);
+    {
+    scoped_lock lk(m_io_cs);
+    m_next_check.store( now_ticks() + m_check_interval.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    if ( stamp_of(m_file_name) != m_stamp) {
+        // don't read it while another process is writing it
+        file_lock lock(m_file_name + ".lock", false);
+        if ( file_is_valid()) {
+            read_file();
+            reloaded = true;
         }
+        else
+            // keep what we have - and don't look at it again until it changes again
+            m_stamp = stamp_of(m_file_name);
+    }
     }
-    return 0;
+    if ( reloaded)
+        // keep the schema's converted values up to date
+        validate();
+    }
+    if ( reloaded)
+        // values changed behind the configuration's back
+        on_reloaded();
+    return reloaded;
+}
+
+// shared files: checks whether the file changed, if we haven't checked for a while
+void file_storage::check_if_due() const {
+    if ( m_shared.load(std::memory_order_relaxed) && now_ticks() >= m_next_check.load(std::memory_order_relaxed))
+        const_cast<file_storage*>(this)->check_for_changes();
+}
+
+void file_storage::on_memory_resource_changed(memory_resource * res) {
+    m_table.set_memory_resource(res);
+    scoped_lock lk(m_io_cs);
+    m_comments_arena.upstream(res);
 }
-#endif
 
 void file_storage::load() {
-    m_infos.clear();
+    scoped_lock lk(m_io_cs);
+    m_table.clear();
+    read_file();
+
+    // nothing was changed yet
+    m_changed.clear();
+    m_table.take_changed(m_changed);
+    m_changed.clear();
+}
+
+/*
+    Reads the file. If we already have settings, they're merged with what's in the file:
+    the values set (or added) here since the last write win, settings that aren't in the file anymore are removed.
+
+    Note: call it with m_io_cs locked
+*/
+void file_storage::read_file() {
+    m_comments.clear();
+    m_trailing_comment = detail::string_ref();
+    m_comments_arena.release();
+    m_spans.clear();
+    m_can_rewrite_in_place = CAN_REWRITE_IN_PLACE;
+    // stamp it before reading, so that if it's modified while we read, we'll see it's changed
+    m_stamp = stamp_of(m_file_name);
+
     string last_comment;
     bool is_first_setting = true;
-    int idx = 0;
     ifstream in( m_file_name.c_str() );
+    // note: reused for every line, so that we don't allocate per line
     string line;
+    info parsed;
+    unsigned long long line_start = 0;
+    size_t value_begin = 0, value_end = 0;
+    // we can rewrite values in place only if the file has our keys, in order: 0, 1, 2, ...
+    int next_key = 0;
+    int max_key = -1;
+    // the settings we had - those that aren't in the file anymore are removed
+    int had = m_table.size();
+    std::vector<bool> in_file(had, false);
     while ( std::getline(in, line) ) {
-        info parsed;
-        read_setting(line, parsed);
+        read_setting(line, parsed, value_begin, value_end);
         if ( !parsed.name.empty() ) {
             // this comment is to be written after this setting
             std::swap(last_comment, parsed.comment);
-            parsed.idx = idx++;
-            parsed.name = locase(parsed.name);
-            m_infos[ parsed.name ] = parsed;
+            std::transform( parsed.name.begin(), parsed.name.end(), parsed.name.begin(), tolower);
+            int key = m_table.find( parsed.name.c_str(), parsed.name.size());
+            if ( key < 0) {
+                bool inserted;
+                key = m_table.insert(parsed.name, parsed.value, parsed.type, inserted);
+                if ( !inserted)
+                    // another thread just added it
+                    m_table.set_loaded(key, parsed.value, parsed.type);
+            }
+            else
+                // (if the same setting is there twice, the last one wins)
+                m_table.set_loaded(key, parsed.value, parsed.type);
+
+            max_key = std::max(max_key, key);
+            if ( key < had)
+                in_file[key] = true;
+            if ( !parsed.comment.empty() && m_comments.find(key) == m_comments.end())
+                m_comments[key] = detail::string_ref(parsed.comment).copy_to(m_comments_arena);
+            if ( key == next_key) {
+                m_spans.push_back( value_span(line_start + value_begin, value_end - value_begin) );
+                ++next_key;
+            }
+            else
+                // the settings' positions are no longer in the same order as the settings
+                m_can_rewrite_in_place = false;
         }
         else {
             // comment - append to last comment
@@ -112,126 +327,382 @@ void file_storage::load() {
             is_first_setting = false;
             last_comment += parsed.comment;
         }
+        line_start += line.size() + 1;
     }
 
-    if ( !last_comment.empty() ) {
-        // there is a comment after all settings
-        info last;
-        last.comment = last_comment;
-        last.idx = idx;
-        last.name = TTEXT("");
-        m_infos[ last.name ] = last;
+    for ( int key = 0; key < had; ++key)
+        if ( !in_file[key]) {
+            // (unless it was set here since the last write)
+            m_table.remove_loaded(key);
+            // it's not in the file, so the file's positions don't match the keys
+            m_can_rewrite_in_place = false;
+        }
+
+    // there might be a comment after all settings (read from the file)
+    m_trailing_comment = detail::string_ref(last_comment).copy_to(m_comments_arena);
+    m_trailing_pos = max_key + 1;
+    m_file_size = file_size(m_file_name);
+}
+
+// with a schema: checks the file's settings before we read it (each invalid one is reported)
+bool file_storage::file_is_valid() {
+    if ( !parent() || !parent()->get_schema())
+        return true;
+    bool valid = true;
+    ifstream in( m_file_name.c_str() );
+    string line;
+    info parsed;
+    size_t value_begin = 0, value_end = 0;
+    typed_value typed;
+    while ( std::getline(in, line) ) {
+        read_setting(line, parsed, value_begin, value_end);
+        if ( parsed.name.empty() )
+            continue;
+        std::transform( parsed.name.begin(), parsed.name.end(), parsed.name.begin(), tolower);
+        if ( !check_setting(parsed.name, parsed.value, typed))
+            valid = false;
     }
+    return valid;
 }
 
 void file_storage::save() {
-    if ( !m_is_dirty)
+    write();
+}
+
+// note: call with m_writer_mutex locked
+void file_storage::start_writer() {
+    if ( !m_writer.joinable())
+        m_writer = std::thread( &file_storage::writer_thread, this);
+}
+
+std::shared_future<bool> file_storage::save_async() {
+    std::promise<bool> request;
+    std::shared_future<bool> saved = request.get_future().share();
+    if ( m_open == open_read_only) {
+        // never save
+        request.set_value(true);
+        return saved;
+    }
+
+    std::lock_guard<std::mutex> lk(m_writer_mutex);
+    start_writer();
+    m_save_requests.push_back( std::move(request));
+    m_writer_cv.notify_one();
+    return saved;
+}
+
+// for save_at_interval - a setting was just modified
+void file_storage::on_modified() {
+    m_last_modified.store( clock_type::now().time_since_epoch().count(), std::memory_order_relaxed);
+    // only the first modification since the last write needs to wake up the writer
+    if ( m_interval_pending.exchange(true))
         return;
+    std::lock_guard<std::mutex> lk(m_writer_mutex);
+    m_first_modified = clock_type::now();
+    start_writer();
+    m_writer_cv.notify_one();
+}
+
+/*
+    Writes the file, whenever asked to. All requests that come while we're writing are served by one write.
+
+    For save_at_interval, it sleeps until something is modified; then, it waits until no modification
+    happened for m_debounce_ms (so that a burst of changes is written once), but no longer than m_interval_ms
+    since the first modification.
+*/
+void file_storage::writer_thread() {
+    std::unique_lock<std::mutex> lk(m_writer_mutex);
+    while ( true) {
+        if ( !m_save_requests.empty()) {
+            std::vector< std::promise<bool> > requests;
+            requests.swap(m_save_requests);
+            lk.unlock();
+            bool ok = write();
+            for ( size_t idx = 0; idx < requests.size(); ++idx)
+                requests[idx].set_value(ok);
+            lk.lock();
+            continue;
+        }
+        if ( m_writer_stop)
+            break; // the destructor writes whatever is still pending
+
+        if ( m_interval_pending) {
+            clock_type::time_point last_modified = clock_type::time_point( clock_type::duration( m_last_modified.load(std::memory_order_relaxed)));
+            clock_type::time_point debounced = last_modified + std::chrono::milliseconds(m_debounce_ms);
+            clock_type::time_point latest = m_first_modified + std::chrono::milliseconds(m_interval_ms);
+            clock_type::time_point deadline = debounced < latest ? debounced : latest;
+            if ( clock_type::now() >= deadline) {
+                // whatever is modified from now on, is for the next write
+                m_interval_pending = false;
+                lk.unlock();
+                write();
+                lk.lock();
+            }
+            else
+                m_writer_cv.wait_until(lk, deadline);
+            continue;
+        }
+        m_writer_cv.wait(lk);
+    }
+}
+
+// writes what changed since the last write. Returns false if writing failed
+bool file_storage::write() {
+    scoped_lock lk(m_io_cs);
+    // note: setting an existing value does not lock, so find out if we're dirty atomically
+    if ( !m_is_dirty.exchange(false))
+        return true;
 
     if ( m_open == open_read_only)
-        return; // never save
+        return true; // never save
 
-    typedef std::map<int, string> index_to_name_coll;
-    index_to_name_coll index_to_name;
-    for ( info_coll::const_iterator b = m_infos.begin(), e = m_infos.end(); b != e; ++b)
-        index_to_name[ b->second.idx ] = b->first;
+    if ( !m_shared.load(std::memory_order_acquire))
+        return write_changes();
 
-    ofstream out(m_file_name.c_str());
-    for ( index_to_name_coll::const_iterator b = index_to_name.begin(), e = index_to_name.end(); b != e; ++b) {
-        info & cur = m_infos[ b->second ];
-        write_setting(out, cur);
+    // shared: hold the lock while we write; if another process wrote the file since we read it,
+    // read it again, so that we only overwrite the settings we set
+    file_lock lock(m_file_name + ".lock", true);
+    if ( !lock.locked()) {
+        m_is_dirty = true;
+        if ( parent())
+            set_error(err::cannot_save, TTEXT("cannot lock settings file ") + string(m_file_name.begin(), m_file_name.end()) );
+        return false;
     }
+    if ( stamp_of(m_file_name) != m_stamp) {
+        if ( file_is_valid()) {
+            read_file();
+            validate();
+            on_reloaded();
+        }
+        else
+            // the file has invalid settings - overwrite it with ours
+            m_can_rewrite_in_place = false;
+    }
+    return write_changes();
+}
 
-    m_is_dirty = false;
+// note: m_io_cs is locked
+bool file_storage::write_changes() {
+    // the values set from now on will be written next time - we only take the keys here, in O(changes);
+    // the values are read (lock-free) as we write them
+    m_changed.clear();
+    m_table.take_changed(m_changed);
+    // if only a few settings changed, only rewrite those
+    bool few_changes = m_changed.size() * 4 <= (size_t)m_table.size();
+    bool ok = (few_changes && save_in_place(m_changed)) || save_all();
+    if ( ok)
+        m_stamp = stamp_of(m_file_name);
+    return ok;
 }
 
-namespace {
-    void strip_comment(string & line, string & comment) {
-        comment.erase();
-        int to_strip = -1;
-        for ( string::reverse_iterator b = line.rbegin(), e = line.rend(); b != e; ++b)
-            if ( *b == '#')
-                to_strip = (int)(b - line.rbegin()); // found comment
-            else if ( *b == '"')
-                break; // found end of string
-
-        if ( to_strip >= 0) {
-            comment = line.substr( line.size() - to_strip - 1);
-            line = line.substr(0, line.size() - to_strip - 1);
+// rewrites the whole file
+bool file_storage::save_all() {
+    // write everything to a temporary file, then replace the original with it - so that
+    // the settings file is never left half-written
+    std::string temp_name = m_file_name + ".tmp";
+    bool ok;
+    std::vector<value_span> spans;
+    unsigned long long written = 0;
+    bool removed = false;
+    {
+    ofstream out(temp_name.c_str());
+    m_save_buffer.erase();
+    info cur;
+    int count = m_table.size();
+    spans.reserve(count);
+    // the comments are sorted by key, same as we walk the settings
+    comment_coll::const_iterator comment = m_comments.begin();
+    for ( int key = 0; key <= count; ++key) {
+        if ( key == m_trailing_pos && m_trailing_comment.len) {
+            cur.name.erase();
+            cur.comment.assign( m_trailing_comment.data, m_trailing_comment.len);
+            write_setting(m_save_buffer, cur);
         }
+        if ( key == count)
+            break;
+        if ( m_table.is_removed(key)) {
+            // (the positions in the file no longer match the keys)
+            removed = true;
+            continue;
+        }
+
+        while ( comment != m_comments.end() && comment->first < key)
+            ++comment;
+        if ( comment != m_comments.end() && comment->first == key)
+            cur.comment.assign( comment->second.data, comment->second.len);
+        else
+            cur.comment.erase();
+        size_t name_len;
+        const char_t * name = m_table.name(key, name_len);
+        cur.name.assign(name, name_len);
+        m_table.get(key, cur.value, cur.type);
+        size_t value_begin = write_setting(m_save_buffer, cur);
+        // (the value is followed by a space)
+        spans.push_back( value_span(written + value_begin, m_save_buffer.size() - 1 - value_begin) );
+
+        if ( m_save_buffer.size() >= SAVE_BUFFER_SIZE) {
+            out.write( m_save_buffer.data(), m_save_buffer.size());
+            written += m_save_buffer.size();
+            m_save_buffer.erase();
+        }
+    }
+    out.write( m_save_buffer.data(), m_save_buffer.size());
+    written += m_save_buffer.size();
+    out.close();
+    ok = !out.fail();
     }
 
+    if ( ok)
+        ok = replace_file(temp_name, m_file_name);
+    if ( ok) {
+        m_spans.swap(spans);
+        m_file_size = written;
+        m_can_rewrite_in_place = CAN_REWRITE_IN_PLACE && !removed;
+    }
+    else {
+        ::remove( temp_name.c_str());
+        // we'll retry on next save
+        m_is_dirty = true;
+        m_can_rewrite_in_place = false;
+        if ( parent())
+            set_error(err::cannot_save, TTEXT("cannot save settings file ") + string(m_file_name.begin(), m_file_name.end()) );
+    }
+    // the buffer is reused on next save - but don't keep a huge one around forever
+    if ( m_save_buffer.capacity() > SAVE_BUFFER_SIZE * 2)
+        string().swap(m_save_buffer);
+    return ok;
 }
 
-void file_storage::read_setting(string line, info & parsed) {
-    strip_comment(line, parsed.comment);
-    string::size_type equal = line.find('=');
-    if ( equal != string::npos) {
-        parsed.name = line.substr(0, equal);
-        string value = line.substr(equal + 1);
-        // remove leading and trailing spaces
-        detail::trim(value);
+/*
+    Rewrites only the values of the changed settings, in place: where a new value has the same length as the old one,
+    it's simply overwritten; from the first value whose length changed, the rest of the file is shifted.
 
-        if ( (value.size() > 2) && (value[0] == '"') && (*value.rbegin() == '"') ) {
-            parsed.type = typeid(string);
-            value.erase(0, 1);
-            value.erase( value.size() - 1, 1);
-            parsed.value = detail::unescape_string(value);
-        }
-        // otherwise, it'a number or bool
-        else if ( value == TTEXT("true")) {
-            parsed.type = typeid(bool);
-            parsed.value = TTEXT("1");
-        }
-        else if ( value == TTEXT("false")) {
-            parsed.type = typeid(bool);
-            parsed.value = TTEXT("0");
+    Returns false if we can't do it (like, settings were added, or the file was changed behind our back) -
+    in which case, the whole file needs to be rewritten.
+*/
+bool file_storage::save_in_place(std::vector<int> & changed) {
+    if ( !m_can_rewrite_in_place || m_spans.size() != (size_t)m_table.size() )
+        return false;
+    if ( m_file_size == 0 || file_size(m_file_name) != m_file_size)
+        return false;
+    if ( changed.empty())
+        return true;
+
+    std::sort( changed.begin(), changed.end());
+    fstream file( m_file_name.c_str(), std::ios_base::in | std::ios_base::out);
+    if ( !file)
+        return false;
+
+    // the new text for each changed value
+    std::vector<string> texts( changed.size());
+    info cur;
+    size_t first_moved = changed.size();
+    for ( size_t idx = 0; idx < changed.size(); ++idx) {
+        m_table.get(changed[idx], cur.value, cur.type);
+        write_value(texts[idx], cur);
+        if ( first_moved == changed.size() && texts[idx].size() != m_spans[ changed[idx] ].len)
+            first_moved = idx;
+    }
+
+    // same length - overwrite
+    for ( size_t idx = 0; idx < first_moved; ++idx) {
+        file.seekp( (std::streamoff)m_spans[ changed[idx] ].offset);
+        file.write( texts[idx].data(), texts[idx].size());
+    }
+
+    if ( first_moved < changed.size()) {
+        // the rest of the file moves
+        unsigned long long tail_start = m_spans[ changed[first_moved] ].offset;
+        m_save_buffer.resize( (size_t)(m_file_size - tail_start));
+        file.seekg( (std::streamoff)tail_start);
+        file.read( &*m_save_buffer.begin(), m_save_buffer.size());
+        if ( (size_t)file.gcount() != m_save_buffer.size()) {
+            m_can_rewrite_in_place = false;
+            return false;
         }
-        else if ( !value.empty() && value[0] == '-') {
-            parsed.type = typeid(long);
-            parsed.value = value;
+
+        string tail;
+        tail.reserve( m_save_buffer.size() + m_save_buffer.size() / 8);
+        size_t copied = 0;
+        long long delta = 0;
+        size_t edit = first_moved;
+        for ( int key = changed[first_moved]; key < (int)m_spans.size(); ++key) {
+            value_span & span = m_spans[key];
+            if ( edit < changed.size() && changed[edit] == key) {
+                size_t begin = (size_t)(span.offset - tail_start);
+                tail.append( m_save_buffer, copied, begin - copied);
+                tail += texts[edit];
+                copied = begin + span.len;
+                span.offset += delta;
+                delta += (long long)texts[edit].size() - (long long)span.len;
+                span.len = (unsigned int)texts[edit].size();
+                ++edit;
+            }
+            else
+                span.offset += delta;
         }
-        else if ( !value.empty() && isdigit(value[0])) {
-            parsed.type = typeid(unsigned long);
-            parsed.value = value;
+        tail.append( m_save_buffer, copied, string::npos);
+
+        file.seekp( (std::streamoff)tail_start);
+        file.write( tail.data(), tail.size());
+        file.close();
+        unsigned long long new_size = tail_start + tail.size();
+        if ( file.fail() || (new_size < m_file_size && !truncate_file(m_file_name, new_size)) ) {
+            m_can_rewrite_in_place = false;
+            return false;
         }
-        else {
-            // note: this could be an enum
-            parsed.type = typeid(string);
-            parsed.value = value;
+        m_file_size = new_size;
+    }
+    else {
+        file.close();
+        if ( file.fail()) {
+            m_can_rewrite_in_place = false;
+            return false;
         }
-
-        if ( parsed.type != typeid(string))
-            if ( parsed.value.find('.') != string::npos)
-                parsed.type = typeid(double);
     }
-    else
-        parsed.comment = line + parsed.comment;
+
+    if ( m_save_buffer.capacity() > SAVE_BUFFER_SIZE * 2)
+        string().swap(m_save_buffer);
+    return true;
+}
+
+void file_storage::read_setting(const string & line, info & parsed, size_t & value_begin, size_t & value_end) {
+    detail::parse_setting_line(line, parsed.name, parsed.value, parsed.type, parsed.comment, &value_begin, &value_end);
 }
 
-void file_storage::write_setting(ofstream & out, const info & parsed) {
-    out << parsed.comment << '\n';
+// returns where the value starts (within 'out')
+size_t file_storage::write_setting(string & out, const info & parsed) {
+    out += parsed.comment;
+    out += '\n';
+    size_t value_begin = out.size();
     // see if parsed.name is empty - if so, there's no settting to write
     if ( !parsed.name.empty()) {
-        out << parsed.name << '=' ;
-        if ( parsed.type == typeid(string) || parsed.type == typeid(variant)) 
-            out << '"' << detail::escape_string(parsed.value) << '"';
-        else if ( parsed.type != typeid(bool))
-            out << parsed.value;
-        else
-            out << ((parsed.value != TTEXT("0")) ? TTEXT("true") : TTEXT("false"));
-        out << ' ';
+        out += parsed.name;
+        out += '=';
+        value_begin = out.size();
+        write_value(out, parsed);
+        out += ' ';
     }
+    return value_begin;
+}
+
+void file_storage::write_value(string & out, const info & parsed) {
+    if ( parsed.type == typeid(string) || parsed.type == typeid(variant)) {
+        out += '"';
+        detail::append_escaped(out, parsed.value);
+        out += '"';
+    }
+    else if ( parsed.type != typeid(bool))
+        out += parsed.value;
+    else
+        out += (parsed.value != TTEXT("0")) ? TTEXT("true") : TTEXT("false");
 }
 
 
 void file_storage::get_setting( const string & name, string & value, typeinfo& type) const {
-    info_coll::const_iterator found = m_infos.find(name);
-    if ( found != m_infos.end() ) {
-        value = found->second.value;
-        type = found->second.type;
-    }
-    else {
+    check_if_due();
+    // lock-free
+    if ( !m_table.get(name, value, type) ) {
         value.clear();
         type = typeid(string);
         bool has_default;
@@ -241,76 +712,142 @@ void file_storage::get_setting( const string & name, string & value, typeinfo& t
     }
 }
 
-namespace {
-    // we only need 4 types: int, unsigned, double, bool, string
-    typeinfo friendly_type(const typeinfo& type) {
-        if ( type == typeid(char))
-            return typeid(string);
-        else if ( type == typeid(wchar_t) )
-            return typeid(string);
-        else if ( type == typeid(unsigned char) )
-            return typeid(string);
-        else if ( type == typeid(signed char) )
-            return typeid(string);
-        else if ( type == typeid(short) )
-            return typeid(long);
-        else if ( type == typeid(unsigned short) )
-            return typeid(unsigned long);
-        else if ( type == typeid(int) )
-            return typeid(long);
-        else if ( type == typeid(unsigned int) )
-            return typeid(unsigned long);
-        else if ( type == typeid(long) )
-            return typeid(long);
-        else if ( type == typeid(unsigned long) )
-            return typeid(unsigned long);
-        else if ( type == typeid(double) )
-            return typeid(double);
-        else if ( type == typeid(float) )
-            return typeid(double);
-        else if ( type == typeid(bool) )
-            return typeid(bool);
-        else if ( type == typeid(string) )
-            return typeid(string);
-        else if ( type == typeid(variant) )
-            return typeid(variant);
-
-        return typeid(variant); // unknown
-    }
+bool file_storage::find_setting( const string & name, string & value, typeinfo& type) const {
+    // lock-free
+    return m_table.get(name, value, type);
 }
 
 
+
 void file_storage::set_setting( const string & name, const string & value, const typeinfo&type) {
-    info_coll::iterator found = m_infos.find(name);
-    if ( found != m_infos.end() ) {
-        // we have this setting
-        if ( found->second.value != value) {
-            found->second.value = value;
-            m_is_dirty = true;
-        }
-    }
+    // did this call change anything? (if not, there's nothing to save)
+    bool changed = false;
+    int found = m_table.find(name.c_str(), name.size());
+    if ( found >= 0 && !m_table.is_removed(found))
+        // we have this setting - no need to lock
+        changed = m_table.set(found, value);
     else {
+        scoped_lock lk(cs());
         if ( m_open != open_read_only) {
-            info new_sett;
-            new_sett.idx = (int)m_infos.size() ;
-            new_sett.name = name;
-            new_sett.value = value;
-            new_sett.type = friendly_type(type);
-            m_infos[ name ] = new_sett;
-            m_is_dirty = true;
+            bool inserted;
+            // (it's not in the file yet - a reload won't remove it)
+            int key = m_table.insert(name, value, detail::friendly_type(type), inserted, true);
+            // (if it wasn't inserted, another thread just added it - or it was removed)
+            changed = inserted || (m_table.is_removed(key) ? m_table.set(key, value, detail::friendly_type(type)) : m_table.set(key, value));
         }
         else {
             set_error(err::bad_setting_name, TTEXT("cannot set setting (file is readyonly)") + full_setting_name(name) );
         }
     }
+    if ( !changed)
+        return;
 
-    if ( m_is_dirty && (m_save == save_each_modify) )
-        save();
+    m_is_dirty = true;
+    if ( m_save == save_each_modify)
+        // don't make the caller wait for the disk
+        save_async();
+    else if ( m_save == save_at_interval)
+        on_modified();
 }
+
 void file_storage::enum_settings( std::map<string,string> & values) const {
+    check_if_due();
     values.clear();
-    for ( info_coll::const_iterator b = m_infos.begin(), e = m_infos.end(); b != e; ++b)
-        values[ b->first ] = b->second.value;
+    string value;
+    typeinfo type;
+    int count = m_table.size();
+    for ( int key = 0; key < count; ++key) {
+        if ( m_table.is_removed(key))
+            continue;
+        m_table.get(key, value, type);
+        values[ m_table.name(key) ] = value;
+    }
+}
+
+namespace {
+    struct name_less {
+        explicit name_less(const detail::settings_table & table) : table(table) {}
+        const detail::settings_table & table;
+
+        static int compare(const char_t * a, size_t a_len, const char_t * b, size_t b_len) {
+            int result = std::char_traits<char_t>::compare(a, b, std::min(a_len, b_len));
+            return result ? result : (a_len < b_len ? -1 : (a_len > b_len ? 1 : 0));
+        }
+        bool operator()(int a, int b) const {
+            size_t a_len, b_len;
+            const char_t * a_name = table.name(a, a_len);
+            const char_t * b_name = table.name(b, b_len);
+            return compare(a_name, a_len, b_name, b_len) < 0;
+        }
+        // (for lower_bound: key < prefix)
+        bool operator()(int key, const string & prefix) const {
+            size_t len;
+            const char_t * name = table.name(key, len);
+            return compare(name, len, prefix.c_str(), prefix.size()) < 0;
+        }
+    };
+}
+
+// call it within a read_guard
+const file_storage::sorted_keys & file_storage::sorted() const {
+    sorted_keys * cur = m_sorted.load(std::memory_order_acquire);
+    int count = m_table.size();
+    if ( cur && (int)cur->keys.size() == count)
+        return *cur;
+
+    scoped_lock lk(m_sorted_cs);
+    cur = m_sorted.load(std::memory_order_acquire);
+    count = m_table.size();
+    if ( cur && (int)cur->keys.size() == count)
+        return *cur;
+    // the keys we already sorted stay sorted - sort the new ones and merge them in
+    sorted_keys * fresh = new sorted_keys;
+    size_t old_count = cur ? cur->keys.size() : 0;
+    fresh->keys.reserve(count);
+    if ( cur)
+        fresh->keys = cur->keys;
+    for ( int key = (int)old_count; key < count; ++key)
+        fresh->keys.push_back(key);
+    std::sort( fresh->keys.begin() + old_count, fresh->keys.end(), name_less(m_table));
+    std::inplace_merge( fresh->keys.begin(), fresh->keys.begin() + old_count, fresh->keys.end(), name_less(m_table));
+    m_sorted.store(fresh, std::memory_order_release);
+    if ( cur)
+        // other threads might still be scanning it
+        detail::retire(cur, delete_sorted);
+    return *fresh;
+}
+
+void file_storage::delete_sorted(void * p) {
+    delete static_cast<sorted_keys*>(p);
+}
+
+bool file_storage::visit_settings( const string & prefix, const setting_visitor & visitor) const {
+    check_if_due();
+    detail::read_guard guard;
+    const sorted_keys & s = sorted();
+    name_less less(m_table);
+    // (reused for each setting)
+    string name, value;
+    typeinfo type;
+    for ( std::vector<int>::const_iterator first = std::lower_bound(s.keys.begin(), s.keys.end(), prefix, less), last = s.keys.end();
+          first != last; ++first) {
+        size_t len;
+        const char_t * key_name = m_table.name(*first, len);
+        if ( len < prefix.size() || std::char_traits<char_t>::compare(key_name, prefix.c_str(), prefix.size()) != 0)
+            break;
+        if ( m_table.is_removed(*first))
+            continue;
+        name.assign(key_name, len);
+        m_table.get(*first, value, type);
+        if ( !visitor(name, value, type))
+            return false;
+    }
+    return true;
+}
+
+void file_storage::get_memory_usage(memory_usage & usage) const {
+    ensure_loaded();
+    m_table.memory(usage);
 }
 
 }
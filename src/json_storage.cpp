@@ -0,0 +1,889 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/json_storage.h"
+#include "ss/util.h"
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace ss {
+
+    namespace {
+
+        // replaces 'to' with 'from' - atomically, where the OS allows it
+        bool replace_file(const std::string & from, const std::string & to) {
+#ifdef _WIN32
+            return ::MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            return ::rename( from.c_str(), to.c_str()) == 0;
+#endif
+        }
+
+        // the whole file, mapped read-only (if it can't be mapped - like, it's empty - it's read into memory)
+        class mapped_file {
+            mapped_file(const mapped_file&);
+            void operator=(const mapped_file&);
+        public:
+            explicit mapped_file(const std::string & name) : m_data(0), m_size(0) {
+#ifdef _WIN32
+                m_file = ::CreateFileA( name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                        0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+                m_mapping = 0;
+                LARGE_INTEGER size;
+                if ( m_file != INVALID_HANDLE_VALUE && ::GetFileSizeEx(m_file, &size) && size.QuadPart > 0) {
+                    m_mapping = ::CreateFileMappingA( m_file, 0, PAGE_READONLY, 0, 0, 0);
+                    if ( m_mapping)
+                        m_data = static_cast<const char*>( ::MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0));
+                    if ( m_data)
+                        m_size = (size_t)size.QuadPart;
+                }
+#else
+                m_fd = ::open( name.c_str(), O_RDONLY);
+                struct stat info;
+                if ( m_fd >= 0 && ::fstat(m_fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+                    void * data = ::mmap( 0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+                    if ( data != MAP_FAILED) {
+                        // we read it once, front to back
+                        ::madvise( data, (size_t)info.st_size, MADV_SEQUENTIAL);
+                        m_data = static_cast<const char*>(data);
+                        m_size = (size_t)info.st_size;
+                    }
+                }
+#endif
+                if ( !m_data) {
+                    std::ifstream in( name.c_str(), std::ios_base::in | std::ios_base::binary);
+                    m_copy.assign( std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() );
+                }
+            }
+            ~mapped_file() {
+#ifdef _WIN32
+                if ( m_data)
+                    ::UnmapViewOfFile(m_data);
+                if ( m_mapping)
+                    ::CloseHandle(m_mapping);
+                if ( m_file != INVALID_HANDLE_VALUE)
+                    ::CloseHandle(m_file);
+#else
+                if ( m_data)
+                    ::munmap( const_cast<char*>(m_data), m_size);
+                if ( m_fd >= 0)
+                    ::close(m_fd);
+#endif
+            }
+            const char * begin() const { return m_data ? m_data : m_copy.data(); }
+            const char * end() const { return m_data ? m_data + m_size : m_copy.data() + m_copy.size(); }
+        private:
+            const char * m_data;
+            size_t m_size;
+            std::string m_copy;
+#ifdef _WIN32
+            HANDLE m_file;
+            HANDLE m_mapping;
+#else
+            int m_fd;
+#endif
+        };
+
+        // the file is UTF-8
+        inline void assign_chars(std::string & dest, const char * begin, const char * end) { dest.assign(begin, end); }
+        inline void assign_chars(std::wstring & dest, const char * begin, const char * end) { dest = detail::widen( std::string(begin, end)); }
+
+        void append_number(std::string & dest, unsigned long n) {
+            char buff[ 24];
+            int len = sprintf(buff, "%lu", n);
+            dest.append(buff, len);
+        }
+
+        void append_utf8(std::string & dest, unsigned long code) {
+            if ( code < 0x80)
+                dest += (char)code;
+            else if ( code < 0x800) {
+                dest += (char)(0xC0 | (code >> 6));
+                dest += (char)(0x80 | (code & 0x3F));
+            }
+            else if ( code < 0x10000) {
+                dest += (char)(0xE0 | (code >> 12));
+                dest += (char)(0x80 | ((code >> 6) & 0x3F));
+                dest += (char)(0x80 | (code & 0x3F));
+            }
+            else {
+                dest += (char)(0xF0 | (code >> 18));
+                dest += (char)(0x80 | ((code >> 12) & 0x3F));
+                dest += (char)(0x80 | ((code >> 6) & 0x3F));
+                dest += (char)(0x80 | (code & 0x3F));
+            }
+        }
+
+        /*
+            A SAX-style JSON parser: one pass over the text, without building a document -
+            it tells the handler about each thing it finds:
+
+            h.begin_object(), h.key(begin,end), h.end_object(),
+            h.begin_array(), h.end_array(),
+            h.scalar(begin, end, type) - strings are unescaped, other values are as written
+
+            Nesting is tracked on a stack of its own (not by recursion), so deep files are fine.
+            A string without escapes is passed as it is in the text; the others are unescaped into a buffer
+            that's reused.
+        */
+        template<class handler> class json_parser {
+        public:
+            json_parser(const char * begin, const char * end, handler & h) : m_begin(begin), m_cur(begin), m_end(end), m_h(h) {}
+
+            // false if the text is not valid JSON (see error())
+            bool parse() {
+                enum { want_value, want_key, after_value } state = want_value;
+                while ( true) {
+                    skip_ws();
+                    if ( state == want_value) {
+                        if ( m_cur == m_end)
+                            return fail("unexpected end of file");
+                        char ch = *m_cur;
+                        if ( ch == '{') {
+                            ++m_cur;
+                            m_h.begin_object();
+                            skip_ws();
+                            if ( m_cur != m_end && *m_cur == '}') {
+                                ++m_cur;
+                                m_h.end_object();
+                                state = after_value;
+                            }
+                            else {
+                                m_nesting.push_back('{');
+                                state = want_key;
+                            }
+                        }
+                        else if ( ch == '[') {
+                            ++m_cur;
+                            m_h.begin_array();
+                            skip_ws();
+                            if ( m_cur != m_end && *m_cur == ']') {
+                                ++m_cur;
+                                m_h.end_array();
+                                state = after_value;
+                            }
+                            else
+                                m_nesting.push_back('[');
+                        }
+                        else {
+                            if ( !parse_scalar())
+                                return false;
+                            state = after_value;
+                        }
+                    }
+                    else if ( state == want_key) {
+                        const char * begin, * end;
+                        if ( m_cur == m_end || *m_cur != '"' || !parse_string(begin, end))
+                            return fail("expected a name");
+                        m_h.key(begin, end);
+                        skip_ws();
+                        if ( m_cur == m_end || *m_cur != ':')
+                            return fail("expected ':'");
+                        ++m_cur;
+                        state = want_value;
+                    }
+                    else {
+                        if ( m_nesting.empty()) {
+                            if ( m_cur != m_end)
+                                return fail("unexpected text after the end");
+                            return true;
+                        }
+                        char open = m_nesting.back();
+                        if ( m_cur == m_end)
+                            return fail("unexpected end of file");
+                        char ch = *m_cur++;
+                        if ( ch == ',')
+                            state = open == '{' ? want_key : want_value;
+                        else if ( ch == '}' && open == '{') {
+                            m_nesting.pop_back();
+                            m_h.end_object();
+                        }
+                        else if ( ch == ']' && open == '[') {
+                            m_nesting.pop_back();
+                            m_h.end_array();
+                        }
+                        else {
+                            --m_cur;
+                            return fail( open == '{' ? "expected ',' or '}'" : "expected ',' or ']'");
+                        }
+                    }
+                }
+            }
+
+            // "line L, column C: what's wrong"
+            const std::string & error() const { return m_error; }
+
+        private:
+            void skip_ws() {
+                while ( m_cur != m_end && (*m_cur == ' ' || *m_cur == '\n' || *m_cur == '\r' || *m_cur == '\t'))
+                    ++m_cur;
+            }
+
+            bool fail(const char * what) {
+                // we only count lines when there's an error
+                unsigned long line = 1, column = 1;
+                for ( const char * p = m_begin; p != m_cur; ++p)
+                    if ( *p == '\n') {
+                        ++line;
+                        column = 1;
+                    }
+                    else
+                        ++column;
+                m_error = "line ";
+                append_number(m_error, line);
+                m_error += ", column ";
+                append_number(m_error, column);
+                m_error += ": ";
+                m_error += what;
+                return false;
+            }
+
+            bool parse_scalar() {
+                const char * begin = m_cur;
+                char ch = *m_cur;
+                if ( ch == '"') {
+                    const char * end;
+                    if ( !parse_string(begin, end))
+                        return false;
+                    m_h.scalar(begin, end, typeid(string));
+                    return true;
+                }
+                if ( ch == '-' || (ch >= '0' && ch <= '9'))
+                    return parse_number();
+                if ( literal("true")) {
+                    m_h.scalar(begin, m_cur, typeid(bool));
+                    return true;
+                }
+                if ( literal("false")) {
+                    m_h.scalar(begin, m_cur, typeid(bool));
+                    return true;
+                }
+                if ( literal("null")) {
+                    m_h.scalar(m_cur, m_cur, typeid(string));
+                    return true;
+                }
+                return fail("expected a value");
+            }
+
+            bool literal(const char * word) {
+                size_t len = strlen(word);
+                if ( (size_t)(m_end - m_cur) < len || memcmp(m_cur, word, len) != 0)
+                    return false;
+                m_cur += len;
+                return true;
+            }
+
+            bool digits() {
+                const char * begin = m_cur;
+                while ( m_cur != m_end && *m_cur >= '0' && *m_cur <= '9')
+                    ++m_cur;
+                return m_cur != begin;
+            }
+
+            bool parse_number() {
+                const char * begin = m_cur;
+                bool negative = *m_cur == '-';
+                if ( negative)
+                    ++m_cur;
+                if ( !digits())
+                    return fail("bad number");
+                bool is_double = false;
+                if ( m_cur != m_end && *m_cur == '.') {
+                    ++m_cur;
+                    is_double = true;
+                    if ( !digits())
+                        return fail("bad number");
+                }
+                if ( m_cur != m_end && (*m_cur == 'e' || *m_cur == 'E')) {
+                    ++m_cur;
+                    is_double = true;
+                    if ( m_cur != m_end && (*m_cur == '+' || *m_cur == '-'))
+                        ++m_cur;
+                    if ( !digits())
+                        return fail("bad number");
+                }
+                if ( is_double)
+                    m_h.scalar(begin, m_cur, typeid(double));
+                else if ( negative)
+                    m_h.scalar(begin, m_cur, typeid(long));
+                else
+                    m_h.scalar(begin, m_cur, typeid(unsigned long));
+                return true;
+            }
+
+            int hex_digit(char ch) {
+                if ( ch >= '0' && ch <= '9') return ch - '0';
+                if ( ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+                if ( ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+                return -1;
+            }
+
+            bool parse_hex4(unsigned long & code) {
+                if ( m_end - m_cur < 4)
+                    return false;
+                code = 0;
+                for ( int idx = 0; idx < 4; ++idx) {
+                    int digit = hex_digit(*m_cur++);
+                    if ( digit < 0)
+                        return false;
+                    code = code * 16 + digit;
+                }
+                return true;
+            }
+
+            // m_cur is at the opening quote. On success, [begin,end) is the unescaped string
+            bool parse_string(const char *& begin, const char *& end) {
+                const char * start = ++m_cur;
+                // the common case - nothing to unescape
+                while ( m_cur != m_end && *m_cur != '"' && *m_cur != '\\' && (unsigned char)*m_cur >= 0x20)
+                    ++m_cur;
+                if ( m_cur != m_end && *m_cur == '"') {
+                    begin = start;
+                    end = m_cur++;
+                    return true;
+                }
+
+                m_buffer.assign(start, m_cur);
+                while ( true) {
+                    if ( m_cur == m_end)
+                        return fail("unterminated string");
+                    char ch = *m_cur++;
+                    if ( ch == '"')
+                        break;
+                    if ( (unsigned char)ch < 0x20) {
+                        --m_cur;
+                        return fail("control character in string");
+                    }
+                    if ( ch != '\\') {
+                        m_buffer += ch;
+                        continue;
+                    }
+                    if ( m_cur == m_end)
+                        return fail("unterminated string");
+                    switch ( *m_cur++) {
+                    case '"': m_buffer += '"'; break;
+                    case '\\': m_buffer += '\\'; break;
+                    case '/': m_buffer += '/'; break;
+                    case 'b': m_buffer += '\b'; break;
+                    case 'f': m_buffer += '\f'; break;
+                    case 'n': m_buffer += '\n'; break;
+                    case 'r': m_buffer += '\r'; break;
+                    case 't': m_buffer += '\t'; break;
+                    case 'u': {
+                        unsigned long code;
+                        if ( !parse_hex4(code))
+                            return fail("bad \\u escape");
+                        if ( code >= 0xD800 && code <= 0xDBFF) {
+                            // a surrogate pair
+                            unsigned long low;
+                            if ( m_end - m_cur < 2 || m_cur[0] != '\\' || m_cur[1] != 'u')
+                                return fail("bad \\u escape");
+                            m_cur += 2;
+                            if ( !parse_hex4(low) || low < 0xDC00 || low > 0xDFFF)
+                                return fail("bad \\u escape");
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        append_utf8(m_buffer, code);
+                        break;
+                    }
+                    default:
+                        --m_cur;
+                        return fail("bad escape");
+                    }
+                }
+                begin = m_buffer.data();
+                end = begin + m_buffer.size();
+                return true;
+            }
+
+        private:
+            const char * m_begin;
+            const char * m_cur;
+            const char * m_end;
+            handler & m_h;
+            // '{' or '[' - what we're in
+            std::vector<char> m_nesting;
+            // unescaped strings (reused)
+            std::string m_buffer;
+            std::string m_error;
+        };
+
+        /*
+            Turns the parser's events into settings: keeps the path we're at ("app.hosts.elems.2") and,
+            for each array we're in, how many elements we've seen so far.
+        */
+        class table_builder {
+        public:
+            explicit table_builder(detail::settings_table & table) : m_table(table) {}
+
+            void begin_object() {
+                begin_value();
+                push(false);
+            }
+            void end_object() {
+                m_frames.pop_back();
+            }
+            void begin_array() {
+                begin_value();
+                push(true);
+            }
+            void end_array() {
+                frame & f = m_frames.back();
+                unsigned long count = f.count;
+                path_at(f.base);
+                m_path += "count";
+                m_frames.pop_back();
+                std::string & value = m_value_buffer;
+                value.erase();
+                append_number(value, count);
+                add( value.data(), value.data() + value.size(), typeid(unsigned long));
+            }
+            void key(const char * begin, const char * end) {
+                path_at( m_frames.back().base);
+                for ( ; begin != end; ++begin)
+                    // (names are case-insensitive; only ASCII letters are lower-cased, so UTF-8 stays intact)
+                    m_path += (*begin >= 'A' && *begin <= 'Z') ? (char)(*begin - 'A' + 'a') : *begin;
+            }
+            void scalar(const char * begin, const char * end, const typeinfo & type) {
+                begin_value();
+                if ( type == typeid(bool)) {
+                    // we keep bools as "1"/"0"
+                    const char * flag = *begin == 't' ? "1" : "0";
+                    add(flag, flag + 1, type);
+                }
+                else
+                    add(begin, end, type);
+            }
+
+        private:
+            struct frame {
+                // where this object/array's own path ends
+                size_t base;
+                bool is_array;
+                unsigned long count;
+            };
+
+            void push(bool is_array) {
+                frame f;
+                f.base = m_path.size();
+                f.is_array = is_array;
+                f.count = 0;
+                m_frames.push_back(f);
+            }
+
+            // the path of an object/array, ready for a child's name to be appended
+            void path_at(size_t base) {
+                m_path.resize(base);
+                if ( base > 0)
+                    m_path += '.';
+            }
+
+            // within an array, each value is the next element
+            void begin_value() {
+                if ( m_frames.empty() || !m_frames.back().is_array)
+                    return;
+                frame & f = m_frames.back();
+                path_at(f.base);
+                m_path += "elems.";
+                append_number(m_path, ++f.count);
+            }
+
+            void add(const char * begin, const char * end, const typeinfo & type) {
+                if ( m_path.empty())
+                    // a value that's not within an object/array - it has no name
+                    return;
+                assign_chars(m_name, m_path.data(), m_path.data() + m_path.size());
+                assign_chars(m_value, begin, end);
+                int key = m_table.find( m_name.c_str(), m_name.size());
+                if ( key < 0) {
+                    bool inserted;
+                    key = m_table.insert(m_name, m_value, type, inserted);
+                    if ( !inserted)
+                        m_table.set_loaded(key, m_value, type);
+                }
+                else
+                    // (if the same setting is there twice, the last one wins)
+                    m_table.set_loaded(key, m_value, type);
+            }
+
+        private:
+            detail::settings_table & m_table;
+            std::string m_path;
+            std::vector<frame> m_frames;
+            // (reused for each setting)
+            string m_name, m_value;
+            std::string m_value_buffer;
+        };
+
+        ///////////////////////////////////////////////////////////////////////////
+        // writing
+
+        void write_string(std::string & out, const std::string & value) {
+            out += '"';
+            for ( std::string::const_iterator first = value.begin(), last = value.end(); first != last; ++first) {
+                unsigned char ch = (unsigned char)*first;
+                switch ( ch) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if ( ch < 0x20) {
+                        char buff[ 8];
+                        sprintf(buff, "\\u%04x", ch);
+                        out += buff;
+                    }
+                    else
+                        out += (char)ch;
+                }
+            }
+            out += '"';
+        }
+
+        // is it a number, as JSON writes it?
+        bool is_json_number(const std::string & value) {
+            struct number_check {
+                bool ok;
+                number_check() : ok(false) {}
+                void begin_object() {} void end_object() {} void begin_array() {} void end_array() {}
+                void key(const char*, const char*) {}
+                void scalar(const char*, const char*, const typeinfo & type) {
+                    ok = type == typeid(long) || type == typeid(unsigned long) || type == typeid(double);
+                }
+            } check;
+            json_parser<number_check> parser( value.data(), value.data() + value.size(), check);
+            return !value.empty() && parser.parse() && check.ok;
+        }
+
+        /*
+            The settings, as a tree (split at the dots). A node has a value, sub-nodes, or (rarely) both.
+        */
+        struct tree_node {
+            tree_node() : key(-1) {}
+            // the setting's key in the table (-1 = no value)
+            int key;
+            // name -> node index
+            std::map<std::string, size_t> children;
+        };
+
+        class tree_writer {
+        public:
+            tree_writer(const detail::settings_table & table) : m_table(table), m_nodes(1) {
+                for ( int key = 0, count = m_table.size(); key < count; ++key) {
+                    std::string name = detail::narrow( m_table.name(key));
+                    size_t node = 0;
+                    std::string::size_type begin = 0;
+                    while ( true) {
+                        std::string::size_type dot = name.find('.', begin);
+                        node = child(node, name.substr(begin, dot == std::string::npos ? std::string::npos : dot - begin) );
+                        if ( dot == std::string::npos)
+                            break;
+                        begin = dot + 1;
+                    }
+                    m_nodes[node].key = key;
+                }
+            }
+
+            // names that have both a value and sub-settings - JSON can't have both, so we write only the sub-settings
+            const std::vector<int> & dropped() const { return m_dropped; }
+
+            void write(std::string & out) {
+                write_node(out, 0, 0);
+                out += '\n';
+            }
+
+        private:
+            size_t child(size_t node, const std::string & name) {
+                std::map<std::string, size_t>::const_iterator found = m_nodes[node].children.find(name);
+                if ( found != m_nodes[node].children.end())
+                    return found->second;
+                size_t idx = m_nodes.size();
+                m_nodes.push_back( tree_node());
+                // (careful - push_back might have moved the nodes)
+                m_nodes[node].children[name] = idx;
+                return idx;
+            }
+
+            const tree_node * find_child(const tree_node & node, const std::string & name) const {
+                std::map<std::string, size_t>::const_iterator found = node.children.find(name);
+                return found != node.children.end() ? &m_nodes[found->second] : 0;
+            }
+
+            // "count" + "elems.1".."elems.N", and nothing else - it's an array of N elements
+            bool array_size(const tree_node & node, unsigned long & count) const {
+                const tree_node * count_node = find_child(node, "count");
+                if ( !count_node || count_node->key < 0 || !count_node->children.empty())
+                    return false;
+                string value;
+                typeinfo type;
+                m_table.get(count_node->key, value, type);
+                std::string text = detail::narrow(value);
+                if ( text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+                    return false;
+                count = strtoul(text.c_str(), 0, 10);
+                if ( count == 0)
+                    return node.children.size() == 1;
+                const tree_node * elems = find_child(node, "elems");
+                if ( !elems || elems->key >= 0 || node.children.size() != 2 || elems->children.size() != count)
+                    return false;
+                std::string idx;
+                for ( unsigned long i = 1; i <= count; ++i) {
+                    idx.erase();
+                    append_number(idx, i);
+                    if ( !find_child(*elems, idx))
+                        return false;
+                }
+                return true;
+            }
+
+            void indent(std::string & out, int depth) {
+                out += '\n';
+                out.append(depth * 4, ' ');
+            }
+
+            void write_value(std::string & out, int key) {
+                string value;
+                typeinfo type;
+                m_table.get(key, value, type);
+                std::string text = detail::narrow(value);
+                switch ( detail::settings_table::type_code(type)) {
+                case 1:
+                    out += (text == "1" || text == "true") ? "true" : "false";
+                    break;
+                case 2: case 3: case 4:
+                    if ( is_json_number(text)) {
+                        out += text;
+                        break;
+                    }
+                    // fall through
+                default:
+                    write_string(out, text);
+                }
+            }
+
+            void write_node(std::string & out, size_t idx, int depth) {
+                // (m_nodes doesn't change while we write)
+                const tree_node & node = m_nodes[idx];
+                if ( node.children.empty()) {
+                    write_value(out, node.key);
+                    return;
+                }
+                if ( node.key >= 0)
+                    m_dropped.push_back(node.key);
+
+                unsigned long count;
+                if ( array_size(node, count)) {
+                    if ( count == 0) {
+                        out += "[]";
+                        return;
+                    }
+                    const tree_node & elems = *find_child(node, "elems");
+                    out += '[';
+                    std::string elem;
+                    for ( unsigned long i = 1; i <= count; ++i) {
+                        elem.erase();
+                        append_number(elem, i);
+                        indent(out, depth + 1);
+                        write_node(out, elems.children.find(elem)->second, depth + 1);
+                        if ( i < count)
+                            out += ',';
+                    }
+                    indent(out, depth);
+                    out += ']';
+                    return;
+                }
+
+                out += '{';
+                for ( std::map<std::string, size_t>::const_iterator first = node.children.begin(), last = node.children.end(); first != last; ) {
+                    indent(out, depth + 1);
+                    write_string(out, first->first);
+                    out += ": ";
+                    write_node(out, first->second, depth + 1);
+                    if ( ++first != last)
+                        out += ',';
+                }
+                indent(out, depth);
+                out += '}';
+            }
+
+        private:
+            const detail::settings_table & m_table;
+            std::vector<tree_node> m_nodes;
+            std::vector<int> m_dropped;
+        };
+
+        struct name_less {
+            explicit name_less(const detail::settings_table & table) : m_table(table) {}
+            bool operator()(int a, int b) const {
+                size_t a_len, b_len;
+                const char_t * a_name = m_table.name(a, a_len);
+                const char_t * b_name = m_table.name(b, b_len);
+                int result = std::char_traits<char_t>::compare(a_name, b_name, std::min(a_len, b_len));
+                return result < 0 || (result == 0 && a_len < b_len);
+            }
+        private:
+            const detail::settings_table & m_table;
+        };
+    }
+
+
+json_storage::json_storage(const std::string & file_name, open_type open, memory_resource * res)
+        : m_file_name(file_name), m_open(open), m_is_dirty(false) {
+    if ( res)
+        set_memory_resource(res);
+    // the file is parsed the first time it's needed - see load()
+}
+
+json_storage::~json_storage(void) {
+    save();
+}
+
+void json_storage::on_memory_resource_changed(memory_resource * res) {
+    m_table.set_memory_resource(res);
+}
+
+void json_storage::load() {
+    m_table.clear();
+    {
+    mapped_file file(m_file_name);
+    if ( file.begin() != file.end()) {
+        table_builder builder(m_table);
+        json_parser<table_builder> parser( file.begin(), file.end(), builder);
+        if ( !parser.parse()) {
+            std::string error = m_file_name + ": " + parser.error();
+            assign_chars(m_parse_error, error.data(), error.data() + error.size());
+        }
+    }
+    }
+    // nothing was changed yet
+    std::vector<int> changed;
+    m_table.take_changed(changed);
+}
+
+void json_storage::save() {
+    if ( m_open == open_read_only || !m_is_dirty.exchange(false))
+        return;
+    if ( !write())
+        // we'll retry on next save
+        m_is_dirty = true;
+}
+
+bool json_storage::write() {
+    std::string temp_name = m_file_name + ".tmp";
+    tree_writer tree(m_table);
+    std::string out;
+    tree.write(out);
+    bool ok;
+    {
+    std::ofstream file( temp_name.c_str(), std::ios_base::out | std::ios_base::binary);
+    file.write( out.data(), out.size());
+    file.close();
+    ok = !file.fail();
+    }
+    if ( ok)
+        ok = replace_file(temp_name, m_file_name);
+    if ( !ok) {
+        ::remove( temp_name.c_str());
+        if ( parent())
+            set_error(err::cannot_save, TTEXT("cannot save settings file ") + string(m_file_name.begin(), m_file_name.end()) );
+        return false;
+    }
+    if ( parent())
+        for ( std::vector<int>::const_iterator first = tree.dropped().begin(), last = tree.dropped().end(); first != last; ++first)
+            set_error(err::cannot_save, TTEXT("cannot save setting ") + full_setting_name( m_table.name(*first))
+                      + TTEXT(" to JSON - it has sub-settings as well") );
+    return true;
+}
+
+void json_storage::get_setting( const string & name, string & value, typeinfo& type) const {
+    // lock-free
+    if ( !m_table.get(name, value, type) ) {
+        value.clear();
+        type = typeid(string);
+        bool has_default;
+        parent()->get_default_value( full_setting_name(name), value, type, has_default);
+        if ( !has_default)
+            set_error(err::bad_setting_name, TTEXT("cannot get setting ") + full_setting_name(name) );
+    }
+}
+
+bool json_storage::find_setting( const string & name, string & value, typeinfo& type) const {
+    // lock-free
+    return m_table.get(name, value, type);
+}
+
+void json_storage::set_setting( const string & name, const string & value, const typeinfo&type) {
+    int found = m_table.find(name.c_str(), name.size());
+    if ( found >= 0) {
+        // we have this setting - no need to lock
+        if ( m_table.set(found, value))
+            m_is_dirty = true;
+        return;
+    }
+    scoped_lock lk(cs());
+    bool inserted;
+    int key = m_table.insert(name, value, detail::friendly_type(type), inserted);
+    if ( !inserted)
+        // another thread just added it
+        m_table.set(key, value);
+    m_is_dirty = true;
+}
+
+void json_storage::enum_settings( std::map<string,string> & values) const {
+    values.clear();
+    string value;
+    typeinfo type;
+    for ( int key = 0, count = m_table.size(); key < count; ++key) {
+        m_table.get(key, value, type);
+        values[ m_table.name(key) ] = value;
+    }
+}
+
+bool json_storage::visit_settings( const string & prefix, const setting_visitor & visitor) const {
+    std::vector<int> keys;
+    for ( int key = 0, count = m_table.size(); key < count; ++key) {
+        size_t len;
+        const char_t * key_name = m_table.name(key, len);
+        if ( len >= prefix.size() && std::char_traits<char_t>::compare(key_name, prefix.c_str(), prefix.size()) == 0)
+            keys.push_back(key);
+    }
+    std::sort( keys.begin(), keys.end(), name_less(m_table));
+    // (reused for each setting)
+    string name, value;
+    typeinfo type;
+    for ( std::vector<int>::const_iterator first = keys.begin(), last = keys.end(); first != last; ++first) {
+        name = m_table.name(*first);
+        m_table.get(*first, value, type);
+        if ( !visitor(name, value, type))
+            return false;
+    }
+    return true;
+}
+
+}
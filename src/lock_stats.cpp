@@ -0,0 +1,183 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/lock_stats.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdio.h>
+
+namespace ss {
+
+#ifdef SS_LOCK_STATS
+
+namespace detail {
+
+// keeps track of all live critical sections (intrusive list), plus the totals of the ones
+// that have been destroyed
+struct lock_registry {
+    lock_registry() : head(0) {}
+
+    // note: this is a plain mutex, not an instrumented one
+    raw_critical_section cs;
+    critical_section * head;
+    typedef std::map<std::string, lock_stats::entry> retired_coll;
+    retired_coll retired;
+
+    static lock_registry & get() {
+        // never destroyed - critical sections can be destroyed after static destructors have run
+        static lock_registry * r = new lock_registry;
+        return *r;
+    }
+
+    static void add_to(lock_stats::entry & e, const critical_section & c) {
+        ++e.instances;
+        e.acquisitions += c.m_acquisitions.load(std::memory_order_relaxed);
+        e.contended += c.m_contended.load(std::memory_order_relaxed);
+        e.wait_ns += c.m_wait_ns.load(std::memory_order_relaxed);
+        e.max_wait_ns = std::max(e.max_wait_ns, c.m_max_wait_ns.load(std::memory_order_relaxed));
+        e.hold_ns += c.m_hold_ns.load(std::memory_order_relaxed);
+        e.max_hold_ns = std::max(e.max_hold_ns, c.m_max_hold_ns.load(std::memory_order_relaxed));
+    }
+
+    static void zero(critical_section & c) {
+        c.m_acquisitions.store(0, std::memory_order_relaxed);
+        c.m_contended.store(0, std::memory_order_relaxed);
+        c.m_wait_ns.store(0, std::memory_order_relaxed);
+        c.m_max_wait_ns.store(0, std::memory_order_relaxed);
+        c.m_hold_ns.store(0, std::memory_order_relaxed);
+        c.m_max_hold_ns.store(0, std::memory_order_relaxed);
+    }
+
+    void link(critical_section * c) {
+        std::lock_guard<raw_critical_section> lk(cs);
+        c->m_prev = 0;
+        c->m_next = head;
+        if ( head) head->m_prev = c;
+        head = c;
+    }
+
+    void unlink(critical_section * c) {
+        std::lock_guard<raw_critical_section> lk(cs);
+        lock_stats::entry & e = retired[ c->m_name];
+        e.name = c->m_name;
+        add_to(e, *c);
+        if ( c->m_prev) c->m_prev->m_next = c->m_next;
+        else head = c->m_next;
+        if ( c->m_next) c->m_next->m_prev = c->m_prev;
+    }
+
+    void set_name(critical_section & c, const std::string & name) {
+        std::lock_guard<raw_critical_section> lk(cs);
+        c.m_name = name;
+    }
+
+    // the totals of all locks, per name
+    void collect(retired_coll & all) {
+        std::lock_guard<raw_critical_section> lk(cs);
+        all = retired;
+        for ( critical_section * c = head; c; c = c->m_next) {
+            lock_stats::entry & e = all[ c->m_name];
+            e.name = c->m_name;
+            add_to(e, *c);
+        }
+    }
+
+    void reset() {
+        std::lock_guard<raw_critical_section> lk(cs);
+        retired.clear();
+        for ( critical_section * c = head; c; c = c->m_next)
+            zero(*c);
+    }
+};
+
+critical_section::critical_section()
+        : m_depth(0), m_hold_start(0), m_acquisitions(0), m_contended(0), m_wait_ns(0), m_max_wait_ns(0),
+          m_hold_ns(0), m_max_hold_ns(0), m_name("(unnamed)"), m_prev(0), m_next(0) {
+    lock_registry::get().link(this);
+}
+
+critical_section::~critical_section() {
+    lock_registry::get().unlink(this);
+}
+
+void name_lock( critical_section & cs, const std::string & name) {
+    lock_registry::get().set_name(cs, name);
+}
+
+}
+
+namespace lock_stats {
+
+namespace {
+    bool more_waiting(const entry & a, const entry & b) {
+        if ( a.wait_ns != b.wait_ns) return a.wait_ns > b.wait_ns;
+        return a.hold_ns > b.hold_ns;
+    }
+}
+
+void report( std::vector<entry> & entries) {
+    using detail::lock_registry;
+    lock_registry::retired_coll all;
+    lock_registry::get().collect(all);
+
+    entries.clear();
+    for ( lock_registry::retired_coll::const_iterator b = all.begin(), e = all.end(); b != e; ++b)
+        entries.push_back(b->second);
+    std::sort( entries.begin(), entries.end(), more_waiting);
+}
+
+void reset() {
+    detail::lock_registry::get().reset();
+}
+
+#else
+
+namespace lock_stats {
+
+void report( std::vector<entry> & entries) {
+    entries.clear();
+}
+
+void reset() {
+}
+
+#endif
+
+void dump( std::ostream & out) {
+    std::vector<entry> entries;
+    report(entries);
+    if ( entries.empty()) {
+        out << "no lock statistics (build with SETTING_LOCK_STATS)\n";
+        return;
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-28s %5s %12s %10s %7s %12s %10s %12s %10s\n",
+        "lock", "inst", "acquired", "contended", "cont%", "wait(ms)", "maxwait", "hold(ms)", "maxhold");
+    out << line;
+    for ( size_t i = 0; i < entries.size(); ++i) {
+        const entry & e = entries[i];
+        snprintf(line, sizeof(line), "%-28s %5d %12llu %10llu %6.2f%% %12.3f %8.1fus %12.3f %8.1fus\n",
+            e.name.c_str(), e.instances, e.acquisitions, e.contended,
+            e.acquisitions ? 100.0 * (double)e.contended / (double)e.acquisitions : 0.0,
+            (double)e.wait_ns / 1e6, (double)e.max_wait_ns / 1e3,
+            (double)e.hold_ns / 1e6, (double)e.max_hold_ns / 1e3);
+        out << line;
+    }
+}
+
+}}
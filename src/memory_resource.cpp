@@ -0,0 +1,138 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/memory_resource.h"
+#include "ss/reclaim.h"
+#include <algorithm>
+#include <new>
+
+namespace ss {
+
+#ifdef SS_USE_PMR
+memory_resource * default_memory_resource() {
+    return std::pmr::get_default_resource();
+}
+#else
+namespace {
+    struct new_delete_resource : memory_resource {
+    protected:
+        void * do_allocate(size_t bytes, size_t) { return ::operator new(bytes); }
+        void do_deallocate(void * p, size_t, size_t) { ::operator delete(p); }
+        bool do_is_equal(const memory_resource & other) const noexcept { return this == &other; }
+    };
+}
+
+memory_resource * default_memory_resource() {
+    static new_delete_resource res;
+    return &res;
+}
+#endif
+
+namespace detail {
+
+struct monotonic_arena::chunk {
+    chunk * next;
+    memory_resource * upstream;
+    size_t size;
+};
+
+namespace {
+    // the chunk header, rounded up so that what follows it is max-aligned
+    const size_t CHUNK_HEADER = 32;
+}
+
+monotonic_arena::monotonic_arena(memory_resource * upstream, size_t first_chunk, size_t max_chunk)
+        : m_upstream(upstream ? upstream : default_memory_resource()), m_chunks(0), m_cur(0), m_left(0),
+          m_next_chunk(first_chunk), m_max_chunk(std::max(first_chunk, max_chunk)), m_reserved(0) {
+}
+
+monotonic_arena::~monotonic_arena() {
+    release();
+}
+
+void * monotonic_arena::do_allocate(size_t bytes, size_t alignment) {
+    static_assert( sizeof(chunk) <= CHUNK_HEADER, "chunk header too big");
+    size_t pad = (alignment - ((size_t)m_cur & (alignment - 1))) & (alignment - 1);
+    if ( !m_cur || bytes + pad > m_left) {
+        // new chunk
+        size_t size = std::max(m_next_chunk, CHUNK_HEADER + bytes + alignment);
+        m_next_chunk = std::min(m_next_chunk * 2, m_max_chunk);
+        chunk * c = static_cast<chunk*>( m_upstream->allocate(size, alignof(std::max_align_t)) );
+        c->next = m_chunks;
+        c->upstream = m_upstream;
+        c->size = size;
+        m_chunks = c;
+        m_reserved += size;
+        m_cur = reinterpret_cast<char*>(c) + CHUNK_HEADER;
+        m_left = size - CHUNK_HEADER;
+        pad = (alignment - ((size_t)m_cur & (alignment - 1))) & (alignment - 1);
+    }
+    void * p = m_cur + pad;
+    m_cur += pad + bytes;
+    m_left -= pad + bytes;
+    return p;
+}
+
+void monotonic_arena::free_chunk(void * p) {
+    chunk * c = static_cast<chunk*>(p);
+    c->upstream->deallocate(c, c->size, alignof(std::max_align_t));
+}
+
+void monotonic_arena::release() {
+    while ( m_chunks) {
+        chunk * next = m_chunks->next;
+        free_chunk(m_chunks);
+        m_chunks = next;
+    }
+    m_cur = 0;
+    m_left = 0;
+    m_reserved = 0;
+}
+
+void monotonic_arena::retire_all() {
+    while ( m_chunks) {
+        chunk * next = m_chunks->next;
+        retire(m_chunks, free_chunk);
+        m_chunks = next;
+    }
+    m_cur = 0;
+    m_left = 0;
+    m_reserved = 0;
+}
+
+void monotonic_arena::swap(monotonic_arena & other) {
+    std::swap(m_upstream, other.m_upstream);
+    std::swap(m_chunks, other.m_chunks);
+    std::swap(m_cur, other.m_cur);
+    std::swap(m_left, other.m_left);
+    std::swap(m_next_chunk, other.m_next_chunk);
+    std::swap(m_max_chunk, other.m_max_chunk);
+    std::swap(m_reserved, other.m_reserved);
+}
+
+
+string_ref string_ref::copy_to(memory_resource & arena) const {
+    char_t * copy = static_cast<char_t*>( arena.allocate( (len + 1) * sizeof(char_t), alignof(char_t)) );
+    std::char_traits<char_t>::copy(copy, data, len);
+    copy[len] = 0;
+    return string_ref(copy, len);
+}
+
+bool operator<(const string_ref & a, const string_ref & b) {
+    int cmp = std::char_traits<char_t>::compare(a.data, b.data, std::min(a.len, b.len));
+    return cmp < 0 || (cmp == 0 && a.len < b.len);
+}
+
+}}
@@ -0,0 +1,183 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/memory_storage.h"
+#include <algorithm>
+
+namespace ss {
+
+    namespace {
+        const size_t INITIAL_SIZE = 64;
+
+        // converts a value to lower-case
+        string locase( const string & str) {
+            string lo;
+            lo.resize( str.length());
+            std::transform( str.begin(), str.end(), lo.begin(), tolower);
+            return lo;
+        }
+    }
+
+memory_storage::memory_storage() : m_infos(INITIAL_SIZE), m_used(0) {
+}
+
+memory_storage::memory_storage(const string & seed_buffer) : m_infos(INITIAL_SIZE), m_used(0) {
+    seed(seed_buffer);
+}
+
+memory_storage::~memory_storage() {
+}
+
+void memory_storage::seed(const string & buffer) {
+    istringstream in(buffer);
+    string line, name, value, comment;
+    typeinfo type;
+    while ( std::getline(in, line) ) {
+        if ( !detail::parse_setting_line(line, name, value, type, comment) )
+            continue; // comments are of no use to us
+        detail::trim(name);
+        name = locase(name);
+        info & dest = insert_info(name, hash_of(name.c_str(), name.size()) );
+        dest.value = value;
+        dest.type = type;
+    }
+}
+
+// FNV-1a
+size_t memory_storage::hash_of(const char_t * name, size_t len) {
+    size_t h = 2166136261u;
+    for ( size_t i = 0; i < len; ++i)
+        h = (h ^ (size_t)name[i]) * 16777619u;
+    return h;
+}
+
+const memory_storage::info * memory_storage::find_info(const char_t * name, size_t len, size_t hash) const {
+    size_t mask = m_infos.size() - 1;
+    for ( size_t idx = hash & mask; ; idx = (idx + 1) & mask) {
+        const info & cur = m_infos[idx];
+        if ( !cur.is_used())
+            return 0;
+        if ( cur.hash == hash && cur.name.size() == len && std::equal(name, name + len, cur.name.begin()) )
+            return &cur;
+    }
+}
+
+// returns the existing setting with this name, or a new (empty) one
+memory_storage::info & memory_storage::insert_info(const string & name, size_t hash) {
+    if ( const info * found = find_info(name.c_str(), name.size(), hash))
+        return const_cast<info&>(*found);
+
+    if ( (m_used + 1) * 2 > m_infos.size())
+        grow();
+
+    size_t mask = m_infos.size() - 1;
+    size_t idx = hash & mask;
+    while ( m_infos[idx].is_used())
+        idx = (idx + 1) & mask;
+
+    info & dest = m_infos[idx];
+    dest.hash = hash;
+    dest.name = name;
+    dest.type = typeid(variant);
+    dest.used = true;
+    ++m_used;
+    return dest;
+}
+
+void memory_storage::grow() {
+    std::vector<info> old( m_infos.size() * 2);
+    old.swap(m_infos);
+    size_t mask = m_infos.size() - 1;
+    for ( std::vector<info>::iterator b = old.begin(), e = old.end(); b != e; ++b) {
+        if ( !b->is_used())
+            continue;
+        size_t idx = b->hash & mask;
+        while ( m_infos[idx].is_used())
+            idx = (idx + 1) & mask;
+        std::swap( m_infos[idx], *b);
+    }
+}
+
+void memory_storage::save() {
+    // nothing to save - we live in memory only
+}
+
+bool memory_storage::find( const char_t * name, size_t name_len, string & value, typeinfo & type) const {
+    read_lock lk( storage_lock());
+    return find_unlocked(name, name_len, value, type);
+}
+
+bool memory_storage::find_unlocked( const char_t * name, size_t name_len, string & value, typeinfo & type) const {
+    const info * found = find_info(name, name_len, hash_of(name, name_len));
+    if ( !found)
+        return false;
+    value = found->value;
+    type = found->type;
+    return true;
+}
+
+// (do_find_setting() has already locked us, as the locking policy says)
+bool memory_storage::find_setting( const string & name, string & value, typeinfo & type) const {
+    return find_unlocked( name.c_str(), name.size(), value, type);
+}
+
+int memory_storage::size() const {
+    read_lock lk( storage_lock());
+    return (int)m_used;
+}
+
+void memory_storage::get_setting( const string & name, string & value, typeinfo& type) const {
+    const info * found = find_info(name.c_str(), name.size(), hash_of(name.c_str(), name.size()));
+    if ( found) {
+        value = found->value;
+        type = found->type;
+    }
+    else {
+        value.clear();
+        type = typeid(string);
+        bool has_default;
+        parent()->get_default_value( full_setting_name(name), value, type, has_default);
+        if ( !has_default)
+            set_error(err::bad_setting_name, TTEXT("cannot get setting ") + full_setting_name(name) );
+    }
+}
+
+void memory_storage::set_setting( const string & name, const string & value, const typeinfo& type) {
+    info & dest = insert_info(name, hash_of(name.c_str(), name.size()) );
+    dest.value = value;
+    dest.type = type;
+}
+
+void memory_storage::enum_settings( std::map<string,string> & values) const {
+    values.clear();
+    for ( std::vector<info>::const_iterator b = m_infos.begin(), e = m_infos.end(); b != e; ++b)
+        if ( b->is_used())
+            values[ b->name ] = b->value;
+}
+
+bool memory_storage::visit_settings( const string & prefix, const setting_visitor & visitor) const {
+    std::vector<const info*> found;
+    for ( std::vector<info>::const_iterator b = m_infos.begin(), e = m_infos.end(); b != e; ++b)
+        if ( b->is_used() && b->name.compare(0, prefix.size(), prefix) == 0)
+            found.push_back( &*b);
+    std::sort( found.begin(), found.end(), [](const info * a, const info * b) { return a->name < b->name; });
+    for ( std::vector<const info*>::const_iterator b = found.begin(), e = found.end(); b != e; ++b)
+        if ( !visitor( (*b)->name, (*b)->value, (*b)->type))
+            return false;
+    return true;
+}
+
+}
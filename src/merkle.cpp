@@ -0,0 +1,233 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/merkle.h"
+#include "ss/util.h"
+#include <type_traits>
+
+namespace ss {
+
+namespace {
+    // FNV-1a
+    unsigned long long hash_chars(unsigned long long h, const string & str) {
+        for ( string::const_iterator first = str.begin(), last = str.end(); first != last; ++first) {
+            h ^= (unsigned long long)(std::make_unsigned<char_t>::type)*first;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    // the hash of one setting. The bits are mixed well, since hashes are added up
+    unsigned long long setting_hash(const string & name, const string & value) {
+        unsigned long long h = hash_chars(14695981039346656037ull, name);
+        // (so that "a"="bc" and "ab"="c" differ)
+        h ^= 0xff;
+        h *= 1099511628211ull;
+        h = hash_chars(h, value);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// delta
+
+string write_delta(const settings_delta & changes) {
+    string out;
+    for ( settings_delta::const_iterator first = changes.begin(), last = changes.end(); first != last; ++first) {
+        if ( first->removed) {
+            out += '-';
+            out += first->name;
+        }
+        else {
+            out += first->name;
+            out += '=';
+            if ( first->type == typeid(bool))
+                out += (first->value != TTEXT("0")) ? TTEXT("true") : TTEXT("false");
+            else if ( first->type == typeid(long) || first->type == typeid(unsigned long) || first->type == typeid(double))
+                out += first->value;
+            else {
+                out += '"';
+                detail::append_escaped(out, first->value);
+                out += '"';
+            }
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+bool read_delta(const string & text, settings_delta & changes) {
+    changes.clear();
+    string line, comment;
+    setting_change change;
+    string::size_type begin = 0;
+    while ( begin < text.size()) {
+        string::size_type end = text.find('\n', begin);
+        if ( end == string::npos)
+            end = text.size();
+        line.assign(text, begin, end - begin);
+        begin = end + 1;
+        detail::trim(line);
+        if ( line.empty())
+            continue;
+        if ( line[0] == '-') {
+            change.name.assign(line, 1, string::npos);
+            change.value.erase();
+            change.type = typeid(string);
+            change.removed = true;
+        }
+        else {
+            if ( !detail::parse_setting_line(line, change.name, change.value, change.type, comment))
+                return false;
+            detail::trim(change.name);
+            change.removed = false;
+        }
+        changes.push_back(change);
+    }
+    return true;
+}
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////////
+// merkle_tree
+
+merkle_tree::node::~node() {
+    for ( std::map<string, node*>::iterator first = children.begin(), last = children.end(); first != last; ++first)
+        delete first->second;
+}
+
+merkle_tree::merkle_tree() : m_root(new node) {
+}
+
+merkle_tree::~merkle_tree() {
+    delete m_root;
+}
+
+void merkle_tree::clear() {
+    delete m_root;
+    m_root = new node;
+}
+
+unsigned long long merkle_tree::hash() const {
+    return m_root->hash;
+}
+
+void merkle_tree::set(const string & name, const string & value) {
+    // find (or add) the setting's node
+    node * cur = m_root;
+    string part;
+    for ( string::size_type begin = 0; ; ) {
+        string::size_type dot = name.find('.', begin);
+        part.assign(name, begin, dot == string::npos ? string::npos : dot - begin);
+        node *& child = cur->children[part];
+        if ( !child)
+            child = new node;
+        cur = child;
+        if ( dot == string::npos)
+            break;
+        begin = dot + 1;
+    }
+
+    unsigned long long h = setting_hash(name, value);
+    // (unsigned arithmetic wraps around - adding the difference works either way)
+    unsigned long long delta = h - (cur->has_value ? cur->own : 0);
+    cur->own = h;
+    cur->has_value = true;
+    if ( !delta)
+        return;
+
+    // ... and add the difference to each node on the way to it
+    cur = m_root;
+    cur->hash += delta;
+    for ( string::size_type begin = 0; ; ) {
+        string::size_type dot = name.find('.', begin);
+        part.assign(name, begin, dot == string::npos ? string::npos : dot - begin);
+        cur = cur->children[part];
+        cur->hash += delta;
+        if ( dot == string::npos)
+            break;
+        begin = dot + 1;
+    }
+}
+
+void merkle_tree::append_path(string & path, const string & part) {
+    if ( !path.empty())
+        path += '.';
+    path += part;
+}
+
+void merkle_tree::diff(const merkle_tree & left, const merkle_tree & right, std::vector< std::pair<string,difference> > & names) {
+    names.clear();
+    string path;
+    diff( *left.m_root, *right.m_root, path, names);
+}
+
+void merkle_tree::diff(const node & left, const node & right, string & path, std::vector< std::pair<string,difference> > & names) {
+    if ( left.hash == right.hash)
+        return;
+    if ( left.has_value != right.has_value || left.own != right.own) {
+        if ( !left.has_value)
+            names.push_back( std::make_pair(path, only_right));
+        else if ( !right.has_value)
+            names.push_back( std::make_pair(path, only_left));
+        else
+            names.push_back( std::make_pair(path, changed));
+    }
+
+    // both are sorted by name - walk them side by side
+    size_t path_len = path.size();
+    std::map<string, node*>::const_iterator l = left.children.begin(), l_end = left.children.end();
+    std::map<string, node*>::const_iterator r = right.children.begin(), r_end = right.children.end();
+    while ( l != l_end || r != r_end) {
+        if ( r == r_end || (l != l_end && l->first < r->first)) {
+            append_path(path, l->first);
+            add_all( *l->second, path, only_left, names);
+            ++l;
+        }
+        else if ( l == l_end || r->first < l->first) {
+            append_path(path, r->first);
+            add_all( *r->second, path, only_right, names);
+            ++r;
+        }
+        else {
+            if ( l->second->hash != r->second->hash) {
+                append_path(path, l->first);
+                diff( *l->second, *r->second, path, names);
+            }
+            ++l;
+            ++r;
+        }
+        path.resize(path_len);
+    }
+}
+
+void merkle_tree::add_all(const node & n, string & path, difference diff, std::vector< std::pair<string,difference> > & names) {
+    if ( n.has_value)
+        names.push_back( std::make_pair(path, diff));
+    size_t path_len = path.size();
+    for ( std::map<string, node*>::const_iterator first = n.children.begin(), last = n.children.end(); first != last; ++first) {
+        append_path(path, first->first);
+        add_all( *first->second, path, diff, names);
+        path.resize(path_len);
+    }
+}
+
+}}
@@ -0,0 +1,102 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/read_cache.h"
+
+namespace ss { namespace detail {
+
+std::atomic<unsigned long long> g_read_cache_epoch(1);
+
+namespace {
+    // how many settings a thread caches, at most. When full, we start over
+    const size_t MAX_ENTRIES = 4096;
+    const size_t TABLE_SIZE = MAX_ENTRIES * 2;
+
+    inline size_t hash_combine(size_t seed, size_t value) {
+        return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+    }
+
+    // FNV-1a
+    inline size_t hash_string(const string & str) {
+        size_t h = 2166136261u;
+        for ( string::const_iterator b = str.begin(), e = str.end(); b != e; ++b)
+            h = (h ^ (size_t)*b) * 16777619u;
+        return h;
+    }
+}
+
+read_cache::read_cache() : m_entries(TABLE_SIZE), m_used(0) {
+}
+
+read_cache::~read_cache() {
+    for ( size_t i = 0; i < m_entries.size(); ++i)
+        delete m_entries[i].value;
+}
+
+read_cache & read_cache::this_thread() {
+    static thread_local read_cache cache;
+    return cache;
+}
+
+size_t read_cache::hash_of(const configuration * conf, const string & place, const string & name, const std::type_info & type) {
+    size_t h = hash_string(name);
+    h = hash_combine(h, hash_string(place));
+    h = hash_combine(h, (size_t)conf);
+    h = hash_combine(h, (size_t)&type);
+    return h;
+}
+
+const read_cache::entry * read_cache::find_entry(const configuration * conf, const string & place, const string & name, const std::type_info & type) const {
+    size_t h = hash_of(conf, place, name, type);
+    size_t mask = m_entries.size() - 1;
+    for ( size_t idx = h & mask; ; idx = (idx + 1) & mask) {
+        const entry & e = m_entries[idx];
+        if ( !e.value)
+            return 0;
+        if ( e.hash == h && e.conf == conf && e.type == &type && e.name == name && e.place == place)
+            return (e.epoch == read_cache_epoch()) ? &e : 0;
+    }
+}
+
+read_cache::entry & read_cache::slot_for(const configuration * conf, const string & place, const string & name, const std::type_info & type) {
+    size_t h = hash_of(conf, place, name, type);
+    size_t mask = m_entries.size() - 1;
+    for ( size_t idx = h & mask; ; idx = (idx + 1) & mask) {
+        entry & e = m_entries[idx];
+        if ( e.value && e.hash == h && e.conf == conf && e.type == &type && e.name == name && e.place == place)
+            // existing (stale) entry
+            return e;
+        if ( !e.value) {
+            if ( m_used >= MAX_ENTRIES) {
+                // full - forget everything, and start over
+                for ( size_t i = 0; i < m_entries.size(); ++i) {
+                    delete m_entries[i].value;
+                    m_entries[i] = entry();
+                }
+                m_used = 0;
+                return slot_for(conf, place, name, type);
+            }
+            ++m_used;
+            e.hash = h;
+            e.conf = conf;
+            e.type = &type;
+            e.place = place;
+            e.name = name;
+            return e;
+        }
+    }
+}
+
+}}
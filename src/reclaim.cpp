@@ -0,0 +1,166 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/reclaim.h"
+#include <thread>
+#include <vector>
+
+namespace ss { namespace detail {
+
+namespace {
+
+    // one per thread that ever read lock-free; never freed, but reused once its thread ends
+    struct reader_slot {
+        reader_slot() : active(0), in_use(true), next(0) {}
+        // the epoch at which the thread entered its (outermost) guard; 0 = not reading
+        std::atomic<unsigned long long> active;
+        std::atomic<bool> in_use;
+        reader_slot * next;
+        // keep each slot on its own cache line
+        char pad[64];
+    };
+
+    struct retired_node {
+        void * p;
+        retire_func deleter;
+        unsigned long long epoch;
+    };
+
+    struct reclaimer {
+        reclaimer() : epoch(1), slots(0) {}
+
+        std::atomic<unsigned long long> epoch;
+        std::atomic<reader_slot*> slots;
+
+        critical_section cs;
+        std::vector<retired_node> retired;
+
+        static reclaimer & get() {
+            // never destroyed - readers/writers might still be around at exit
+            static reclaimer * r = new reclaimer;
+            return *r;
+        }
+
+        reader_slot * acquire_slot() {
+            for ( reader_slot * s = slots.load(std::memory_order_acquire); s; s = s->next) {
+                bool expected = false;
+                if ( !s->in_use.load(std::memory_order_relaxed) && s->in_use.compare_exchange_strong(expected, true))
+                    return s;
+            }
+            reader_slot * s = new reader_slot;
+            reader_slot * head = slots.load(std::memory_order_relaxed);
+            do {
+                s->next = head;
+            } while ( !slots.compare_exchange_weak(head, s, std::memory_order_release, std::memory_order_relaxed));
+            return s;
+        }
+
+        // the oldest epoch a reader might still be in (or ~0 if there are no readers)
+        unsigned long long oldest_active(const reader_slot * except = 0) {
+            unsigned long long oldest = ~0ULL;
+            for ( reader_slot * s = slots.load(std::memory_order_acquire); s; s = s->next) {
+                if ( s == except)
+                    continue;
+                unsigned long long e = s->active.load(std::memory_order_acquire);
+                if ( e && e < oldest)
+                    oldest = e;
+            }
+            return oldest;
+        }
+
+        // note: cs must be locked
+        void reclaim() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            unsigned long long oldest = oldest_active();
+            size_t kept = 0;
+            for ( size_t i = 0; i < retired.size(); ++i) {
+                // a reader that entered at an epoch > the retire epoch cannot have seen the node
+                if ( retired[i].epoch < oldest)
+                    retired[i].deleter( retired[i].p);
+                else
+                    retired[kept++] = retired[i];
+            }
+            retired.resize(kept);
+        }
+    };
+
+    struct thread_reader {
+        thread_reader() : slot(0), depth(0) {}
+        ~thread_reader() {
+            if ( slot) {
+                slot->active.store(0, std::memory_order_release);
+                slot->in_use.store(false, std::memory_order_release);
+            }
+        }
+        reader_slot * slot;
+        int depth;
+    };
+
+    thread_local thread_reader t_reader;
+
+    void enter_guard() {
+        thread_reader & r = t_reader;
+        if ( r.depth++ > 0)
+            return;
+        if ( !r.slot)
+            r.slot = reclaimer::get().acquire_slot();
+        r.slot->active.store( reclaimer::get().epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        // our slot must be visible before we read any shared node
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+read_guard::read_guard() : m_active(true) {
+    enter_guard();
+}
+
+read_guard::read_guard(bool active) : m_active(active) {
+    if ( active)
+        enter_guard();
+}
+
+read_guard::~read_guard() {
+    if ( !m_active)
+        return;
+    thread_reader & r = t_reader;
+    if ( --r.depth == 0)
+        r.slot->active.store(0, std::memory_order_release);
+}
+
+void retire(void * p, retire_func deleter) {
+    reclaimer & r = reclaimer::get();
+    scoped_lock lk(r.cs);
+    retired_node node;
+    node.p = p;
+    node.deleter = deleter;
+    // the node is already unlinked - readers that start from now on can't find it
+    node.epoch = r.epoch.fetch_add(1);
+    r.retired.push_back(node);
+    if ( r.retired.size() >= 64)
+        r.reclaim();
+}
+
+void wait_for_readers() {
+    reclaimer & r = reclaimer::get();
+    // readers that enter from now on, can't see what was unlinked
+    unsigned long long epoch = r.epoch.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // (if we're inside a guard ourselves, we don't wait for us)
+    const reader_slot * mine = t_reader.depth > 0 ? t_reader.slot : 0;
+    while ( r.oldest_active(mine) <= epoch)
+        std::this_thread::yield();
+}
+
+}}
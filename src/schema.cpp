@@ -0,0 +1,318 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/setting_storage.h"
+#include "ss/settings_table.h"
+#include "ss/reclaim.h"
+#include "ss/util.h"
+#include <algorithm>
+
+namespace ss {
+
+namespace {
+    // converts a value to lower-case
+    string locase( const string & str) {
+        string lo;
+        lo.resize( str.length());
+        std::transform( str.begin(), str.end(), lo.begin(), tolower);
+        return lo;
+    }
+
+    // the whole value needs to be a number (surrounding spaces are ok)
+    template<class type> bool parse_number(const string & value, type & val) {
+        istringstream in( value);
+        in >> val;
+        if ( in.fail() )
+            return false;
+        in >> std::ws;
+        return in.eof();
+    }
+
+    // a typed_value is kept in the settings_table as raw characters (one byte per character)
+    enum { TYPED_LEN = sizeof(double) > sizeof(long) ? sizeof(double) : sizeof(long) };
+
+    string encode( const typed_value & typed) {
+        const unsigned char * raw = reinterpret_cast<const unsigned char*>(&typed.as_long);
+        string encoded( TYPED_LEN, 0);
+        for ( size_t idx = 0; idx < TYPED_LEN; ++idx)
+            encoded[idx] = (char_t)raw[idx];
+        return encoded;
+    }
+
+    bool decode( const string & encoded, unsigned char code, typed_value & typed) {
+        if ( code == 0 || encoded.size() != TYPED_LEN)
+            return false;
+        unsigned char * raw = reinterpret_cast<unsigned char*>(&typed.as_long);
+        for ( size_t idx = 0; idx < TYPED_LEN; ++idx)
+            raw[idx] = (unsigned char)encoded[idx];
+        typed.code = code;
+        return true;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// schema
+
+schema::rule & schema::add_rule(const string & pattern, const typeinfo & type) {
+    rule r;
+    r.pattern = locase(pattern);
+    r.code = detail::settings_table::type_code( detail::friendly_type(type));
+    m_rules.push_back(r);
+    size_t idx = m_rules.size() - 1;
+    // "prefix.*" -> "prefix."
+    if ( r.pattern.size() >= 2 && r.pattern.compare( r.pattern.size() - 2, 2, TTEXT(".*")) == 0)
+        m_prefixes[ r.pattern.substr(0, r.pattern.size() - 1) ] = idx;
+    else
+        m_exact[ r.pattern] = idx;
+    return m_rules.back();
+}
+
+schema & schema::add(const string & pattern, const typeinfo & type) {
+    add_rule(pattern, type);
+    return *this;
+}
+
+schema & schema::add(const string & pattern, const typeinfo & type, double min_value, double max_value) {
+    rule & r = add_rule(pattern, type);
+    r.has_range = true;
+    r.min_value = min_value;
+    r.max_value = max_value;
+    return *this;
+}
+
+schema & schema::add_enum(const string & pattern, const string & domain) {
+    rule & r = add_rule(pattern, typeid(string));
+    string::size_type begin = 0;
+    while ( true) {
+        string::size_type end = domain.find('|', begin);
+        r.domain.push_back( domain.substr(begin, end == string::npos ? string::npos : end - begin) );
+        if ( end == string::npos)
+            break;
+        begin = end + 1;
+    }
+    return *this;
+}
+
+const schema::rule * schema::find(const string & name) const {
+    string lo_name = locase(name);
+    std::map<string, size_t>::const_iterator found = m_exact.find(lo_name);
+    if ( found != m_exact.end() )
+        return &m_rules[found->second];
+    // the longest prefix wins
+    for ( string::size_type dot = lo_name.rfind('.'); dot != string::npos && dot > 0; dot = lo_name.rfind('.', dot - 1) ) {
+        found = m_prefixes.find( lo_name.substr(0, dot + 1) );
+        if ( found != m_prefixes.end() )
+            return &m_rules[found->second];
+    }
+    return 0;
+}
+
+bool schema::check(const string & name, const string & value, typed_value & typed, string & error) const {
+    typed = typed_value();
+    const rule * r = find(name);
+    if ( !r)
+        return true;
+
+    bool ok = true;
+    double number = 0;
+    switch ( r->code) {
+    case 1: {
+        string lo = locase(value);
+        detail::trim(lo);
+        if ( lo == TTEXT("1") || lo == TTEXT("true"))
+            typed.as_bool = true;
+        else if ( lo == TTEXT("0") || lo == TTEXT("false"))
+            typed.as_bool = false;
+        else
+            ok = false;
+        break;
+    }
+    case 2:
+        ok = parse_number(value, typed.as_long);
+        number = (double)typed.as_long;
+        break;
+    case 3:
+        // (the stream would happily wrap a negative number around)
+        ok = value.find('-') == string::npos && parse_number(value, typed.as_ulong);
+        number = (double)typed.as_ulong;
+        break;
+    case 4:
+        ok = parse_number(value, typed.as_double);
+        number = typed.as_double;
+        break;
+    default:
+        if ( !r->domain.empty())
+            ok = std::find( r->domain.begin(), r->domain.end(), value) != r->domain.end();
+        break;
+    }
+    if ( ok && r->has_range && (number < r->min_value || number > r->max_value) )
+        ok = false;
+
+    if ( !ok) {
+        typed = typed_value();
+        error = TTEXT("invalid value for ") + name + TTEXT(": ") + value;
+        return false;
+    }
+    if ( r->code >= 1 && r->code <= 4)
+        typed.code = r->code;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// setting_storage - the schema part
+
+bool setting_storage::check_setting(const string & name, const string & value, typed_value & typed) const {
+    configuration * conf = parent();
+    const schema * s = conf ? conf->get_schema() : 0;
+    if ( !s)
+        return true;
+    string error;
+    if ( s->check( full_setting_name(name), value, typed, error) )
+        return true;
+    set_error(err::invalid_setting, error);
+    return false;
+}
+
+void setting_storage::set_typed(const string & name, const typed_value & typed) const {
+    detail::read_guard guard;
+    scoped_lock lk(m_typed_cs);
+    // (see keep_typed)
+    m_typed_sets.fetch_add(1, std::memory_order_relaxed);
+    detail::settings_table * table = m_typed.load(std::memory_order_acquire);
+    if ( !table) {
+        if ( !typed.code)
+            // nothing to remember
+            return;
+        table = new detail::settings_table;
+        m_typed.store(table, std::memory_order_release);
+    }
+
+    // note: code 0 (not converted) overwrites whatever we had for it
+    typeinfo type = detail::settings_table::code_type(typed.code);
+    string encoded = encode(typed);
+    int key = table->find( name.c_str(), name.size());
+    if ( key < 0) {
+        bool inserted;
+        key = table->insert(name, encoded, type, inserted);
+        if ( inserted)
+            return;
+    }
+    table->set(key, encoded, type);
+}
+
+void setting_storage::set_current_typed(const string & name, const string & value, const typed_value & typed) const {
+    // two threads setting the same setting could otherwise keep their converted values in the opposite order
+    // than their values were set. Whoever gets here last sees the last value set
+    scoped_lock lk(m_typed_cs);
+    string cur;
+    typeinfo type;
+    if ( !find_setting(name, cur, type)) {
+        set_typed(name, typed_value());
+        return;
+    }
+    if ( cur == value) {
+        set_typed(name, typed);
+        return;
+    }
+    typed_value cur_typed;
+    if ( !check_setting(name, cur, cur_typed))
+        cur_typed = typed_value();
+    set_typed(name, cur_typed);
+}
+
+bool setting_storage::do_get_typed(const string & name, typed_value & typed) const {
+    detail::read_guard guard;
+    const detail::settings_table * table = m_typed.load(std::memory_order_acquire);
+    if ( !table)
+        return false;
+    string encoded;
+    typeinfo type;
+    if ( !table->get(name, encoded, type))
+        return false;
+    return decode( encoded, detail::settings_table::type_code(type), typed);
+}
+
+bool setting_storage::validate() {
+    if ( !parent() || !parent()->get_schema())
+        return true;
+    std::map<string,string> values;
+    for ( int tries = 0; ; ++tries) {
+        unsigned long sets_before = m_typed_sets.load(std::memory_order_acquire);
+        do_enum_settings(values);
+        detail::settings_table * fresh = new detail::settings_table;
+        if ( !convert_all(values, *fresh)) {
+            delete fresh;
+            return false;
+        }
+        // a setting was set while we were enumerating - what we have might be stale already
+        if ( keep_typed(fresh, sets_before))
+            return true;
+        if ( tries == MAX_VALIDATE_TRIES) {
+            // sets keep coming - drop the converted values; they're converted again as they're set
+            keep_typed(0, m_typed_sets.load(std::memory_order_acquire));
+            return true;
+        }
+    }
+}
+
+bool setting_storage::validate(const std::map<string,string> & values) const {
+    if ( !parent() || !parent()->get_schema())
+        return true;
+    detail::settings_table * fresh = new detail::settings_table;
+    if ( !convert_all(values, *fresh)) {
+        delete fresh;
+        return false;
+    }
+    keep_typed(fresh, m_typed_sets.load(std::memory_order_acquire));
+    return true;
+}
+
+// checks all values (reporting each invalid one), and converts them into 'table'
+bool setting_storage::convert_all(const std::map<string,string> & values, detail::settings_table & table) const {
+    bool valid = true;
+    typed_value typed;
+    for ( std::map<string,string>::const_iterator first = values.begin(), last = values.end(); first != last; ++first) {
+        if ( !check_setting(first->first, first->second, typed)) {
+            valid = false;
+            continue;
+        }
+        if ( typed.code) {
+            bool inserted;
+            table.insert( first->first, encode(typed), detail::settings_table::code_type(typed.code), inserted);
+        }
+    }
+    return valid;
+}
+
+// replaces the converted values - unless a value was set (set_typed) since we read the values
+bool setting_storage::keep_typed(detail::settings_table * fresh, unsigned long sets_before) const {
+    scoped_lock lk(m_typed_cs);
+    if ( m_typed_sets.load(std::memory_order_relaxed) != sets_before) {
+        delete fresh;
+        return false;
+    }
+    detail::settings_table * old = m_typed.exchange(fresh, std::memory_order_acq_rel);
+    if ( old)
+        // other threads might still be reading it
+        detail::retire(old, delete_typed);
+    return true;
+}
+
+void setting_storage::delete_typed(void * p) {
+    delete static_cast<detail::settings_table*>(p);
+}
+
+}
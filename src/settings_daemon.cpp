@@ -0,0 +1,231 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/setting_storage.h"
+#include "ss/settings_daemon.h"
+#include "ss/memory_storage.h"
+#include "ss/util.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ss {
+
+namespace {
+    // a client that doesn't take what we send for this long, is dropped
+    const int SEND_TIMEOUT_MS = 2000;
+
+    // what we send/receive is UTF-8
+    inline void assign_chars(std::string & dest, const std::string & src) { dest = src; }
+    inline void assign_chars(std::wstring & dest, const std::string & src) { dest = detail::widen(src); }
+}
+
+namespace protocol = detail::socket_protocol;
+
+settings_daemon::settings_daemon(configuration & conf, const std::string & socket_path)
+        : m_conf(conf), m_path(socket_path), m_listen(-1), m_stop(false), m_publish_pending(false), m_client_count(0) {
+    m_wake[0] = m_wake[1] = -1;
+    m_published.add_storage( string(), new memory_storage);
+}
+
+settings_daemon::~settings_daemon() {
+    stop();
+}
+
+bool settings_daemon::start() {
+    if ( m_listen >= 0)
+        return true;
+    if ( ::pipe(m_wake) != 0)
+        return false;
+    m_listen = protocol::listen_to(m_path);
+    if ( m_listen < 0) {
+        ::close(m_wake[0]);
+        ::close(m_wake[1]);
+        m_wake[0] = m_wake[1] = -1;
+        return false;
+    }
+    m_stop = false;
+    // (what the first clients get, is what we have now)
+    do_publish();
+    m_thread = std::thread( &settings_daemon::run, this);
+    return true;
+}
+
+void settings_daemon::stop() {
+    if ( m_listen < 0)
+        return;
+    m_stop = true;
+    wake();
+    if ( m_thread.joinable())
+        m_thread.join();
+    drop_all();
+    protocol::close_socket(m_listen);
+    ::unlink( m_path.c_str());
+    ::close(m_wake[0]);
+    ::close(m_wake[1]);
+    m_listen = -1;
+    m_wake[0] = m_wake[1] = -1;
+}
+
+void settings_daemon::publish() {
+    m_publish_pending = true;
+    wake();
+}
+
+void settings_daemon::wake() {
+    if ( m_wake[1] < 0)
+        return;
+    char ch = 0;
+    while ( ::write(m_wake[1], &ch, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void settings_daemon::run() {
+    std::vector<pollfd> fds;
+    while ( !m_stop) {
+        fds.clear();
+        pollfd p;
+        p.events = POLLIN;
+        p.revents = 0;
+        p.fd = m_listen;
+        fds.push_back(p);
+        p.fd = m_wake[0];
+        fds.push_back(p);
+        for ( size_t idx = 0; idx < m_clients.size(); ++idx) {
+            p.fd = m_clients[idx]->fd;
+            fds.push_back(p);
+        }
+        if ( ::poll( &fds[0], fds.size(), -1) < 0) {
+            if ( errno == EINTR)
+                continue;
+            break;
+        }
+
+        if ( fds[1].revents) {
+            char buff[ 64];
+            ssize_t ignore = ::read(m_wake[0], buff, sizeof(buff));
+            (void)ignore;
+        }
+        // (the clients we poll are the first ones - any new client is added at the end)
+        for ( size_t idx = 0; idx + 2 < fds.size(); ++idx) {
+            client & c = *m_clients[idx];
+            if ( fds[idx + 2].revents && !c.dead && !on_readable(c))
+                c.dead = true;
+        }
+        if ( fds[0].revents)
+            accept_client();
+        if ( m_publish_pending.exchange(false))
+            do_publish();
+        remove_dead();
+    }
+}
+
+void settings_daemon::accept_client() {
+    int fd;
+    while ( (fd = ::accept(m_listen, 0, 0)) < 0 && errno == EINTR)
+        ;
+    if ( fd < 0)
+        return;
+    protocol::set_send_timeout(fd, SEND_TIMEOUT_MS);
+    m_clients.push_back( new client(fd));
+    m_client_count = (int)m_clients.size();
+}
+
+bool settings_daemon::on_readable(client & c) {
+    if ( !c.reader.read_some(c.fd))
+        return false;
+    std::string verb, payload;
+    bool bad;
+    while ( c.reader.next(verb, payload, bad)) {
+        if ( verb == protocol::SYNC) {
+            // whatever changed meanwhile, the others get it as a delta - this client gets it in the snapshot
+            do_publish();
+            settings_delta all;
+            setting_change change;
+            m_published.visit_settings( string(), [&](const string & name, const string & value, const typeinfo & type) {
+                change.name = name;
+                change.value = value;
+                change.type = type;
+                all.push_back(change);
+                return true;
+            });
+            if ( !protocol::send_frame(c.fd, protocol::SNAPSHOT, detail::narrow( write_delta(all))))
+                return false;
+            c.synced = true;
+        }
+        else if ( verb == protocol::SET) {
+            settings_delta changes;
+            string text;
+            assign_chars(text, payload);
+            if ( !read_delta(text, changes))
+                return false;
+            // all at once, then everybody gets them (the sender too - that's how it knows they were applied)
+            m_conf.apply(changes);
+            do_publish();
+        }
+        else
+            return false;
+    }
+    return !bad;
+}
+
+// pushes what changed since we last published
+void settings_daemon::do_publish() {
+    settings_delta changes;
+    m_published.diff(m_conf, changes);
+    settings_delta pushed;
+    for ( settings_delta::const_iterator first = changes.begin(), last = changes.end(); first != last; ++first)
+        // (storages can't remove settings - neither can the clients)
+        if ( !first->removed)
+            pushed.push_back(*first);
+    if ( pushed.empty())
+        return;
+    m_published.apply(pushed);
+
+    std::string payload = detail::narrow( write_delta(pushed));
+    for ( size_t idx = 0; idx < m_clients.size(); ++idx) {
+        client & c = *m_clients[idx];
+        if ( c.synced && !c.dead && !protocol::send_frame(c.fd, protocol::DELTA, payload))
+            c.dead = true;
+    }
+}
+
+void settings_daemon::remove_dead() {
+    std::vector<client*> alive;
+    for ( size_t idx = 0; idx < m_clients.size(); ++idx) {
+        client * c = m_clients[idx];
+        if ( c->dead) {
+            protocol::close_socket(c->fd);
+            delete c;
+        }
+        else
+            alive.push_back(c);
+    }
+    m_clients.swap(alive);
+    m_client_count = (int)m_clients.size();
+}
+
+void settings_daemon::drop_all() {
+    for ( size_t idx = 0; idx < m_clients.size(); ++idx) {
+        protocol::close_socket(m_clients[idx]->fd);
+        delete m_clients[idx];
+    }
+    m_clients.clear();
+    m_client_count = 0;
+}
+
+}
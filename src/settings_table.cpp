@@ -0,0 +1,414 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/settings_table.h"
+#include <algorithm>
+#include <string.h>
+
+namespace ss { namespace detail {
+
+namespace {
+    const size_t INITIAL_INDEX_SIZE = 64;
+    const size_t INITIAL_DIRECTORY_SIZE = 16;
+    // compact a stripe once it has this much garbage (and more garbage than live values)
+    const size_t MIN_GARBAGE_TO_COMPACT = 64 * 1024;
+
+    inline size_t blob_payload(size_t len) {
+        return len * sizeof(char_t);
+    }
+}
+
+
+settings_table::blob * settings_table::new_blob(monotonic_arena & arena, const char_t * data, size_t len, unsigned char type) {
+    blob * b = static_cast<blob*>( arena.allocate( sizeof(blob) + blob_payload(len), alignof(blob)) );
+    b->len = (unsigned int)len;
+    b->type = type;
+    b->changed = 0;
+    if ( len)
+        memcpy( b->data(), data, blob_payload(len));
+    return b;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// directory & index
+
+settings_table::directory::directory(size_t capacity) : capacity(capacity), segments(new std::atomic<segment*>[capacity]) {
+    for ( size_t i = 0; i < capacity; ++i)
+        segments[i].store(0, std::memory_order_relaxed);
+}
+
+settings_table::directory::~directory() {
+    delete[] segments;
+}
+
+settings_table::index::index(size_t size) : mask(size - 1), slots(new std::atomic<unsigned long long>[size]) {
+    for ( size_t i = 0; i < size; ++i)
+        slots[i].store(0, std::memory_order_relaxed);
+}
+
+settings_table::index::~index() {
+    delete[] slots;
+}
+
+void settings_table::delete_directory(void * p) {
+    delete static_cast<directory*>(p);
+}
+
+void settings_table::delete_index(void * p) {
+    delete static_cast<index*>(p);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// settings_table
+
+settings_table::settings_table() : m_directory(0), m_index(0), m_size(0), m_valued(0), m_name_bytes(0) {
+    name_lock(m_insert_cs, "storage index");
+    init();
+}
+
+settings_table::~settings_table() {
+    destroy();
+}
+
+void settings_table::init() {
+    m_directory.store( new directory(INITIAL_DIRECTORY_SIZE));
+    m_index.store( new index(INITIAL_INDEX_SIZE));
+    m_size.store(0);
+    m_valued.store(0);
+    m_name_bytes = 0;
+}
+
+void settings_table::destroy() {
+    directory * dir = m_directory.load();
+    for ( size_t i = 0; i < dir->capacity; ++i)
+        delete dir->segments[i].load();
+    delete dir;
+    delete m_index.load();
+
+    m_names.release();
+    for ( int i = 0; i < STRIPES; ++i) {
+        m_stripes[i].values.release();
+        m_stripes[i].changed.clear();
+        m_stripes[i].live_bytes = 0;
+        m_stripes[i].garbage_bytes = 0;
+    }
+}
+
+void settings_table::clear() {
+    destroy();
+    init();
+}
+
+void settings_table::set_memory_resource(memory_resource * res) {
+    {
+    scoped_lock lk(m_insert_cs);
+    m_names.upstream(res);
+    }
+    for ( int i = 0; i < STRIPES; ++i) {
+        scoped_lock lk(m_stripes[i].cs);
+        m_stripes[i].values.upstream(res);
+    }
+}
+
+// FNV-1a
+size_t settings_table::hash_of(const char_t * name, size_t len) {
+    size_t h = 2166136261u;
+    for ( size_t i = 0; i < len; ++i)
+        h = (h ^ (size_t)name[i]) * 16777619u;
+    return h;
+}
+
+bool settings_table::equal(const blob & b, const char_t * data, size_t len) {
+    return b.len == len && std::equal(data, data + len, b.data());
+}
+
+unsigned char settings_table::type_code(const typeinfo & type) {
+    if ( type == typeid(string)) return 0;
+    if ( type == typeid(bool)) return 1;
+    if ( type == typeid(long)) return 2;
+    if ( type == typeid(unsigned long)) return 3;
+    if ( type == typeid(double)) return 4;
+    return 5; // variant, or unknown
+}
+
+typeinfo settings_table::code_type(unsigned char code) {
+    switch ( code) {
+    case 0: return typeid(string);
+    case 1: return typeid(bool);
+    case 2: return typeid(long);
+    case 3: return typeid(unsigned long);
+    case 4: return typeid(double);
+    default: return typeid(variant);
+    }
+}
+
+// note: call it within a read_guard (or with m_insert_cs locked)
+const settings_table::record & settings_table::rec(int key) const {
+    directory * dir = m_directory.load(std::memory_order_acquire);
+    segment * seg = dir->segments[ key / SEGMENT_SIZE ].load(std::memory_order_acquire);
+    return seg->records[ key % SEGMENT_SIZE ];
+}
+
+settings_table::record & settings_table::rec(int key) {
+    return const_cast<record&>( static_cast<const settings_table*>(this)->rec(key) );
+}
+
+// note: call it within a read_guard
+int settings_table::find(const char_t * name, size_t len, size_t hash) const {
+    const index & idx = *m_index.load(std::memory_order_acquire);
+    unsigned long long tag = (unsigned long long)(unsigned int)hash;
+    for ( size_t i = (size_t)tag & idx.mask; ; i = (i + 1) & idx.mask) {
+        unsigned long long slot = idx.slots[i].load(std::memory_order_acquire);
+        if ( !slot)
+            return -1;
+        if ( (slot >> 32) == tag) {
+            int key = (int)(slot & 0xFFFFFFFFULL) - 1;
+            if ( equal( *rec(key).name, name, len))
+                return key;
+        }
+    }
+}
+
+int settings_table::find(const char_t * name, size_t len) const {
+    read_guard guard;
+    return find(name, len, hash_of(name, len));
+}
+
+bool settings_table::get(const string & name, string & value, typeinfo & type) const {
+    read_guard guard;
+    int key = find(name.c_str(), name.size(), hash_of(name.c_str(), name.size()));
+    if ( key < 0)
+        return false;
+    const blob * v = rec(key).value.load(std::memory_order_acquire);
+    if ( v->type == REMOVED)
+        return false;
+    value.assign( v->data(), v->len);
+    type = code_type(v->type);
+    return true;
+}
+
+void settings_table::get(int key, string & value, typeinfo & type) const {
+    read_guard guard;
+    const blob * v = rec(key).value.load(std::memory_order_acquire);
+    value.assign( v->data(), v->len);
+    type = code_type(v->type);
+}
+
+bool settings_table::is_removed(int key) const {
+    read_guard guard;
+    return rec(key).value.load(std::memory_order_acquire)->type == REMOVED;
+}
+
+const char_t * settings_table::name(int key, size_t & len) const {
+    read_guard guard;
+    const blob * n = rec(key).name;
+    len = n->len;
+    return n->data();
+}
+
+string settings_table::name(int key) const {
+    size_t len;
+    const char_t * data = name(key, len);
+    return string(data, len);
+}
+
+bool settings_table::set(int key, const string & value) {
+    const blob * cur;
+    {
+    read_guard guard;
+    cur = rec(key).value.load(std::memory_order_acquire);
+    // the type of a setting never changes, unless explicitly set
+    if ( cur->type != REMOVED && equal(*cur, value.c_str(), value.size()))
+        return false;
+    }
+    return set_impl(key, value.c_str(), value.size(), 0xFF, false);
+}
+
+bool settings_table::set(int key, const string & value, const typeinfo & type) {
+    return set_impl(key, value.c_str(), value.size(), type_code(type), false);
+}
+
+bool settings_table::set_loaded(int key, const string & value, const typeinfo & type) {
+    return set_impl(key, value.c_str(), value.size(), type_code(type), true);
+}
+
+bool settings_table::remove_loaded(int key) {
+    return set_impl(key, 0, 0, REMOVED, true);
+}
+
+// type = 0xFF -> keep existing type
+bool settings_table::set_impl(int key, const char_t * value, size_t len, unsigned char type, bool loaded) {
+    stripe & s = m_stripes[ key % STRIPES ];
+    scoped_lock lk(s.cs);
+    read_guard guard;
+    record & r = rec(key);
+    const blob * cur = r.value.load(std::memory_order_relaxed);
+    if ( loaded && cur->changed)
+        // the value set here wins over the one that was read
+        return false;
+    if ( type == 0xFF)
+        // (a removed setting that's set again, is a string)
+        type = cur->type != REMOVED ? cur->type : type_code(typeid(string));
+    if ( cur->type == type && equal(*cur, value, len))
+        return false;
+
+    blob * changed = new_blob(s.values, value, len, type);
+    changed->changed = loaded ? 0 : 1;
+    if ( !cur->changed && !loaded)
+        s.changed.push_back(key);
+    r.value.store( changed, std::memory_order_release);
+    s.live_bytes += blob_payload(len);
+    s.live_bytes -= blob_payload(cur->len);
+    s.garbage_bytes += sizeof(blob) + blob_payload(cur->len);
+    if ( s.garbage_bytes >= MIN_GARBAGE_TO_COMPACT && s.garbage_bytes > s.live_bytes)
+        compact( key % STRIPES);
+    return true;
+}
+
+void settings_table::take_changed(std::vector<int> & keys) {
+    read_guard guard;
+    for ( int i = 0; i < STRIPES; ++i) {
+        stripe & s = m_stripes[i];
+        scoped_lock lk(s.cs);
+        for ( size_t idx = 0; idx < s.changed.size(); ++idx)
+            const_cast<blob*>( rec(s.changed[idx]).value.load(std::memory_order_relaxed) )->changed = 0;
+        keys.insert( keys.end(), s.changed.begin(), s.changed.end());
+        s.changed.clear();
+    }
+}
+
+// copies the live values of a stripe into a fresh arena. The stripe is locked
+void settings_table::compact(int stripe_idx) {
+    stripe & s = m_stripes[stripe_idx];
+    monotonic_arena fresh( s.values.upstream());
+    // (not size() - a key being inserted has its value here already)
+    int count = (int)m_valued.load(std::memory_order_acquire);
+    for ( int key = stripe_idx; key < count; key += STRIPES) {
+        record & r = rec(key);
+        const blob * cur = r.value.load(std::memory_order_relaxed);
+        blob * copy = new_blob(fresh, cur->data(), cur->len, cur->type);
+        copy->changed = cur->changed;
+        r.value.store( copy, std::memory_order_release);
+    }
+    // readers might still be reading the old values
+    s.values.retire_all();
+    s.values.swap(fresh);
+    s.garbage_bytes = 0;
+}
+
+// note: m_insert_cs is locked
+void settings_table::add_segment_if_needed(int key) {
+    size_t seg_idx = (size_t)key / SEGMENT_SIZE;
+    directory * dir = m_directory.load(std::memory_order_relaxed);
+    if ( seg_idx >= dir->capacity) {
+        directory * bigger = new directory( dir->capacity * 2);
+        for ( size_t i = 0; i < dir->capacity; ++i)
+            bigger->segments[i].store( dir->segments[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_directory.store(bigger, std::memory_order_release);
+        retire(dir, delete_directory);
+        dir = bigger;
+    }
+    if ( !dir->segments[seg_idx].load(std::memory_order_relaxed)) {
+        segment * seg = new segment;
+        for ( int i = 0; i < SEGMENT_SIZE; ++i) {
+            seg->records[i].name = 0;
+            seg->records[i].value.store(0, std::memory_order_relaxed);
+        }
+        dir->segments[seg_idx].store(seg, std::memory_order_release);
+    }
+}
+
+// note: m_insert_cs is locked
+void settings_table::grow_index() {
+    index * old = m_index.load(std::memory_order_relaxed);
+    index * bigger = new index( (old->mask + 1) * 2);
+    for ( size_t i = 0; i <= old->mask; ++i) {
+        unsigned long long slot = old->slots[i].load(std::memory_order_relaxed);
+        if ( !slot)
+            continue;
+        size_t pos = (size_t)(slot >> 32) & bigger->mask;
+        while ( bigger->slots[pos].load(std::memory_order_relaxed))
+            pos = (pos + 1) & bigger->mask;
+        bigger->slots[pos].store(slot, std::memory_order_relaxed);
+    }
+    m_index.store(bigger, std::memory_order_release);
+    retire(old, delete_index);
+}
+
+int settings_table::insert(const string & name, const string & value, const typeinfo & type, bool & inserted, bool changed) {
+    size_t hash = hash_of(name.c_str(), name.size());
+    scoped_lock lk(m_insert_cs);
+    read_guard guard;
+    inserted = false;
+    int existing = find(name.c_str(), name.size(), hash);
+    if ( existing >= 0)
+        return existing;
+
+    int key = (int)m_size.load(std::memory_order_relaxed);
+    add_segment_if_needed(key);
+    record & r = rec(key);
+    r.name = new_blob(m_names, name.c_str(), name.size(), 0);
+    m_name_bytes += blob_payload(name.size());
+    {
+    stripe & s = m_stripes[ key % STRIPES ];
+    scoped_lock stripe_lk(s.cs);
+    blob * v = new_blob(s.values, value.c_str(), value.size(), type_code(type));
+    if ( changed) {
+        v->changed = 1;
+        s.changed.push_back(key);
+    }
+    r.value.store( v, std::memory_order_release);
+    m_valued.store(key + 1, std::memory_order_release);
+    s.live_bytes += blob_payload(value.size());
+    }
+
+    if ( (size_t)(key + 1) * 2 > m_index.load(std::memory_order_relaxed)->mask + 1)
+        grow_index();
+    index & idx = *m_index.load(std::memory_order_relaxed);
+    unsigned long long tag = (unsigned long long)(unsigned int)hash;
+    size_t pos = (size_t)tag & idx.mask;
+    while ( idx.slots[pos].load(std::memory_order_relaxed))
+        pos = (pos + 1) & idx.mask;
+    idx.slots[pos].store( (tag << 32) | (unsigned long long)(key + 1), std::memory_order_release);
+    m_size.store(key + 1, std::memory_order_release);
+    inserted = true;
+    return key;
+}
+
+void settings_table::memory(memory_usage & usage) const {
+    scoped_lock lk(m_insert_cs);
+    usage = memory_usage();
+    usage.keys = size();
+    usage.name_bytes = m_name_bytes;
+    usage.arena_bytes = m_names.reserved();
+    for ( int i = 0; i < STRIPES; ++i) {
+        const stripe & s = m_stripes[i];
+        scoped_lock stripe_lk( const_cast<critical_section&>(s.cs));
+        usage.value_bytes += s.live_bytes;
+        usage.garbage_bytes += s.garbage_bytes;
+        usage.arena_bytes += s.values.reserved();
+    }
+
+    const directory * dir = m_directory.load(std::memory_order_relaxed);
+    usage.record_bytes = dir->capacity * sizeof(std::atomic<segment*>);
+    for ( size_t i = 0; i < dir->capacity; ++i)
+        if ( dir->segments[i].load(std::memory_order_relaxed))
+            usage.record_bytes += sizeof(segment);
+    usage.index_bytes = (m_index.load(std::memory_order_relaxed)->mask + 1) * sizeof(unsigned long long);
+}
+
+}}
@@ -0,0 +1,537 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/shm_storage.h"
+#include "ss/read_cache.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace ss {
+
+/*
+    The layout of the segments. Everything is in native byte order - all processes
+    are on the same machine, and built with the same char_t.
+
+    control segment:    control
+    generation segment: generation_header | index (index_size slots) | entries (count) | names & values
+
+    Offsets are in bytes, from the start of the segment.
+*/
+struct shm_storage::control {
+    std::atomic<unsigned int> magic;
+    // the seqlock: odd while the writer is switching to a new generation
+    std::atomic<unsigned int> seq;
+    std::atomic<unsigned long long> generation;
+    // the size of the generation's segment
+    std::atomic<unsigned long long> size;
+};
+
+struct shm_storage::generation_header {
+    unsigned int magic;
+    unsigned int char_size;
+    unsigned long long number;
+    unsigned long long size;
+    unsigned int count;
+    // power of 2; slot = entry index + 1 (0 = empty)
+    unsigned int index_size;
+};
+
+struct shm_storage::entry {
+    unsigned int hash;
+    unsigned int type;
+    unsigned int name_offset;
+    unsigned int name_len;
+    unsigned int value_offset;
+    unsigned int value_len;
+};
+
+namespace {
+    const unsigned int CONTROL_MAGIC = 0x53534354;     // "SSCT"
+    const unsigned int GENERATION_MAGIC = 0x53534745;  // "SSGE"
+    // how often readers that started before the writer look for the control segment
+    const long long ATTACH_RETRY_MS = 1000;
+    // a writer that holds the seqlock this long is considered dead
+    const long long STUCK_WRITER_MS = 1000;
+
+    size_t align_up(size_t n, size_t alignment) {
+        return (n + alignment - 1) & ~(alignment - 1);
+    }
+
+    long long now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // maps a whole segment; returns 0 on failure. 'size' = 0 means whatever its size is
+    void * map_segment(const std::string & name, bool writable, size_t & size) {
+        int fd = ::shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if ( fd < 0)
+            return 0;
+        struct stat info;
+        if ( ::fstat(fd, &info) != 0 || (size && (size_t)info.st_size != size) || info.st_size == 0) {
+            ::close(fd);
+            return 0;
+        }
+        size = (size_t)info.st_size;
+        void * addr = ::mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        return addr == MAP_FAILED ? 0 : addr;
+    }
+}
+
+
+shm_storage::shm_storage(const std::string & segment_name, open_type open)
+        : m_name(segment_name), m_open(open), m_control(0), m_current(0), m_next_attach(0), m_rejected(0), m_published(0) {
+    // POSIX wants "/name"
+    if ( m_name.empty() || m_name[0] != '/')
+        m_name = "/" + m_name;
+    detail::name_lock(m_map_cs, "shm_storage:" + m_name);
+
+    if ( m_open == open_writer) {
+        int fd = ::shm_open(m_name.c_str(), O_RDWR | O_CREAT, 0644);
+        if ( fd >= 0) {
+            struct stat info;
+            if ( ::fstat(fd, &info) == 0 && (size_t)info.st_size < sizeof(control))
+                // new segment - it's zero-filled
+                ::ftruncate(fd, sizeof(control));
+            void * addr = ::mmap(0, sizeof(control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if ( addr != MAP_FAILED) {
+                control * ctl = static_cast<control*>(addr);
+                unsigned int no_magic = 0;
+                ctl->magic.compare_exchange_strong(no_magic, CONTROL_MAGIC);
+                // readers in other processes access it too - the atomics can't be lock-based
+                assert( ctl->seq.is_lock_free() && ctl->generation.is_lock_free());
+                m_control.store(ctl, std::memory_order_release);
+            }
+        }
+        load_published();
+    }
+    else {
+        detail::read_guard guard;
+        check_generation();
+    }
+}
+
+shm_storage::~shm_storage() {
+    // nobody is using us anymore (nor reading the mapping)
+    delete_mapping( m_current.load());
+    if ( control * ctl = m_control.load())
+        ::munmap(ctl, sizeof(control));
+}
+
+std::string shm_storage::generation_name(const std::string & segment_name, unsigned long long number) {
+    std::ostringstream name;
+    name << segment_name << '.' << number;
+    return name.str();
+}
+
+void shm_storage::delete_mapping(void * p) {
+    mapping * m = static_cast<mapping*>(p);
+    if ( !m)
+        return;
+    ::munmap(m->addr, m->size);
+    delete m;
+}
+
+// looks for the control segment (readers that started before the writer retry once in a while)
+bool shm_storage::attach() const {
+    long long now = now_ms();
+    if ( now < m_next_attach.load(std::memory_order_relaxed))
+        return false;
+    scoped_lock lk(m_map_cs);
+    if ( m_control.load(std::memory_order_acquire))
+        return true;
+    m_next_attach.store(now + ATTACH_RETRY_MS, std::memory_order_relaxed);
+
+    size_t size = 0;
+    void * addr = map_segment(m_name, false, size);
+    if ( !addr)
+        return false;
+    control * ctl = static_cast<control*>(addr);
+    if ( size < sizeof(control) || ctl->magic.load(std::memory_order_acquire) != CONTROL_MAGIC) {
+        ::munmap(addr, size);
+        return false;
+    }
+    m_control.store(ctl, std::memory_order_release);
+    return true;
+}
+
+// readers: if there's a new generation, switches to it. Call it within a read_guard
+bool shm_storage::check_generation() const {
+    control * ctl = m_control.load(std::memory_order_acquire);
+    if ( !ctl) {
+        if ( !attach())
+            return false;
+        ctl = m_control.load(std::memory_order_acquire);
+    }
+
+    unsigned int seq = ctl->seq.load(std::memory_order_acquire);
+    if ( seq & 1)
+        // the writer is switching generations - keep using the current one
+        return false;
+    unsigned long long number = ctl->generation.load(std::memory_order_relaxed);
+    unsigned long long size = ctl->size.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ( ctl->seq.load(std::memory_order_relaxed) != seq)
+        return false;
+
+    mapping * cur = m_current.load(std::memory_order_acquire);
+    if ( number == 0 || (cur && cur->number == number) || number == m_rejected.load(std::memory_order_relaxed))
+        return false;
+
+    scoped_lock lk(m_map_cs);
+    cur = m_current.load(std::memory_order_acquire);
+    if ( cur && cur->number == number)
+        // another thread switched already
+        return false;
+    mapping * m = map_generation(number, size);
+    if ( !m)
+        // it's already been replaced by a newer one - we'll pick that one up on the next read
+        return false;
+    if ( parent() && parent()->get_schema()) {
+        std::map<string,string> values;
+        entries_of(*m, values);
+        if ( !validate(values)) {
+            // keep the generation we have
+            m_rejected.store(number, std::memory_order_relaxed);
+            delete_mapping(m);
+            return false;
+        }
+    }
+    m_current.store(m, std::memory_order_release);
+    if ( cur)
+        detail::retire(cur, delete_mapping);
+    on_reloaded();
+    return true;
+}
+
+shm_storage::mapping * shm_storage::map_generation(unsigned long long number, unsigned long long size) const {
+    size_t mapped_size = (size_t)size;
+    void * addr = map_segment( generation_name(m_name, number), false, mapped_size);
+    if ( !addr)
+        return 0;
+    mapping * m = new mapping;
+    m->addr = addr;
+    m->size = mapped_size;
+    m->number = number;
+    if ( !well_formed(*m)) {
+        delete_mapping(m);
+        return 0;
+    }
+    return m;
+}
+
+// checks that the segment is what we expect it to be - afterwards, we don't check any offset
+bool shm_storage::well_formed(mapping & m) {
+    if ( m.size < sizeof(generation_header))
+        return false;
+    const char * base = static_cast<const char*>(m.addr);
+    const generation_header & header = *reinterpret_cast<const generation_header*>(base);
+    if ( header.magic != GENERATION_MAGIC || header.char_size != sizeof(char_t) || header.number != m.number || header.size != m.size)
+        return false;
+    if ( header.index_size == 0 || (header.index_size & (header.index_size - 1)) || header.count >= header.index_size)
+        return false;
+
+    size_t slots_offset = align_up(sizeof(generation_header), alignof(unsigned int));
+    size_t entries_offset = align_up(slots_offset + header.index_size * sizeof(unsigned int), alignof(entry));
+    if ( entries_offset + (size_t)header.count * sizeof(entry) > m.size)
+        return false;
+    m.header = &header;
+    m.slots = reinterpret_cast<const unsigned int*>(base + slots_offset);
+    m.entries = reinterpret_cast<const entry*>(base + entries_offset);
+
+    for ( unsigned int i = 0; i < header.index_size; ++i)
+        if ( m.slots[i] > header.count)
+            return false;
+    for ( unsigned int i = 0; i < header.count; ++i) {
+        const entry & e = m.entries[i];
+        if ( e.name_offset % sizeof(char_t) || e.value_offset % sizeof(char_t))
+            return false;
+        if ( e.name_offset + (size_t)e.name_len * sizeof(char_t) > m.size || e.value_offset + (size_t)e.value_len * sizeof(char_t) > m.size)
+            return false;
+    }
+    return true;
+}
+
+bool shm_storage::find(const mapping & m, const string & name, string & value, typeinfo & type) const {
+    const char * base = static_cast<const char*>(m.addr);
+    unsigned int hash = (unsigned int)detail::settings_table::hash_of(name.c_str(), name.size());
+    unsigned int mask = m.header->index_size - 1;
+    for ( unsigned int idx = hash & mask, probes = 0; probes <= mask; idx = (idx + 1) & mask, ++probes) {
+        unsigned int slot = m.slots[idx];
+        if ( !slot)
+            return false;
+        const entry & e = m.entries[slot - 1];
+        if ( e.hash != hash || e.name_len != name.size())
+            continue;
+        const char_t * entry_name = reinterpret_cast<const char_t*>(base + e.name_offset);
+        if ( std::char_traits<char_t>::compare(entry_name, name.c_str(), e.name_len) != 0)
+            continue;
+        value.assign( reinterpret_cast<const char_t*>(base + e.value_offset), e.value_len);
+        type = detail::settings_table::code_type( (unsigned char)e.type);
+        return true;
+    }
+    return false;
+}
+
+// the writer starts from what was published (say, by the previous instance of the process)
+void shm_storage::load_published() {
+    control * ctl = m_control.load(std::memory_order_acquire);
+    if ( !ctl)
+        return;
+    unsigned long long number = ctl->generation.load(std::memory_order_acquire);
+    unsigned long long size = ctl->size.load(std::memory_order_relaxed);
+    if ( number == 0)
+        return;
+    mapping * m = map_generation(number, size);
+    if ( !m)
+        return;
+
+    const char * base = static_cast<const char*>(m->addr);
+    for ( unsigned int i = 0; i < m->header->count; ++i) {
+        const entry & e = m->entries[i];
+        string name( reinterpret_cast<const char_t*>(base + e.name_offset), e.name_len);
+        string value( reinterpret_cast<const char_t*>(base + e.value_offset), e.value_len);
+        bool inserted;
+        m_table.insert(name, value, detail::settings_table::code_type( (unsigned char)e.type), inserted);
+    }
+    m_published = number;
+    delete_mapping(m);
+}
+
+// writes all settings as a new generation, and makes it the current one
+bool shm_storage::publish() {
+    control * ctl = m_control.load(std::memory_order_acquire);
+    if ( !ctl)
+        return false;
+
+    // build the generation in memory first, so that we hold the seqlock only while copying it
+    unsigned int count = (unsigned int)m_table.size();
+    unsigned int index_size = 8;
+    while ( index_size < count * 2)
+        index_size *= 2;
+    size_t slots_offset = align_up(sizeof(generation_header), alignof(unsigned int));
+    size_t entries_offset = align_up(slots_offset + index_size * sizeof(unsigned int), alignof(entry));
+    size_t strings_offset = align_up(entries_offset + count * sizeof(entry), alignof(char_t));
+
+    std::vector<unsigned int> slots(index_size, 0);
+    std::vector<entry> entries(count);
+    string strings;
+    string value;
+    typeinfo type;
+    for ( unsigned int key = 0; key < count; ++key) {
+        size_t name_len;
+        const char_t * name = m_table.name(key, name_len);
+        m_table.get(key, value, type);
+        entry & e = entries[key];
+        e.hash = (unsigned int)detail::settings_table::hash_of(name, name_len);
+        e.type = detail::settings_table::type_code(type);
+        e.name_offset = (unsigned int)(strings_offset + strings.size() * sizeof(char_t));
+        e.name_len = (unsigned int)name_len;
+        strings.append(name, name_len);
+        e.value_offset = (unsigned int)(strings_offset + strings.size() * sizeof(char_t));
+        e.value_len = (unsigned int)value.size();
+        strings += value;
+
+        unsigned int idx = e.hash & (index_size - 1);
+        while ( slots[idx])
+            idx = (idx + 1) & (index_size - 1);
+        slots[idx] = key + 1;
+    }
+    size_t size = strings_offset + strings.size() * sizeof(char_t);
+    if ( size > 0xFFFFFFFFu)
+        return false;
+
+    // take the seqlock (a writer that's been holding it for too long has died)
+    unsigned int seq = ctl->seq.load(std::memory_order_relaxed);
+    long long give_up = now_ms() + STUCK_WRITER_MS;
+    while ( true) {
+        if ( (seq & 1) && now_ms() < give_up) {
+            std::this_thread::yield();
+            seq = ctl->seq.load(std::memory_order_relaxed);
+            continue;
+        }
+        unsigned int locked = (seq | 1) + ((seq & 1) ? 2 : 0);
+        if ( ctl->seq.compare_exchange_weak(seq, locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+            seq = locked;
+            break;
+        }
+    }
+
+    unsigned long long old_number = ctl->generation.load(std::memory_order_relaxed);
+    unsigned long long number = old_number + 1;
+    std::string name = generation_name(m_name, number);
+    bool ok = false;
+    // a writer that died while publishing could have left it behind
+    ::shm_unlink(name.c_str());
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if ( fd >= 0) {
+        void * addr = MAP_FAILED;
+        if ( ::ftruncate(fd, (off_t)size) == 0)
+            addr = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if ( addr != MAP_FAILED) {
+            char * base = static_cast<char*>(addr);
+            generation_header & header = *reinterpret_cast<generation_header*>(base);
+            header.magic = GENERATION_MAGIC;
+            header.char_size = sizeof(char_t);
+            header.number = number;
+            header.size = size;
+            header.count = count;
+            header.index_size = index_size;
+            std::copy(slots.begin(), slots.end(), reinterpret_cast<unsigned int*>(base + slots_offset));
+            std::copy(entries.begin(), entries.end(), reinterpret_cast<entry*>(base + entries_offset));
+            std::char_traits<char_t>::copy( reinterpret_cast<char_t*>(base + strings_offset), strings.data(), strings.size());
+            ::munmap(addr, size);
+            ok = true;
+        }
+        else
+            ::shm_unlink(name.c_str());
+    }
+
+    if ( ok) {
+        ctl->generation.store(number, std::memory_order_relaxed);
+        ctl->size.store(size, std::memory_order_relaxed);
+    }
+    ctl->seq.store(seq + 1, std::memory_order_release);
+
+    if ( ok) {
+        // readers that mapped it can still use it; the others will find the new one
+        if ( old_number)
+            ::shm_unlink( generation_name(m_name, old_number).c_str());
+        m_published = number;
+    }
+    return ok;
+}
+
+void shm_storage::save() {
+    if ( m_open != open_writer)
+        return;
+    if ( !publish())
+        set_error(err::cannot_save, TTEXT("cannot publish settings to shared memory ") + string(m_name.begin(), m_name.end()) );
+}
+
+void shm_storage::get_setting( const string & name, string & value, typeinfo& type) const {
+    if ( !find_setting(name, value, type)) {
+        value.clear();
+        type = typeid(string);
+        bool has_default;
+        parent()->get_default_value( full_setting_name(name), value, type, has_default);
+        if ( !has_default)
+            set_error(err::bad_setting_name, TTEXT("cannot get setting ") + full_setting_name(name) );
+    }
+}
+
+bool shm_storage::find_setting( const string & name, string & value, typeinfo& type) const {
+    if ( m_open == open_writer)
+        return m_table.get(name, value, type);
+    detail::read_guard guard;
+    check_generation();
+    mapping * cur = m_current.load(std::memory_order_acquire);
+    return cur && find(*cur, name, value, type);
+}
+
+void shm_storage::set_setting( const string & name, const string & value, const typeinfo& type) {
+    if ( m_open != open_writer) {
+        set_error(err::bad_setting_name, TTEXT("cannot set setting (shared memory is read-only)") + full_setting_name(name) );
+        return;
+    }
+    int found = m_table.find(name.c_str(), name.size());
+    if ( found >= 0)
+        m_table.set(found, value);
+    else {
+        scoped_lock lk(cs());
+        bool inserted;
+        int key = m_table.insert(name, value, detail::friendly_type(type), inserted);
+        if ( !inserted)
+            // another thread just added it
+            m_table.set(key, value);
+    }
+}
+
+void shm_storage::enum_settings( std::map<string,string> & values) const {
+    values.clear();
+    string value;
+    typeinfo type;
+    if ( m_open == open_writer) {
+        for ( int key = 0, count = m_table.size(); key < count; ++key) {
+            m_table.get(key, value, type);
+            values[ m_table.name(key) ] = value;
+        }
+        return;
+    }
+
+    detail::read_guard guard;
+    check_generation();
+    const mapping * cur = m_current.load(std::memory_order_acquire);
+    if ( cur)
+        entries_of(*cur, values);
+}
+
+void shm_storage::entries_of(const mapping & m, std::map<string,string> & values) {
+    const char * base = static_cast<const char*>(m.addr);
+    for ( unsigned int i = 0; i < m.header->count; ++i) {
+        const entry & e = m.entries[i];
+        values[ string( reinterpret_cast<const char_t*>(base + e.name_offset), e.name_len) ] =
+            string( reinterpret_cast<const char_t*>(base + e.value_offset), e.value_len);
+    }
+}
+
+bool shm_storage::refresh() {
+    if ( m_open == open_writer)
+        return false;
+    detail::read_guard guard;
+    return check_generation();
+}
+
+unsigned long long shm_storage::generation() const {
+    if ( m_open == open_writer) {
+        scoped_lock lk(cs());
+        return m_published;
+    }
+    detail::read_guard guard;
+    const mapping * cur = m_current.load(std::memory_order_acquire);
+    return cur ? cur->number : 0;
+}
+
+void shm_storage::on_memory_resource_changed(memory_resource * res) {
+    m_table.set_memory_resource(res);
+}
+
+void shm_storage::remove(const std::string & segment_name) {
+    std::string name = segment_name;
+    if ( name.empty() || name[0] != '/')
+        name = "/" + name;
+    size_t size = 0;
+    if ( void * addr = map_segment(name, false, size)) {
+        if ( size >= sizeof(control)) {
+            unsigned long long number = static_cast<control*>(addr)->generation.load();
+            if ( number)
+                ::shm_unlink( generation_name(name, number).c_str());
+        }
+        ::munmap(addr, size);
+    }
+    ::shm_unlink(name.c_str());
+}
+
+}
@@ -0,0 +1,175 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/socket_protocol.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace ss { namespace detail { namespace socket_protocol {
+
+namespace {
+    // frames bigger than this are garbage
+    const unsigned long MAX_FRAME = 256ul << 20;
+
+    bool make_address(const std::string & path, sockaddr_un & addr) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if ( path.empty() || path.size() >= sizeof(addr.sun_path))
+            return false;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    int new_socket() {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+#ifdef SO_NOSIGPIPE
+        // (where there's no MSG_NOSIGNAL)
+        if ( fd >= 0) {
+            int on = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+        }
+#endif
+        return fd;
+    }
+
+    bool send_all(int fd, const char * data, size_t len) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        while ( len > 0) {
+            ssize_t sent = ::send(fd, data, len, flags);
+            if ( sent < 0) {
+                if ( errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += sent;
+            len -= (size_t)sent;
+        }
+        return true;
+    }
+}
+
+int listen_to(const std::string & path) {
+    sockaddr_un addr;
+    if ( !make_address(path, addr))
+        return -1;
+    int fd = new_socket();
+    if ( fd < 0)
+        return -1;
+    // (a daemon that died leaves its socket file behind)
+    ::unlink( path.c_str());
+    if ( ::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, 64) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connect_to(const std::string & path) {
+    sockaddr_un addr;
+    if ( !make_address(path, addr))
+        return -1;
+    int fd = new_socket();
+    if ( fd < 0)
+        return -1;
+    int result;
+    while ( (result = ::connect(fd, (sockaddr*)&addr, sizeof(addr))) != 0 && errno == EINTR)
+        ;
+    if ( result != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void set_send_timeout(int fd, int ms) {
+    timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+void close_socket(int fd) {
+    if ( fd >= 0)
+        ::close(fd);
+}
+
+bool send_frame(int fd, const char * verb, const std::string & payload) {
+    char header[ 64];
+    int len = snprintf(header, sizeof(header), "%s %lu\n", verb, (unsigned long)payload.size());
+    // (one write, if the payload is small)
+    if ( payload.size() < 4096) {
+        std::string frame(header, len);
+        frame += payload;
+        return send_all(fd, frame.data(), frame.size());
+    }
+    return send_all(fd, header, len) && send_all(fd, payload.data(), payload.size());
+}
+
+bool frame_reader::read_some(int fd) {
+    char buff[ 64 * 1024];
+    ssize_t got;
+    while ( (got = ::recv(fd, buff, sizeof(buff), 0)) < 0 && errno == EINTR)
+        ;
+    if ( got <= 0)
+        return false;
+    // drop the frames we already handed out
+    if ( m_pos > 0) {
+        m_buffer.erase(0, m_pos);
+        m_pos = 0;
+    }
+    m_buffer.append(buff, (size_t)got);
+    return true;
+}
+
+bool frame_reader::next(std::string & verb, std::string & payload, bool & bad) {
+    bad = false;
+    size_t eol = m_buffer.find('\n', m_pos);
+    if ( eol == std::string::npos) {
+        // a header is short
+        bad = m_buffer.size() - m_pos > 64;
+        return false;
+    }
+    size_t space = m_buffer.find(' ', m_pos);
+    if ( space == std::string::npos || space > eol) {
+        bad = true;
+        return false;
+    }
+    std::string len_str = m_buffer.substr(space + 1, eol - space - 1);
+    char * end;
+    unsigned long len = strtoul(len_str.c_str(), &end, 10);
+    if ( len_str.empty() || *end || len > MAX_FRAME) {
+        bad = true;
+        return false;
+    }
+    if ( m_buffer.size() - (eol + 1) < len)
+        // not all here yet
+        return false;
+    verb.assign(m_buffer, m_pos, space - m_pos);
+    payload.assign(m_buffer, eol + 1, len);
+    m_pos = eol + 1 + len;
+    return true;
+}
+
+}}}
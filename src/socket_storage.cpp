@@ -0,0 +1,333 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/configuration.h"
+#include "ss/socket_storage.h"
+#include "ss/util.h"
+#include <chrono>
+#include <fstream>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace ss {
+
+namespace {
+    // while the daemon is not available, we try to reconnect this often
+    const int RECONNECT_MS = 500;
+    // the replica file is written at most this often
+    const int REPLICA_DELAY_MS = 1000;
+
+    // what we send/receive is UTF-8
+    inline void assign_chars(std::string & dest, const std::string & src) { dest = src; }
+    inline void assign_chars(std::wstring & dest, const std::string & src) { dest = detail::widen(src); }
+
+    long long now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+namespace protocol = detail::socket_protocol;
+
+socket_storage::socket_storage(const std::string & socket_path, const std::string & replica_file, int connect_timeout_ms)
+        : m_path(socket_path), m_replica_file(replica_file), m_fd(-1), m_stop(false), m_connected(false) {
+    detail::name_lock(m_pending_cs, "socket_storage pending");
+    if ( ::pipe(m_wake) != 0)
+        m_wake[0] = m_wake[1] = -1;
+    if ( connect(connect_timeout_ms))
+        save_replica();
+    else
+        // the daemon is not there - start from what we had
+        load_replica();
+    m_io = std::thread( &socket_storage::io_thread, this);
+}
+
+socket_storage::~socket_storage() {
+    m_stop = true;
+    wake();
+    m_io.join();
+    save_replica();
+    if ( m_wake[0] >= 0) {
+        ::close(m_wake[0]);
+        ::close(m_wake[1]);
+    }
+}
+
+void socket_storage::on_memory_resource_changed(memory_resource * res) {
+    m_table.set_memory_resource(res);
+}
+
+// connects, and waits for the settings. Called by the constructor, then only by our thread
+bool socket_storage::connect(int timeout_ms) {
+    int fd = protocol::connect_to(m_path);
+    if ( fd < 0)
+        return false;
+    protocol::set_send_timeout(fd, timeout_ms);
+    if ( !protocol::send_frame(fd, protocol::SYNC, std::string())) {
+        protocol::close_socket(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    m_reader.clear();
+    long long until = now_ms() + timeout_ms;
+    bool got_settings = false;
+    while ( !got_settings) {
+        long long left = until - now_ms();
+        pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        int result = left > 0 ? ::poll(&p, 1, (int)left) : 0;
+        if ( result < 0 && errno == EINTR)
+            continue;
+        if ( result <= 0 || !m_reader.read_some(fd) || !on_frames(got_settings)) {
+            disconnect();
+            return false;
+        }
+    }
+    m_connected = true;
+    // what was set while we were not connected
+    if ( !send_pending()) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+void socket_storage::disconnect() {
+    protocol::close_socket(m_fd);
+    m_fd = -1;
+    m_connected = false;
+}
+
+void socket_storage::wake() {
+    if ( m_wake[1] < 0)
+        return;
+    char ch = 0;
+    while ( ::write(m_wake[1], &ch, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void socket_storage::io_thread() {
+    // when the replica file is due to be written (0 = nothing new to write)
+    long long replica_due = 0;
+    while ( !m_stop) {
+        pollfd fds[2];
+        fds[0].fd = m_wake[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = m_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        int timeout = m_fd < 0 ? RECONNECT_MS : -1;
+        if ( replica_due) {
+            int left = (int)std::max(0LL, replica_due - now_ms());
+            timeout = timeout < 0 ? left : std::min(timeout, left);
+        }
+        if ( ::poll(fds, m_fd < 0 ? 1 : 2, timeout) < 0 && errno != EINTR)
+            break;
+
+        if ( fds[0].revents) {
+            char buff[ 64];
+            ssize_t ignore = ::read(m_wake[0], buff, sizeof(buff));
+            (void)ignore;
+        }
+        if ( m_stop)
+            break;
+
+        if ( replica_due && now_ms() >= replica_due) {
+            save_replica();
+            replica_due = 0;
+        }
+
+        if ( m_fd < 0) {
+            if ( connect(RECONNECT_MS))
+                replica_due = now_ms() + REPLICA_DELAY_MS;
+            continue;
+        }
+        if ( fds[1].revents) {
+            bool got_settings = false;
+            if ( !m_reader.read_some(m_fd) || !on_frames(got_settings)) {
+                disconnect();
+                continue;
+            }
+            if ( got_settings && !replica_due)
+                replica_due = now_ms() + REPLICA_DELAY_MS;
+        }
+        if ( !send_pending())
+            disconnect();
+    }
+
+    // the last batch
+    if ( m_fd >= 0)
+        send_pending();
+    disconnect();
+}
+
+bool socket_storage::on_frames(bool & got_settings) {
+    std::string verb, payload;
+    bool bad;
+    while ( m_reader.next(verb, payload, bad)) {
+        if ( verb != protocol::SNAPSHOT && verb != protocol::DELTA)
+            return false;
+        apply(payload);
+        got_settings = true;
+    }
+    return !bad;
+}
+
+void socket_storage::apply(const std::string & payload) {
+    string text;
+    assign_chars(text, payload);
+    settings_delta changes;
+    read_delta(text, changes);
+    typed_value typed;
+    for ( settings_delta::const_iterator first = changes.begin(), last = changes.end(); first != last; ++first) {
+        if ( first->removed)
+            continue;
+        // with a schema, invalid values are reported - and we keep what we have
+        if ( !check_setting(first->name, first->value, typed))
+            continue;
+        int key = m_table.find( first->name.c_str(), first->name.size());
+        bool inserted = false;
+        if ( key < 0)
+            key = m_table.insert( first->name, first->value, first->type, inserted);
+        if ( inserted || m_table.set_loaded( key, first->value, first->type))
+            // keep the schema's converted value up to date
+            set_typed(first->name, typed);
+    }
+    if ( !changes.empty())
+        // values changed behind the configuration's back
+        on_reloaded();
+}
+
+// sends what was set since the last batch. False if we could not
+bool socket_storage::send_pending() {
+    std::map<string, setting_change> pending;
+    { scoped_lock lk(m_pending_cs);
+      pending.swap(m_pending);
+    }
+    if ( pending.empty())
+        return true;
+    settings_delta changes;
+    changes.reserve( pending.size());
+    for ( std::map<string, setting_change>::const_iterator first = pending.begin(), last = pending.end(); first != last; ++first)
+        changes.push_back(first->second);
+    if ( protocol::send_frame(m_fd, protocol::SET, detail::narrow( write_delta(changes)))) {
+        // the daemon has what we set - from now on, what it pushes wins
+        // (what's set meanwhile is in the next batch - until then, it might be overwritten by an older value)
+        std::vector<int> sent;
+        m_table.take_changed(sent);
+        return true;
+    }
+
+    // we'll send them once we reconnect (unless they're set again meanwhile)
+    scoped_lock lk(m_pending_cs);
+    for ( std::map<string, setting_change>::const_iterator first = pending.begin(), last = pending.end(); first != last; ++first)
+        m_pending.insert(*first);
+    return false;
+}
+
+void socket_storage::load_replica() {
+    if ( m_replica_file.empty())
+        return;
+    std::ifstream in( m_replica_file.c_str(), std::ios_base::in | std::ios_base::binary);
+    std::string payload( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+    apply(payload);
+}
+
+void socket_storage::save_replica() {
+    if ( m_replica_file.empty())
+        return;
+    settings_delta all;
+    setting_change change;
+    for ( int key = 0, count = m_table.size(); key < count; ++key) {
+        change.name = m_table.name(key);
+        m_table.get(key, change.value, change.type);
+        all.push_back(change);
+    }
+    std::string temp_name = m_replica_file + ".tmp";
+    std::string payload = detail::narrow( write_delta(all));
+    bool ok;
+    {
+    std::ofstream out( temp_name.c_str(), std::ios_base::out | std::ios_base::binary);
+    out.write( payload.data(), payload.size());
+    out.close();
+    ok = !out.fail();
+    }
+    if ( !ok || ::rename( temp_name.c_str(), m_replica_file.c_str()) != 0)
+        ::remove( temp_name.c_str());
+}
+
+void socket_storage::save() {
+    wake();
+}
+
+void socket_storage::get_setting( const string & name, string & value, typeinfo& type) const {
+    // lock-free
+    if ( !m_table.get(name, value, type) ) {
+        value.clear();
+        type = typeid(string);
+        bool has_default;
+        parent()->get_default_value( full_setting_name(name), value, type, has_default);
+        if ( !has_default)
+            set_error(err::bad_setting_name, TTEXT("cannot get setting ") + full_setting_name(name) );
+    }
+}
+
+bool socket_storage::find_setting( const string & name, string & value, typeinfo& type) const {
+    // lock-free
+    return m_table.get(name, value, type);
+}
+
+void socket_storage::set_setting( const string & name, const string & value, const typeinfo&type) {
+    setting_change change;
+    change.name = name;
+    change.value = value;
+    change.type = detail::friendly_type(type);
+
+    int found = m_table.find(name.c_str(), name.size());
+    if ( found >= 0)
+        // we have this setting - no need to lock
+        m_table.set(found, value);
+    else {
+        scoped_lock lk(cs());
+        bool inserted;
+        int key = m_table.insert(name, value, change.type, inserted);
+        if ( !inserted)
+            // another thread just added it
+            m_table.set(key, value);
+    }
+
+    { scoped_lock lk(m_pending_cs);
+      m_pending[name] = change;
+    }
+    // our thread sends it (along with whatever else is set until it gets to it)
+    wake();
+}
+
+void socket_storage::enum_settings( std::map<string,string> & values) const {
+    values.clear();
+    string value;
+    typeinfo type;
+    for ( int key = 0, count = m_table.size(); key < count; ++key) {
+        m_table.get(key, value, type);
+        values[ m_table.name(key) ] = value;
+    }
+}
+
+}
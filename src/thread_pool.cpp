@@ -0,0 +1,76 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+#include "ss/thread_pool.h"
+
+namespace ss { namespace detail {
+
+thread_pool::thread_pool(int threads) : m_size(threads), m_idle(0), m_stop(false) {
+    if ( m_size <= 0) {
+        m_size = (int)std::thread::hardware_concurrency();
+        if ( m_size < 2)
+            m_size = 2;
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_stop = true;
+    }
+    m_cv.notify_all();
+    for ( size_t idx = 0; idx < m_threads.size(); ++idx)
+        m_threads[idx].join();
+}
+
+std::shared_future<void> thread_pool::submit(const std::function<void()> & task) {
+    std::packaged_task<void()> wrapped(task);
+    std::shared_future<void> done = wrapped.get_future().share();
+    {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_tasks.push_back( std::move(wrapped));
+    // nobody's free to take it - one more thread, until we have them all (then, it waits its turn)
+    if ( m_idle < (int)m_tasks.size() && (int)m_threads.size() < m_size)
+        m_threads.push_back( std::thread( &thread_pool::worker, this));
+    }
+    m_cv.notify_one();
+    return done;
+}
+
+void thread_pool::worker() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while ( true) {
+        if ( !m_tasks.empty()) {
+            std::packaged_task<void()> task = std::move( m_tasks.front());
+            m_tasks.pop_front();
+            lk.unlock();
+            task();
+            lk.lock();
+            continue;
+        }
+        if ( m_stop)
+            break;
+        ++m_idle;
+        m_cv.wait(lk);
+        --m_idle;
+    }
+}
+
+thread_pool & thread_pool::shared() {
+    static thread_pool pool;
+    return pool;
+}
+
+}}
@@ -0,0 +1,288 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// trace.cpp: per-thread ring buffers + Chrome trace-event export
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ss/trace.h"
+
+#ifdef SS_IS_TRACING
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SS_TRACE_USE_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SS_TRACE_USE_TSC
+#endif
+
+namespace ss { namespace trace {
+
+namespace detail {
+    std::atomic<bool> g_enabled(false);
+}
+
+namespace {
+
+    // raw timestamp - the TSC where we have one (a couple of ns), otherwise steady_clock's nanoseconds.
+    // It's converted into microseconds only when dumping
+    inline unsigned long long now_ticks() {
+#ifdef SS_TRACE_USE_TSC
+        return __rdtsc();
+#else
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // one event. The fields are atomics only so that dumping while a thread is still tracing is well-defined;
+    // all accesses are relaxed (plain moves on x86)
+    struct event {
+        std::atomic<const char*> name;
+        // (timestamp << 1) | is_begin
+        std::atomic<unsigned long long> stamp;
+    };
+
+    // single producer (the owning thread), any number of readers (dumpers)
+    struct thread_buffer {
+        thread_buffer(int tid, int capacity) : tid(tid), mask(capacity - 1), events(new event[capacity]), head(0), floor(0) {
+            for ( int i = 0; i < capacity; ++i) {
+                events[i].name.store(0, std::memory_order_relaxed);
+                events[i].stamp.store(0, std::memory_order_relaxed);
+            }
+        }
+        ~thread_buffer() { delete[] events; }
+
+        int tid;
+        unsigned long long mask;
+        event * events;
+        // how many events were ever written
+        std::atomic<unsigned long long> head;
+        // events below this index were clear()-ed
+        std::atomic<unsigned long long> floor;
+    };
+
+    // how many buffers of threads that ended we keep (so that a process whose threads come and go
+    // doesn't keep allocating buffers)
+    const size_t MAX_DEAD_BUFFERS = 16;
+
+    struct registry {
+        registry() : buffer_size(1 << 16), last_tid(0), base_ticks(now_ticks()), base_time(std::chrono::steady_clock::now()) {}
+        ~registry() {
+            for ( size_t i = 0; i < buffers.size(); ++i)
+                delete buffers[i];
+        }
+
+        std::mutex cs;
+        // note: buffers outlive their threads, so that we can still dump events from threads that have ended
+        std::vector<thread_buffer*> buffers;
+        // the buffers of threads that ended (oldest first) - also in 'buffers'
+        std::deque<thread_buffer*> dead;
+        int buffer_size;
+        int last_tid;
+
+        // used to convert ticks into microseconds
+        unsigned long long base_ticks;
+        std::chrono::steady_clock::time_point base_time;
+    };
+
+    registry & reg() {
+        static registry r;
+        return r;
+    }
+
+    thread_local thread_buffer * t_buffer = 0;
+    // set once our thread's buffer was given up (the thread is ending) - from then on, we don't trace
+    thread_local bool t_ended = false;
+
+    thread_buffer * register_thread() {
+        registry & r = reg();
+        std::lock_guard<std::mutex> lk(r.cs);
+        if ( r.dead.size() >= MAX_DEAD_BUFFERS && r.dead.front()->mask + 1 == (unsigned long long)r.buffer_size) {
+            // reuse the buffer of the thread that ended first (dumping holds the lock - nobody is reading it)
+            thread_buffer * buf = r.dead.front();
+            r.dead.pop_front();
+            buf->tid = ++r.last_tid;
+            buf->head.store(0, std::memory_order_relaxed);
+            buf->floor.store(0, std::memory_order_relaxed);
+            return buf;
+        }
+        thread_buffer * buf = new thread_buffer( ++r.last_tid, r.buffer_size);
+        r.buffers.push_back(buf);
+        return buf;
+    }
+
+    // the thread ended - its events can still be dumped, until the buffer is reused or dropped
+    void unregister_thread(thread_buffer * buf) {
+        registry & r = reg();
+        std::lock_guard<std::mutex> lk(r.cs);
+        r.dead.push_back(buf);
+        while ( r.dead.size() > MAX_DEAD_BUFFERS) {
+            thread_buffer * oldest = r.dead.front();
+            r.dead.pop_front();
+            r.buffers.erase( std::find(r.buffers.begin(), r.buffers.end(), oldest));
+            delete oldest;
+        }
+    }
+
+    // gives up the thread's buffer when the thread ends
+    struct buffer_owner {
+        buffer_owner() : buf(0) {}
+        ~buffer_owner() {
+            t_ended = true;
+            t_buffer = 0;
+            if ( buf)
+                unregister_thread(buf);
+        }
+        thread_buffer * buf;
+    };
+    thread_local buffer_owner t_owner;
+
+    int round_up_to_pow2(int n) {
+        int result = 1;
+        while ( result < n) result <<= 1;
+        return result;
+    }
+
+    struct copied_event {
+        const char * name;
+        unsigned long long ticks;
+        bool is_begin;
+    };
+
+    // copies whatever events are still valid in this buffer
+    void copy_events(const thread_buffer & buf, std::vector<copied_event> & out) {
+        unsigned long long capacity = buf.mask + 1;
+        unsigned long long end = buf.head.load(std::memory_order_acquire);
+        unsigned long long begin = end > capacity ? end - capacity : 0;
+        begin = std::max(begin, buf.floor.load(std::memory_order_relaxed));
+
+        std::vector<copied_event> copied;
+        copied.reserve( (size_t)(end - begin));
+        for ( unsigned long long i = begin; i < end; ++i) {
+            const event & e = buf.events[i & buf.mask];
+            copied_event c;
+            c.name = e.name.load(std::memory_order_relaxed);
+            unsigned long long stamp = e.stamp.load(std::memory_order_relaxed);
+            c.ticks = stamp >> 1;
+            c.is_begin = (stamp & 1) != 0;
+            copied.push_back(c);
+        }
+
+        // while we were copying, the owner thread could have overwritten the oldest slots
+        // (including the one it's writing right now, which is not yet published)
+        unsigned long long new_end = buf.head.load(std::memory_order_acquire);
+        unsigned long long first_valid = (new_end + 1 > capacity) ? new_end + 1 - capacity : 0;
+        size_t skip = first_valid > begin ? (size_t)std::min<unsigned long long>(first_valid - begin, copied.size()) : 0;
+
+        // the oldest events might be "end"s whose "begin" was overwritten - drop those
+        int depth = 0;
+        for ( size_t i = skip; i < copied.size(); ++i) {
+            if ( copied[i].is_begin)
+                ++depth;
+            else if ( depth > 0)
+                --depth;
+            else
+                continue;
+            out.push_back(copied[i]);
+        }
+    }
+}
+
+namespace detail {
+    void record(const char * name, bool is_begin) {
+        thread_buffer * buf = t_buffer;
+        if ( !buf) {
+            if ( t_ended)
+                return;
+            buf = t_buffer = t_owner.buf = register_thread();
+        }
+        unsigned long long idx = buf->head.load(std::memory_order_relaxed);
+        event & e = buf->events[idx & buf->mask];
+        e.name.store(name, std::memory_order_relaxed);
+        e.stamp.store( (now_ticks() << 1) | (is_begin ? 1 : 0), std::memory_order_relaxed);
+        buf->head.store(idx + 1, std::memory_order_release);
+    }
+}
+
+void enable(bool on) {
+    reg(); // make sure the time base exists before the first event
+    detail::g_enabled.store(on, std::memory_order_relaxed);
+}
+
+void set_buffer_size(int events) {
+    registry & r = reg();
+    std::lock_guard<std::mutex> lk(r.cs);
+    r.buffer_size = round_up_to_pow2( events > 2 ? events : 2);
+}
+
+void clear() {
+    registry & r = reg();
+    std::lock_guard<std::mutex> lk(r.cs);
+    for ( size_t i = 0; i < r.buffers.size(); ++i)
+        r.buffers[i]->floor.store( r.buffers[i]->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+void dump_chrome_trace(std::ostream & out) {
+    registry & r = reg();
+    std::lock_guard<std::mutex> lk(r.cs);
+
+    // find out how many ticks there are in a microsecond
+    unsigned long long ticks = now_ticks() - r.base_ticks;
+    double elapsed_us = std::chrono::duration<double, std::micro>( std::chrono::steady_clock::now() - r.base_time).count();
+    double ticks_per_us = (ticks > 0 && elapsed_us > 0) ? (double)ticks / elapsed_us : 1.0;
+
+    // (we leave the stream as we found it)
+    std::ios_base::fmtflags old_flags = out.flags();
+    std::streamsize old_precision = out.precision();
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    std::vector<copied_event> events;
+    for ( size_t b = 0; b < r.buffers.size(); ++b) {
+        events.clear();
+        copy_events( *r.buffers[b], events);
+        for ( size_t i = 0; i < events.size(); ++i) {
+            double ts = (double)(long long)(events[i].ticks - r.base_ticks) / ticks_per_us;
+            out << (first ? "\n" : ",\n")
+                << "{\"name\":\"" << events[i].name << "\",\"cat\":\"ss\",\"ph\":\"" << (events[i].is_begin ? 'B' : 'E')
+                << "\",\"ts\":" << std::fixed << ts << ",\"pid\":1,\"tid\":" << r.buffers[b]->tid << "}";
+            first = false;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    out.flags(old_flags);
+    out.precision(old_precision);
+}
+
+bool dump_chrome_trace(const std::string & file_name) {
+    std::ofstream out(file_name.c_str());
+    if ( !out)
+        return false;
+    dump_chrome_trace(out);
+    return out.good();
+}
+
+}}
+
+#endif
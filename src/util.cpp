@@ -55,39 +55,164 @@ void trim(string & value) {
         value.erase( value.size() - 1, 1);
 }
 
+namespace {
+    void unescape_into(const char_t * b, const char_t * e, string & unescaped) {
+        unescaped.erase();
+        for ( ; b != e ; ++b)
+            if ( *b == '\\' && ((b + 1) != e)) {
+                switch ( b[1]) {
+                    case '\\': unescaped += '\\'; ++b; break;
+                    case 'n': unescaped += '\n'; ++b; break;
+                    case 'r': unescaped += '\r'; ++b; break;
+                    case '"': unescaped += '"'; ++b; break;
+                    default: unescaped += *b; break;
+                }
+            }
+            else
+                unescaped += *b;
+    }
+}
+
 string unescape_string(const string & value) {
     string unescaped;
     unescaped.reserve(value.size());
+    unescape_into( value.c_str(), value.c_str() + value.size(), unescaped);
+    return unescaped;
+}
+
+void append_escaped(string & dest, const string & value) {
     for ( string::const_iterator b = value.begin(), e = value.end(); b != e ; ++b)
-        if ( *b == '\\' && ((b + 1) != e)) {
-            switch ( b[1]) {
-                case '\\': unescaped += '\\'; ++b; break;
-                case 'n': unescaped += '\n'; ++b; break;
-                case 'r': unescaped += '\r'; ++b; break;
-                case '"': unescaped += '"'; ++b; break;
-                default: unescaped += *b; break;
-            }
+        switch ( *b) {
+            case '\\': dest += TTEXT("\\\\"); break;
+            case '\n': dest += TTEXT("\\n"); break;
+            case '\r': dest += TTEXT("\\r"); break;
+            case '"':  dest += TTEXT("\\\""); break;
+            default:   dest += *b; break;
         }
-        else
-            unescaped += *b;
-    return unescaped;
 }
 
 string escape_string(const string & value) {
     string escaped;
     escaped.reserve(value.size() * 2);
-    for ( string::const_iterator b = value.begin(), e = value.end(); b != e ; ++b)
-        switch ( *b) {
-            case '\\': escaped += TTEXT("\\\\"); break;
-            case '\n': escaped += TTEXT("\\n"); break;
-            case '\r': escaped += TTEXT("\\r"); break;
-            case '"':  escaped += TTEXT("\\\""); break;
-            default:   escaped += *b; break;
-        }
+    append_escaped(escaped, value);
     return escaped;
 }
 
 
 
-}}
 
+namespace {
+    // returns where the comment starts (or line.size() if there's no comment)
+    string::size_type find_comment(const string & line) {
+        string::size_type comment = line.size();
+        for ( string::size_type idx = line.size(); idx > 0; --idx)
+            if ( line[idx - 1] == '#')
+                comment = idx - 1; // found comment
+            else if ( line[idx - 1] == '"')
+                break; // found end of string
+        return comment;
+    }
+
+    bool equals(const char_t * b, const char_t * e, const char_t * str) {
+        for ( ; b != e && *str; ++b, ++str)
+            if ( *b != *str)
+                return false;
+        return b == e && !*str;
+    }
+}
+
+/** 
+    Parses one line of a settings file: name=value # comment
+
+    The value's type is deduced from the way it's written: "quoted" is a string, true/false is a bool,
+    otherwise it's a (signed/unsigned) number or double. Anything else is considered a string.
+
+    If the line is not a setting (just a comment), returns false (and the whole line is the comment)
+*/
+bool parse_setting_line(const string & line, string & name, string & value, typeinfo & type, string & comment, size_t * raw_value_begin, size_t * raw_value_end) {
+    // note: we don't create any temporaries - name/value/comment can reuse their buffers
+    string::size_type comment_start = find_comment(line);
+    string::size_type equal = line.find('=');
+    if ( equal == string::npos || equal > comment_start) {
+        name.erase();
+        comment = line;
+        return false;
+    }
+    comment.assign(line, comment_start, string::npos);
+    name.assign(line, 0, equal);
+
+    // remove leading and trailing spaces
+    const char_t * b = line.c_str() + equal + 1, * e = line.c_str() + comment_start;
+    while ( b != e && isspace(*b)) ++b;
+    while ( b != e && isspace(e[-1])) --e;
+    if ( raw_value_begin) *raw_value_begin = b - line.c_str();
+    if ( raw_value_end) *raw_value_end = e - line.c_str();
+
+    if ( (e - b > 2) && (*b == '"') && (e[-1] == '"') ) {
+        type = typeid(string);
+        unescape_into(b + 1, e - 1, value);
+    }
+    // otherwise, it'a number or bool
+    else if ( equals(b, e, TTEXT("true"))) {
+        type = typeid(bool);
+        value = TTEXT("1");
+    }
+    else if ( equals(b, e, TTEXT("false"))) {
+        type = typeid(bool);
+        value = TTEXT("0");
+    }
+    else {
+        value.assign(b, e);
+        if ( b != e && *b == '-')
+            type = typeid(long);
+        else if ( b != e && isdigit(*b))
+            type = typeid(unsigned long);
+        else
+            // note: this could be an enum
+            type = typeid(string);
+    }
+
+    if ( type != typeid(string))
+        if ( value.find('.') != string::npos)
+            type = typeid(double);
+    return true;
+}
+
+
+// we only need 4 types: int, unsigned, double, bool, string
+typeinfo friendly_type(const typeinfo& type) {
+    if ( type == typeid(char))
+        return typeid(string);
+    else if ( type == typeid(wchar_t) )
+        return typeid(string);
+    else if ( type == typeid(unsigned char) )
+        return typeid(string);
+    else if ( type == typeid(signed char) )
+        return typeid(string);
+    else if ( type == typeid(short) )
+        return typeid(long);
+    else if ( type == typeid(unsigned short) )
+        return typeid(unsigned long);
+    else if ( type == typeid(int) )
+        return typeid(long);
+    else if ( type == typeid(unsigned int) )
+        return typeid(unsigned long);
+    else if ( type == typeid(long) )
+        return typeid(long);
+    else if ( type == typeid(unsigned long) )
+        return typeid(unsigned long);
+    else if ( type == typeid(double) )
+        return typeid(double);
+    else if ( type == typeid(float) )
+        return typeid(double);
+    else if ( type == typeid(bool) )
+        return typeid(bool);
+    else if ( type == typeid(string) )
+        return typeid(string);
+    else if ( type == typeid(variant) )
+        return typeid(variant);
+
+    return typeid(variant); // unknown
+}
+
+}}
@@ -0,0 +1,96 @@
+// Straightforward Settings Library
+//
+// Copyright 2007 John Torjo (john@macadamian.com)
+//
+// Permission to copy, use, sell and distribute this software is granted
+// provided this copyright notice appears in all copies.
+// Permission to modify the code and to distribute modified code is granted
+// provided this copyright notice appears in all copies, and a notice
+// that the code was modified is included with the copyright notice.
+//
+// This software is provided "as is" without express or implied warranty,
+// and with no claim as to its suitability for any purpose.
+//
+// Find latest version of this at http://www.macadamian.ro/drdobbs/
+
+// ssd.cpp: the settings daemon - serves a settings file to the processes on this host
+//
+//   ssd /run/my_app.sock /etc/my_app.settings [--check-ms 1000]
+//
+// The processes mount it with a socket_storage (see ss/socket_storage.h). What they set
+// is written to the file; when the file is edited, the changes are pushed to all of them.
+// Stops on SIGINT/SIGTERM.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ss/setting.h"
+#include "ss/file_storage.h"
+#include "ss/settings_daemon.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace ss {
+    // the library needs this - the daemon uses its own configuration, so nothing to do here
+    void init_settings() {}
+}
+
+namespace {
+    volatile std::sig_atomic_t g_stop = 0;
+
+    void on_signal(int) {
+        g_stop = 1;
+    }
+
+    void usage() {
+        std::cerr << "usage: ssd <socket path> <settings file> [--check-ms N]" << std::endl;
+    }
+}
+
+int main(int argc, char ** argv) {
+    if ( argc < 3) {
+        usage();
+        return 1;
+    }
+    std::string socket_path = argv[1];
+    std::string file_name = argv[2];
+    int check_ms = 1000;
+    for ( int idx = 3; idx < argc; ++idx) {
+        if ( !strcmp(argv[idx], "--check-ms") && idx + 1 < argc)
+            check_ms = atoi(argv[++idx]);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    ss::configuration conf;
+    conf.set_error_handler(ss::err::do_log_to_console);
+    ss::file_storage * file = new ss::file_storage(file_name, ss::file_storage::open_writable, ss::file_storage::save_at_interval);
+    // (so that we see it when it's edited)
+    file->set_shared(true, check_ms);
+    conf.add_storage("", file);
+
+    ss::settings_daemon daemon(conf, socket_path);
+    if ( !daemon.start()) {
+        std::cerr << "ssd: cannot listen on " << socket_path << std::endl;
+        return 1;
+    }
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    while ( !g_stop) {
+        std::this_thread::sleep_for( std::chrono::milliseconds(check_ms > 0 ? check_ms : 1000));
+        // (a read might have reloaded the file already - publishing what didn't change is cheap anyway)
+        file->check_for_changes();
+        daemon.publish();
+    }
+    daemon.stop();
+    conf.save().wait();
+    return 0;
+}